@@ -0,0 +1,157 @@
+/*****
+      bench_batch.c -
+      Benchmark for decoding many images at once with image_read_batch.
+      Decodes every file given on the command line on a thread pool of the
+      given size, with the given cap on megabytes of images in flight, and
+      prints the files and pixels decoded per second.  Files that can't be
+      read are reported and skipped.
+
+      Call:
+        bench_batch [-t <threads>] [-m <MB>] <image> ...
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "img_batch.h"
+#include "img_thread.h"
+#include "img_err.h"
+
+
+/**** Data Structures ****/
+
+/* totals kept by the callback */
+typedef struct {
+  pthread_mutex_t lock;                 /* guards everything below */
+  long nread;                           /* images decoded */
+  double npix;                          /* pixels decoded */
+} tally;
+
+
+/**** Program ****/
+
+/***
+    usage:  Print help message and exit.
+***/
+void usage(void) {
+
+  printf("Usage:  bench_batch [-t <threads>] [-m <MB>] <image> ...\n");
+  printf("  exiting ...\n");
+  exit(1);
+}
+
+/***
+    now_ms:  Read the monotonic clock.
+    returns:   current time in milliseconds
+***/
+static double now_ms(void) {
+  struct timespec ts;                   /* clock reading */
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+/***
+    count_image:  imgbatchfn adding a decoded image to the totals and
+                  freeing it.
+    args:         arg - tally
+                  idx - index of file
+                  fname - name of file
+                  img - image read, NULL if failed
+                  err - 0, or error code
+***/
+static void count_image(void *arg, long idx, const char *fname,
+                        _rgbimage *img, int err) {
+  tally *t;                             /* totals */
+
+  (void) idx;
+  t = (tally *) arg;
+
+  if (err < 0) {
+    printf("  skipped %s: %s\n", fname, img_errmsg());
+    return;
+  }
+
+  pthread_mutex_lock(&t->lock);
+  t->nread++;
+  t->npix += (double) img->ncol * img->nrow;
+  pthread_mutex_unlock(&t->lock);
+
+  free_rgbimage(&img);
+}
+
+
+int main(int argc, char **argv) {
+  thrpool *thr;                         /* pool to decode on */
+  tally t;                              /* images decoded */
+  double t0, ms;                        /* timer readings */
+  long nfail;                           /* files not read */
+  int nthread;                          /* size of pool */
+  int mb;                               /* budget in megabytes */
+  int argi;                             /* next argument */
+  int retval;
+
+  thr = NULL;
+  nthread = 0;
+  mb = 1024;
+
+  for (argi=1; (argi < argc) && ('-' == argv[argi][0]); argi+=2) {
+    if (argc <= argi + 1) {
+      usage();
+    }
+    if (0 == strcmp(argv[argi], "-t")) {
+      if ((1 != sscanf(argv[argi+1], "%d", &nthread)) || (nthread < 1)) {
+        usage();
+      }
+    } else if (0 == strcmp(argv[argi], "-m")) {
+      if ((1 != sscanf(argv[argi+1], "%d", &mb)) || (mb < 1)) {
+        usage();
+      }
+    } else {
+      usage();
+    }
+  }
+  if (argc <= argi) {
+    usage();
+  }
+
+  /* count_image prints errors with the file name, so don't log them too. */
+  img_setlog(NULL, NULL);
+
+  retval = thrpool_create(&thr, nthread);
+  if (retval < 0) {
+    printf("%s\n", img_errmsg());
+    return retval;
+  }
+
+  memset(&t, 0, sizeof(t));
+  pthread_mutex_init(&t.lock, NULL);
+
+  t0 = now_ms();
+  nfail = image_read_batch((const char **) argv + argi, argc - argi,
+                           (size_t) mb << 20, thr, NULL, count_image, &t);
+  ms = now_ms() - t0;
+
+  if (nfail < 0) {
+    printf("%s\n", img_errmsg());
+    retval = -1;
+  } else {
+    printf("\n%ld images (%ld skipped), %d threads, %d MB in flight\n",
+           t.nread, nfail, thrpool_size(thr), mb);
+    printf("  total                    %10.2f ms\n", ms);
+    printf("  images                   %10.1f /s\n", t.nread / (ms / 1e3));
+    printf("  pixels                   %10.1f M/s\n\n",
+           t.npix / 1e6 / (ms / 1e3));
+    retval = 0;
+  }
+
+  pthread_mutex_destroy(&t.lock);
+  thrpool_destroy(&thr);
+
+  return retval;
+}
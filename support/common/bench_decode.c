@@ -0,0 +1,151 @@
+/*****
+      bench_decode.c -
+      Benchmark for the cost of zero-filling image planes the decoders are
+      about to overwrite.  Times a full decode of the image given on the
+      command line (PNG or JPEG), then times allocating planes of the same
+      size zeroed and un-zeroed, each followed by one write pass standing
+      in for the decoder's output.  The difference between the two is what
+      the decoders save by using alloc_rgbimage_raw.  Use a large image
+      (hundreds of megapixels) to see the effect.
+
+      Call:
+        bench_decode <image> [<reps>]
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "img_png_v3.h"
+#include "img_jpeg_v3.h"
+#include "img_io.h"
+
+
+/**** Macros ****/
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+
+/**** Program ****/
+
+/***
+    usage:  Print help message and exit.
+***/
+void usage(void) {
+
+  printf("Usage:  bench_decode <image> [<reps>]\n");
+  printf("  exiting ...\n");
+  exit(1);
+}
+
+/***
+    now_ms:  Read the monotonic clock.
+    returns:   current time in milliseconds
+***/
+static double now_ms(void) {
+  struct timespec ts;                   /* clock reading */
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+/***
+    fill_planes:  Write every pixel of every plane, as a decoder would.
+    args:         img - image to fill
+***/
+static void fill_planes(_rgbimage *img) {
+  int y;                                /* row */
+
+  for (y=0; y<img->nrow; y++) {
+    memset(img->r + (y * img->stride), y, img->ncol);
+    memset(img->g + (y * img->stride), y, img->ncol);
+    memset(img->b + (y * img->stride), y, img->ncol);
+  }
+}
+
+
+int main(int argc, char **argv) {
+  _rgbimage *img;                       /* image read or allocated */
+  double tdec, tzero, traw;             /* best times, ms */
+  double t0, t;                         /* timer readings */
+  int ispng;                            /* true if input is PNG */
+  int ncol, nrow;                       /* size of image */
+  int nrep;                             /* times to repeat each test */
+  int i;
+  int retval;
+
+  img = NULL;
+  nrep = 5;
+  ncol = nrow = 0;
+
+  if ((2 != argc) && (3 != argc)) {
+    usage();
+  }
+
+  if ((3 == argc) && ((1 != sscanf(argv[2], "%d", &nrep)) || (nrep < 1))) {
+    usage();
+  }
+
+  ispng = (0 < PNG_isa(argv[1]));
+
+  tdec = tzero = traw = -1.0;
+  for (i=0; i<nrep; i++) {
+    t0 = now_ms();
+    retval = image_read(argv[1], &img);
+    t = now_ms() - t0;
+    CLEANUPONERR;
+    if ((tdec < 0.0) || (t < tdec)) {
+      tdec = t;
+    }
+    ncol = img->ncol;
+    nrow = img->nrow;
+    free_rgbimage(&img);
+  }
+
+  for (i=0; i<nrep; i++) {
+    t0 = now_ms();
+    retval = alloc_rgbimage_mode(&img, ncol, nrow, ALLOC_ALIGNED);
+    CLEANUPONERR;
+    fill_planes(img);
+    t = now_ms() - t0;
+    free_rgbimage(&img);
+    if ((tzero < 0.0) || (t < tzero)) {
+      tzero = t;
+    }
+
+    t0 = now_ms();
+    retval = alloc_rgbimage_raw(&img, ncol, nrow, ALLOC_ALIGNED);
+    CLEANUPONERR;
+    fill_planes(img);
+    t = now_ms() - t0;
+    free_rgbimage(&img);
+    if ((traw < 0.0) || (t < traw)) {
+      traw = t;
+    }
+  }
+
+  printf("\n%d x %d %s image, best of %d\n", ncol, nrow,
+         ispng ? "PNG" : "JPEG", nrep);
+  printf("  decode                   %10.2f ms\n", tdec);
+  printf("  zeroed alloc + fill      %10.2f ms\n", tzero);
+  printf("  raw alloc + fill         %10.2f ms\n", traw);
+  printf("  zero-fill saved          %10.2f ms  (%.1f%% of decode)\n\n",
+         tzero - traw, 100.0 * (tzero - traw) / tdec);
+
+  retval = 0;
+
+ cleanup:
+  free_rgbimage(&img);
+
+  return retval;
+}
@@ -0,0 +1,224 @@
+/*****
+      bench_kern.c -
+      Microbenchmark for the deinterleave and alpha kernels.  Splits a
+      buffer of random 1 to 4 channel pixels into planes with both the
+      scalar and vector kernels, checks they agree, and prints the
+      throughput of each in MB/s of interleaved input.  Then does the same
+      for premultiplying, unpremultiplying, and compositing random RGBA
+      planes, in MB/s of the four planes.
+
+      Call:
+        bench_kern [<pixels> [<reps>]]
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "img_kern.h"
+
+
+/**** Program ****/
+
+/***
+    usage:  Print help message and exit.
+***/
+void usage(void) {
+
+  printf("Usage:  bench_kern [<pixels> [<reps>]]\n");
+  printf("  exiting ...\n");
+  exit(1);
+}
+
+/***
+    now_ms:  Read the monotonic clock.
+    returns:   current time in milliseconds
+***/
+static double now_ms(void) {
+  struct timespec ts;                   /* clock reading */
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+/***
+    run_deint:  Time one kernel, keeping the best of several runs.
+    args:       nchan - channels in src (1 to 4)
+                vec - true to run the vector kernel, false for scalar
+                src - interleaved samples
+                r, g, b, a - planes to fill
+                n - number of pixels
+                nrep - number of runs
+    returns:   best time in ms
+***/
+static double run_deint(int nchan, int vec, const uchar *src, uchar *r,
+                        uchar *g, uchar *b, uchar *a, int n, int nrep) {
+  double best, t0, t;                   /* timer readings */
+  int i;
+
+  best = -1.0;
+  for (i=0; i<nrep; i++) {
+    t0 = now_ms();
+    if (1 == nchan) {
+      (vec ? kern_deint1 : kern_deint1_c)(src, r, g, b, n);
+    } else if (2 == nchan) {
+      (vec ? kern_deint2 : kern_deint2_c)(src, r, g, b, a, n);
+    } else if (3 == nchan) {
+      (vec ? kern_deint3 : kern_deint3_c)(src, r, g, b, n);
+    } else {
+      (vec ? kern_deint4 : kern_deint4_c)(src, r, g, b, a, n);
+    }
+    t = now_ms() - t0;
+    if ((best < 0.0) || (t < best)) {
+      best = t;
+    }
+  }
+
+  return best;
+}
+
+/***
+    run_alpha:  Time one alpha kernel, keeping the best of several runs.
+                The planes are reset from the source before each run, as
+                the kernels work in place.
+    args:       op - 0 to premultiply, 1 to unpremultiply, 2 to composite
+                     the first four planes over the last four
+                vec - true to run the vector kernel, false for scalar
+                src - 8 planes of n samples, back-to-back
+                pl - 8 planes to work on
+                n - number of pixels
+                nrep - number of runs
+    returns:   best time in ms
+***/
+static double run_alpha(int op, int vec, const uchar *src, uchar **pl,
+                        int n, int nrep) {
+  double best, t0, t;                   /* timer readings */
+  int i, p;
+
+  best = -1.0;
+  for (i=0; i<nrep; i++) {
+    for (p=0; p<8; p++) {
+      memcpy(pl[p], src + ((size_t) p * n), n);
+    }
+    t0 = now_ms();
+    if (0 == op) {
+      (vec ? kern_premul : kern_premul_c)(pl[0], pl[1], pl[2], pl[3], n);
+    } else if (1 == op) {
+      (vec ? kern_unpremul : kern_unpremul_c)(pl[0], pl[1], pl[2], pl[3], n);
+    } else {
+      (vec ? kern_over : kern_over_c)(pl[0], pl[1], pl[2], pl[3], pl[4],
+                                      pl[5], pl[6], pl[7], n);
+    }
+    t = now_ms() - t0;
+    if ((best < 0.0) || (t < best)) {
+      best = t;
+    }
+  }
+
+  return best;
+}
+
+
+int main(int argc, char **argv) {
+  uchar *src;                           /* interleaved input */
+  uchar *pl[16];                        /* planes, scalar then vector */
+  static const char *opname[3] = {      /* names of the alpha kernels */
+    "premul", "unpremul", "over"
+  };
+  double tc, tv;                        /* best scalar, vector times */
+  double mb;                            /* megabytes of input */
+  int nchan;                            /* channels being tested */
+  int op;                               /* alpha kernel being tested */
+  int npix;                             /* pixels per run */
+  int nrep;                             /* runs per kernel */
+  int i;
+  int retval;
+
+  npix = 1 << 22;
+  nrep = 10;
+  src = NULL;
+  memset(pl, 0, sizeof(pl));
+
+  if (3 < argc) {
+    usage();
+  }
+  if ((2 <= argc) && ((1 != sscanf(argv[1], "%d", &npix)) || (npix < 1))) {
+    usage();
+  }
+  if ((3 == argc) && ((1 != sscanf(argv[2], "%d", &nrep)) || (nrep < 1))) {
+    usage();
+  }
+
+  if (NULL == (src = (uchar *) malloc(8 * (size_t) npix))) {
+    printf("can't allocate input\n");
+    retval = -1;
+    goto cleanup;
+  }
+  for (i=0; i<16; i++) {
+    if (NULL == (pl[i] = (uchar *) malloc(npix))) {
+      printf("can't allocate planes\n");
+      retval = -1;
+      goto cleanup;
+    }
+  }
+
+  srand(1);
+  for (i=0; i<8*npix; i++) {
+    src[i] = rand();
+  }
+
+  printf("\nDeinterleave %d pixels, best of %d, vector kernels %s\n", npix,
+         nrep, kern_name());
+  printf("  chan      scalar MB/s    vector MB/s    speedup\n");
+
+  for (nchan=1; nchan<=4; nchan++) {
+    tc = run_deint(nchan, 0, src, pl[0], pl[1], pl[2], pl[3], npix, nrep);
+    tv = run_deint(nchan, 1, src, pl[4], pl[5], pl[6], pl[7], npix, nrep);
+
+    for (i=0; i<((0 == (nchan % 2)) ? 4 : 3); i++) {
+      if (0 != memcmp(pl[i], pl[i+4], npix)) {
+        printf("  kernels disagree for %d channels, plane %d\n", nchan, i);
+        retval = -1;
+        goto cleanup;
+      }
+    }
+
+    mb = ((double) nchan * npix) / 1e6;
+    printf("  %4d   %14.1f %14.1f %10.2fx\n", nchan, mb / (tc / 1e3),
+           mb / (tv / 1e3), tc / tv);
+  }
+
+  printf("\nAlpha kernels on %d pixels, best of %d\n", npix, nrep);
+  printf("  kernel    scalar MB/s    vector MB/s    speedup\n");
+
+  for (op=0; op<3; op++) {
+    tc = run_alpha(op, 0, src, pl, npix, nrep);
+    tv = run_alpha(op, 1, src, pl + 8, npix, nrep);
+
+    for (i=0; i<8; i++) {
+      if (0 != memcmp(pl[i], pl[i+8], npix)) {
+        printf("  kernels disagree for %s, plane %d\n", opname[op], i);
+        retval = -1;
+        goto cleanup;
+      }
+    }
+
+    mb = (4.0 * npix) / 1e6;
+    printf("  %-8s %14.1f %14.1f %10.2fx\n", opname[op], mb / (tc / 1e3),
+           mb / (tv / 1e3), tc / tv);
+  }
+  printf("\n");
+
+  retval = 0;
+
+ cleanup:
+  for (i=0; i<16; i++) {
+    free(pl[i]);
+  }
+  free(src);
+
+  return retval;
+}
@@ -0,0 +1,138 @@
+/*****
+      bench_prefetch.c -
+      Benchmark for reading ahead through a list of images.  Decodes the
+      files given on the command line one after another, first each with
+      image_read_ctx as a plain loop would, then through prefetch_read
+      with the given depth, and prints both times.  The second pass finds
+      the files in the page cache the first pass filled, so for a fair
+      comparison on real storage drop the cache between runs (as root,
+      echo 3 > /proc/sys/vm/drop_caches) and run each pass on its own
+      with -n (no prefetch) or -p.
+
+      Call:
+        bench_prefetch [-n | -p] [-d <depth>] <image> ...
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "img_io.h"
+#include "img_prefetch.h"
+#include "img_err.h"
+
+
+/**** Program ****/
+
+/***
+    usage:  Print help message and exit.
+***/
+void usage(void) {
+
+  printf("Usage:  bench_prefetch [-n | -p] [-d <depth>] <image> ...\n");
+  printf("  -n    only the plain loop\n");
+  printf("  -p    only the prefetching loop\n");
+  printf("  exiting ...\n");
+  exit(1);
+}
+
+/***
+    now_ms:  Read the monotonic clock.
+    returns:   current time in milliseconds
+***/
+static double now_ms(void) {
+  struct timespec ts;                   /* clock reading */
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (ts.tv_sec * 1e3) + (ts.tv_nsec / 1e6);
+}
+
+
+int main(int argc, char **argv) {
+  imgprefetch *pf;                      /* read-ahead of the list */
+  imgctx *ctx;                          /* codec contexts */
+  _rgbimage *img;                       /* image read */
+  const char **fnames;                  /* files to read */
+  double t0, tplain, tpf;               /* timer readings */
+  long nfile;                           /* number of files */
+  long idx;                             /* file read */
+  long i;
+  int plain, prefetch;                  /* which loops to run */
+  int depth;                            /* files to read ahead */
+  int argi;                             /* next argument */
+  int retval;
+
+  pf = NULL;
+  ctx = NULL;
+  img = NULL;
+  plain = prefetch = 1;
+  depth = 4;
+  tplain = tpf = -1.0;
+
+  for (argi=1; (argi < argc) && ('-' == argv[argi][0]); argi++) {
+    if (0 == strcmp(argv[argi], "-n")) {
+      prefetch = 0;
+    } else if (0 == strcmp(argv[argi], "-p")) {
+      plain = 0;
+    } else if ((0 == strcmp(argv[argi], "-d")) && (argi + 1 < argc)) {
+      argi++;
+      if ((1 != sscanf(argv[argi], "%d", &depth)) || (depth < 1)) {
+        usage();
+      }
+    } else {
+      usage();
+    }
+  }
+  if ((argc <= argi) || (!plain && !prefetch)) {
+    usage();
+  }
+  fnames = (const char **) argv + argi;
+  nfile = argc - argi;
+
+  retval = image_ctx_create(&ctx);
+  if (retval < 0) {
+    goto cleanup;
+  }
+
+  if (plain) {
+    t0 = now_ms();
+    for (i=0; i<nfile; i++) {
+      /* Errors are logged; keep going as a batch job would. */
+      (void) image_read_ctx(ctx, fnames[i], &img, NULL);
+    }
+    tplain = now_ms() - t0;
+  }
+
+  if (prefetch) {
+    t0 = now_ms();
+    retval = prefetch_create(&pf, fnames, nfile, depth);
+    if (retval < 0) {
+      goto cleanup;
+    }
+    while (1 != prefetch_read(pf, ctx, &idx, &img, NULL)) {
+      continue;
+    }
+    tpf = now_ms() - t0;
+  }
+
+  printf("\n%ld images, prefetch depth %d\n", nfile, depth);
+  if (plain) {
+    printf("  plain loop               %10.2f ms\n", tplain);
+  }
+  if (prefetch) {
+    printf("  prefetching loop         %10.2f ms\n", tpf);
+  }
+  printf("\n");
+
+  retval = 0;
+
+ cleanup:
+  prefetch_destroy(&pf);
+  image_ctx_destroy(&ctx);
+  free_rgbimage(&img);
+
+  return retval;
+}
@@ -0,0 +1,280 @@
+/*****
+      img_batch.c -
+      Decode a list of images in parallel.  The list is run as one loop on
+      a thread pool, a file per iteration.  Before decoding, a file's
+      header is probed and image_need predicts the bytes it needs (its
+      planes, with alpha if the file has an alpha channel or a tRNS chunk,
+      plus the whole decoded image libpng buffers for an interlaced PNG),
+      and the thread waits its turn to add them to the bytes in flight.
+      Turns are handed out as tickets, so a file that doesn't fit holds
+      back the ones after it rather than being passed over by smaller
+      files forever.
+
+      Each file is opened once, with imginput_open, and the same input is
+      probed and then decoded.  Only a file that can't be mapped (a pipe,
+      say) is read past its header by the probe, and is opened again.
+
+      A thread waiting in the pool helps with any loop queued there,
+      including this one, so a decode may start another file from inside
+      a kernel's parallel loop.  That thread already holds bytes the
+      budget is waiting on, so it skips the queue rather than deadlock;
+      the budget can then be exceeded by the images nested this way.
+
+      Public Interface:
+        image_read_batch - decode a list of images on a thread pool
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "img_batch.h"
+#include "img_io.h"
+#include "img_err.h"
+
+
+/**** Data Structures ****/
+
+/* codec contexts not in use, kept for the next range of files */
+typedef struct __ctxnode {
+  imgctx *ctx;                          /* PNG and JPEG contexts */
+  struct __ctxnode *next;               /* next free contexts */
+} ctxnode;
+
+/* a batch being decoded */
+typedef struct {
+  const char **fnames;                  /* files to read */
+  rgbpool *pool;                        /* where images come from */
+  imgbatchfn done;                      /* callback for each image */
+  void *arg;                            /* its argument */
+  pthread_mutex_t lock;                 /* guards everything below */
+  pthread_cond_t turn;                  /* bytes freed or ticket served */
+  size_t budget;                        /* most bytes in flight */
+  size_t inflight;                      /* bytes of files started */
+  unsigned long next;                   /* next ticket to hand out */
+  unsigned long serving;                /* ticket allowed to start */
+  long nfail;                           /* files that couldn't be read */
+  ctxnode *ctxfree;                     /* contexts not in use */
+} batch;
+
+
+
+/**** Local Variables ****/
+
+/* number of files this thread has started and not yet delivered */
+static _Thread_local int nheld = 0;
+
+
+
+/**** Local Functions ****/
+
+/***
+    batch_start:  Wait for our turn and for room under the budget, then
+                  count a file's bytes in flight.  A file bigger than the
+                  whole budget starts once nothing else is in flight.
+    args:         b - batch
+                  need - bytes the file will use
+    modifies:     b
+***/
+static void batch_start(batch *b, size_t need) {
+  unsigned long ticket;                 /* our place in line */
+
+  pthread_mutex_lock(&b->lock);
+  if (0 == nheld) {
+    ticket = b->next++;
+    while ((ticket != b->serving) ||
+           ((0 < b->inflight) && (b->budget < b->inflight + need))) {
+      pthread_cond_wait(&b->turn, &b->lock);
+    }
+    b->serving++;
+    /* The next in line may fit too. */
+    pthread_cond_broadcast(&b->turn);
+  }
+  b->inflight += need;
+  pthread_mutex_unlock(&b->lock);
+}
+
+/***
+    batch_end:  Take a file's bytes out of flight, letting others start.
+    args:       b - batch
+                need - bytes the file was counted for
+                failed - true if the file couldn't be read
+    modifies:   b
+***/
+static void batch_end(batch *b, size_t need, int failed) {
+
+  pthread_mutex_lock(&b->lock);
+  b->inflight -= need;
+  if (failed) {
+    b->nfail++;
+  }
+  pthread_cond_broadcast(&b->turn);
+  pthread_mutex_unlock(&b->lock);
+}
+
+/***
+    batch_file:  Read one file of the batch and deliver it.
+    args:        b - batch
+                 ctx - codec contexts to read with, may be NULL
+                 idx - index of file in list
+    modifies:    b, ctx
+***/
+static void batch_file(batch *b, imgctx *ctx, long idx) {
+  const char *fname;                    /* file to read */
+  imginput in;                          /* its contents */
+  _rgbimage *img;                       /* image read */
+  imginfo info;                         /* what the header says */
+  size_t need;                          /* bytes predicted */
+  int opened;                           /* true while in is open */
+  int started;                          /* true once counted in flight */
+  int retval;
+
+  fname = b->fnames[idx];
+  img = NULL;
+  need = 0;
+  opened = 0;
+  started = 0;
+
+  retval = imginput_open(&in, fname);
+  if (0 <= retval) {
+    opened = 1;
+    retval = image_probe_input(&in, fname, &info);
+  }
+
+  /* The probe only looks at a mapped file, but reads a stream past its
+     header, so that has to start over. */
+  if ((0 <= retval) && (NULL == in.buf)) {
+    opened = 0;
+    retval = imginput_close(&in, fname);
+    if (0 <= retval) {
+      retval = imginput_open(&in, fname);
+      opened = (0 <= retval);
+    }
+  }
+
+  /* A file we can't probe won't decode either, so needs no turn. */
+  if (0 <= retval) {
+    need = image_need(&info);
+    batch_start(b, need);
+    started = 1;
+    nheld++;
+    retval = image_read_input(ctx, fname, &in, &img, b->pool);
+  }
+
+  if (opened && (imginput_close(&in, fname) < 0) && (0 <= retval)) {
+    retval = img_errcode();
+  }
+  if (retval < 0) {
+    rgbpool_release(b->pool, &img);
+  }
+
+  b->done(b->arg, idx, fname, img, (retval < 0) ? retval : 0);
+
+  if (started) {
+    nheld--;
+  }
+  batch_end(b, need, retval < 0);
+}
+
+/***
+    batch_range:  thrbody reading a range of the list, with contexts from
+                  the free list (or new ones) for the whole range.
+    args:         arg - batch
+                  lo, hi - files to read
+***/
+static void batch_range(void *arg, long lo, long hi) {
+  batch *b;                             /* the batch */
+  ctxnode *node;                        /* contexts to use */
+  long i;
+
+  b = (batch *) arg;
+
+  pthread_mutex_lock(&b->lock);
+  node = b->ctxfree;
+  if (NULL != node) {
+    b->ctxfree = node->next;
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  /* Without contexts each file just gets fresh ones. */
+  if ((NULL == node) &&
+      (NULL != (node = (ctxnode *) calloc(1, sizeof(ctxnode))))) {
+    (void) image_ctx_create(&node->ctx);
+  }
+
+  for (i=lo; i<hi; i++) {
+    batch_file(b, node ? node->ctx : NULL, i);
+  }
+
+  if (NULL != node) {
+    pthread_mutex_lock(&b->lock);
+    node->next = b->ctxfree;
+    b->ctxfree = node;
+    pthread_mutex_unlock(&b->lock);
+  }
+}
+
+
+
+/**** Batch Functions ****/
+
+/***
+    image_read_batch:  Decode a list of images on a thread pool, passing
+                       each to a callback as it's done, with at most
+                       budget bytes of images in flight.
+    args:              fnames - files to read
+                       n - number of files
+                       budget - most bytes of images being decoded or
+                                delivered at once
+                       thr - thread pool, NULL for the shared pool
+                       pool - image pool, NULL to allocate images
+                       done - callback for each image
+                       arg - passed to done
+    returns:   number of files that couldn't be read
+               < 0 if the batch couldn't start
+***/
+long image_read_batch(const char **fnames, long n, size_t budget,
+                      thrpool *thr, rgbpool *pool, imgbatchfn done,
+                      void *arg) {
+  batch b;                              /* the batch */
+  ctxnode *node;                        /* contexts to release */
+
+  if ((NULL == fnames) || (NULL == done) || (n < 0)) {
+    return img_error(IMGERR_ARG, "no files or callback for batch");
+  }
+
+  b.fnames = fnames;
+  b.pool = pool;
+  b.done = done;
+  b.arg = arg;
+  b.budget = budget;
+  b.inflight = 0;
+  b.next = b.serving = 0;
+  b.nfail = 0;
+  b.ctxfree = NULL;
+
+  if (0 != pthread_mutex_init(&b.lock, NULL)) {
+    return img_error(IMGERR_FAIL, "can't initialize batch lock");
+  }
+  if (0 != pthread_cond_init(&b.turn, NULL)) {
+    pthread_mutex_destroy(&b.lock);
+    return img_error(IMGERR_FAIL, "can't initialize batch condition");
+  }
+
+  if (NULL == thr) {
+    thr = thrpool_shared();
+  }
+  thrpool_parfor(thr, 0, n, 1, batch_range, &b);
+
+  while (NULL != (node = b.ctxfree)) {
+    b.ctxfree = node->next;
+    image_ctx_destroy(&node->ctx);
+    free(node);
+  }
+  pthread_cond_destroy(&b.turn);
+  pthread_mutex_destroy(&b.lock);
+
+  return b.nfail;
+}
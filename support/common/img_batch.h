@@ -0,0 +1,63 @@
+/*****
+      img_batch.h -
+      Public declarations for decoding a list of images in parallel.  The
+      files are read on a thread pool, each with codec contexts kept from
+      its thread's last image, and every image is handed to a callback as
+      soon as it's done.  A cap on bytes in flight keeps a few huge files
+      from running the machine out of memory: each file's header is probed
+      first, and it only starts decoding once the planes it will need fit
+      under the cap with those of the images already being decoded or
+      delivered.
+
+      Public Interface:
+        image_read_batch - decode a list of images on a thread pool
+
+      Required Libraries:
+        libpng, libjpeg
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGBATCH
+#define _IMGBATCH 1
+
+#include "img_rgb.h"
+#include "img_rgbpool.h"
+#include "img_thread.h"
+
+
+/*** Data Structures ***/
+
+/* callback getting each image, from the thread that decoded it; several
+   may run at once
+     arg - argument given to image_read_batch
+     idx - index of the file in the list
+     fname - name of the file
+     img - image read, which now belongs to the callback, or NULL if the
+           file couldn't be read
+     err - 0 if read, else the IMGERR_* code (with img_errmsg in this
+           thread saying why)
+*/
+typedef void (*imgbatchfn)(void *, long, const char *, _rgbimage *, int);
+
+
+/*** External Functions ***/
+
+/* decode a list of images in parallel, returning when all are delivered
+     fnames - files to read
+     n - number of files
+     budget - most bytes of images in flight, from the start of a decode
+              until its callback returns (a single image larger than this
+              still runs, alone)
+     thr - thread pool to decode on (if NULL, use thrpool_shared)
+     pool - image pool to draw images from, NULL to allocate them
+     done - callback for each image
+     arg - passed to done
+   returns number of files that couldn't be read, < 0 if the batch
+   couldn't start
+*/
+extern long image_read_batch(const char **, long, size_t, thrpool *,
+                             rgbpool *, imgbatchfn, void *);
+
+
+#endif   /* _IMGBATCH */
@@ -0,0 +1,188 @@
+/*****
+      img_err.c -
+      Error reporting for the library.  The last error is kept in thread-
+      local storage, so a failure in one thread is never seen by, or
+      overwritten by, another.  Messages are formatted into a buffer with
+      vsnprintf and system errors are described with strerror_r, neither
+      of which shares state between threads.  The log function is the one
+      shared setting; it is read under a lock so a function and its
+      argument are always seen together.
+
+      Public Interface:
+        img_error - record an error and log it
+        img_syserror - record an error from a failed system call
+        img_warning - log a warning
+        img_errcode - code of this thread's last error
+        img_errmsg - message for this thread's last error
+        img_errclear - forget this thread's last error
+        img_setlog - install the log function
+        img_logstderr - the default log function
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "img_err.h"
+
+
+
+/**** Local Variables ****/
+
+/* this thread's last error */
+static _Thread_local int lastcode = IMGERR_OK;
+static _Thread_local char lastmsg[IMGERR_MSGLEN];
+
+/* where messages go, guarded by loglock */
+static pthread_mutex_t loglock = PTHREAD_MUTEX_INITIALIZER;
+static imglogfn logfn = img_logstderr;
+static void *logarg = NULL;
+
+
+
+/**** Local Functions ****/
+
+/***
+    log_msg:  Pass a message to the log function, if there is one.
+    args:     code - IMGERR_* of an error, IMGERR_OK for a warning
+              msg - message
+***/
+static void log_msg(int code, const char *msg) {
+  imglogfn fn;                          /* log function */
+  void *arg;                            /* its argument */
+
+  pthread_mutex_lock(&loglock);
+  fn = logfn;
+  arg = logarg;
+  pthread_mutex_unlock(&loglock);
+
+  if (NULL != fn) {
+    fn(code, msg, arg);
+  }
+}
+
+
+
+/**** Error Functions ****/
+
+/***
+    img_error:  Record an error for this thread and log it.
+    args:       code - IMGERR_* what went wrong
+                fmt, ... - message, as for printf
+    returns:   code, so callers can return img_error(...)
+***/
+int img_error(int code, const char *fmt, ...) {
+  va_list args;                         /* message arguments */
+
+  va_start(args, fmt);
+  vsnprintf(lastmsg, sizeof(lastmsg), fmt, args);
+  va_end(args);
+  lastcode = code;
+
+  log_msg(code, lastmsg);
+
+  return code;
+}
+
+/***
+    img_syserror:  Record an error from a failed system call for this
+                   thread, adding ": <reason>" for errnum, and log it.
+    args:          code - IMGERR_* what went wrong
+                   errnum - errno from the call
+                   fmt, ... - message, as for printf
+    returns:   code
+***/
+int img_syserror(int code, int errnum, const char *fmt, ...) {
+  va_list args;                         /* message arguments */
+  size_t n;                             /* length of message so far */
+
+  va_start(args, fmt);
+  vsnprintf(lastmsg, sizeof(lastmsg), fmt, args);
+  va_end(args);
+
+  n = strlen(lastmsg);
+  if (n + 3 < sizeof(lastmsg)) {
+    lastmsg[n++] = ':';
+    lastmsg[n++] = ' ';
+    if (0 != strerror_r(errnum, lastmsg + n, sizeof(lastmsg) - n)) {
+      snprintf(lastmsg + n, sizeof(lastmsg) - n, "error %d", errnum);
+    }
+  }
+  lastcode = code;
+
+  log_msg(code, lastmsg);
+
+  return code;
+}
+
+/***
+    img_warning:  Log a warning.  The last error is left alone.
+    args:         fmt, ... - message, as for printf
+***/
+void img_warning(const char *fmt, ...) {
+  char msg[IMGERR_MSGLEN];              /* formatted message */
+  va_list args;                         /* message arguments */
+
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  log_msg(IMGERR_OK, msg);
+}
+
+/***
+    img_errcode:  Get the code of this thread's last error.
+    returns:   IMGERR_* code, IMGERR_OK if none
+***/
+int img_errcode(void) {
+
+  return lastcode;
+}
+
+/***
+    img_errmsg:  Get the message of this thread's last error.
+    returns:   message, "" if none; valid until this thread's next error
+***/
+const char *img_errmsg(void) {
+
+  return lastmsg;
+}
+
+/***
+    img_errclear:  Forget this thread's last error.
+***/
+void img_errclear(void) {
+
+  lastcode = IMGERR_OK;
+  lastmsg[0] = '\0';
+}
+
+/***
+    img_setlog:  Install the log function for all threads.
+    args:        fn - function to call, NULL to only keep messages
+                 arg - passed to fn with each message
+***/
+void img_setlog(imglogfn fn, void *arg) {
+
+  pthread_mutex_lock(&loglock);
+  logfn = fn;
+  logarg = arg;
+  pthread_mutex_unlock(&loglock);
+}
+
+/***
+    img_logstderr:  Write a message to stderr as one line, warnings marked
+                    as such.  stdio locks the stream for the one call, so
+                    lines from different threads don't interleave.
+    args:           code - IMGERR_* of an error, IMGERR_OK for a warning
+                    msg - message
+                    arg - not used
+***/
+void img_logstderr(int code, const char *msg, void *arg) {
+
+  (void) arg;
+  fprintf(stderr, "%s%s\n", (IMGERR_OK == code) ? "warning: " : "", msg);
+}
@@ -0,0 +1,108 @@
+/*****
+      img_err.h -
+      Public declarations for the library's error reporting.  Functions
+      that fail return one of the IMGERR_* codes below (all < 0) and leave
+      a message, kept per thread, that says what went wrong.  Each message
+      and warning is also passed to a log function, which by default
+      writes it as one line to stderr; a program can install its own, or
+      none.  Nothing here shares state between threads except the log
+      function, so the codecs can report errors from many threads at once.
+
+      Public Interface:
+        img_error - record an error and log it
+        img_syserror - record an error from a failed system call
+        img_warning - log a warning
+        img_errcode - code of this thread's last error
+        img_errmsg - message for this thread's last error
+        img_errclear - forget this thread's last error
+        img_setlog - install the log function
+        img_logstderr - the default log function
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGERR
+#define _IMGERR 1
+
+
+/*** Constants ***/
+
+/* longest message kept, with its terminating NUL */
+#define IMGERR_MSGLEN  256
+
+
+/*** Data Structures ***/
+
+/* error codes; functions return these, so all but IMGERR_OK are < 0 */
+enum imgerr {
+  IMGERR_OK = 0,                        /* no error */
+  IMGERR_FAIL = -1,                     /* failure not covered below */
+  IMGERR_NOMEM = -2,                    /* out of memory */
+  IMGERR_IO = -3,                       /* open, read, write, or close */
+  IMGERR_FORMAT = -4,                   /* not the format expected, or
+                                           damaged */
+  IMGERR_UNSUPPORTED = -5,              /* valid file we don't handle */
+  IMGERR_ARG = -6,                      /* bad argument */
+  IMGERR_CODEC = -7                     /* libpng or libjpeg failed */
+};
+
+/* log function, called from the thread with the problem
+     code - IMGERR_* of an error, IMGERR_OK for a warning
+     msg - message, no trailing newline
+     arg - argument given to img_setlog
+*/
+typedef void (*imglogfn)(int, const char *, void *);
+
+
+/*** External Functions ***/
+
+/* record an error for this thread and log it
+     code - IMGERR_* what went wrong
+     fmt, ... - message, as for printf
+   returns code
+*/
+extern int img_error(int, const char *, ...)
+  __attribute__((format(printf, 2, 3)));
+
+/* record an error from a failed system call, adding the reason for errnum
+   to the message
+     code - IMGERR_* what went wrong
+     errnum - errno from the call
+     fmt, ... - message, as for printf
+   returns code
+*/
+extern int img_syserror(int, int, const char *, ...)
+  __attribute__((format(printf, 3, 4)));
+
+/* log a warning; this doesn't change the last error
+     fmt, ... - message, as for printf
+*/
+extern void img_warning(const char *, ...)
+  __attribute__((format(printf, 1, 2)));
+
+/* code of the last error in this thread, IMGERR_OK if none since the last
+   img_errclear (successful calls don't clear it)
+*/
+extern int img_errcode(void);
+
+/* message of the last error in this thread, "" if none */
+extern const char *img_errmsg(void);
+
+/* forget the last error in this thread */
+extern void img_errclear(void);
+
+/* install the function messages are logged to, for all threads; best done
+   before any are started
+     fn - log function (if NULL, messages are only kept)
+     arg - passed to fn with each message
+*/
+extern void img_setlog(imglogfn, void *);
+
+/* default log function, writing each message as one line to stderr with
+   a single call, so lines from different threads don't mix
+     code, msg, arg - as imglogfn (arg not used)
+*/
+extern void img_logstderr(int, const char *, void *);
+
+
+#endif   /* _IMGERR */
@@ -0,0 +1,113 @@
+/*****
+      img_input.c -
+      The input source for the decoders.  Regular files are mapped read-
+      only with a hint that they'll be read front to back, so the kernel
+      reads ahead aggressively and can drop pages behind us.  Other inputs
+      fall back to a stdio stream.
+
+      Public Interface:
+        imginput_open - open a file for a decoder, mapping it if possible
+        imginput_close - release the file
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "img_input.h"
+#include "img_err.h"
+
+
+
+/**** Input Support ****/
+
+/***
+    imginput_open:  Open a file for a decoder.  A regular file with data
+                    is mapped and advised MADV_SEQUENTIAL; if that's not
+                    possible the file is wrapped in a stdio stream.  stdin
+                    is always a stream.
+    args:           in - input to set up
+                    fname - name of file to open, if NULL use stdin
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  in
+***/
+int imginput_open(imginput *in, const char *fname) {
+  struct stat st;                       /* file information */
+  void *map;                            /* mapped file */
+  int fd;                               /* file descriptor */
+  int retval;
+
+  in->fin = NULL;
+  in->buf = NULL;
+  in->nbuf = 0;
+
+  if (NULL == fname) {
+    in->fin = stdin;
+    return 0;
+  }
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    return img_syserror(IMGERR_IO, errno, "can't open file %s to read",
+                        fname);
+  }
+
+  if ((0 == fstat(fd, &st)) && S_ISREG(st.st_mode) && (0 < st.st_size)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED != map) {
+      /* Only a hint; the read works the same if it's ignored. */
+      (void) madvise(map, st.st_size, MADV_SEQUENTIAL);
+      close(fd);
+      in->buf = (const uchar *) map;
+      in->nbuf = st.st_size;
+      return 0;
+    }
+  }
+
+  in->fin = fdopen(fd, "r");
+  if (NULL == in->fin) {
+    retval = img_syserror(IMGERR_IO, errno, "can't open file %s to read",
+                          fname);
+    close(fd);
+    return retval;
+  }
+
+  return 0;
+}
+
+/***
+    imginput_close:  Unmap or close a file opened with imginput_open.
+    args:            in - input to close
+                     fname - name of file, for messages
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  in
+***/
+int imginput_close(imginput *in, const char *fname) {
+  int retval;
+
+  retval = 0;
+  if (NULL != in->buf) {
+    if (0 != munmap((void *) in->buf, in->nbuf)) {
+      retval = img_syserror(IMGERR_IO, errno, "problem unmapping %s", fname);
+    }
+  } else if (NULL != in->fin) {
+    if (0 != fclose(in->fin)) {
+      retval = img_syserror(IMGERR_IO, errno, "problem closing %s", fname);
+    }
+  }
+
+  in->fin = NULL;
+  in->buf = NULL;
+  in->nbuf = 0;
+
+  return retval;
+}
@@ -0,0 +1,53 @@
+/*****
+      img_input.h -
+      Public declarations for the input source the decoders read from.  A
+      regular file is mapped into memory, so the codecs read it straight
+      from the page cache with no copy into stdio buffers and no read
+      calls.  Anything that can't be mapped (stdin, pipes, empty files) is
+      read through stdio as before.
+
+      Public Interface:
+        imginput_open - open a file for a decoder, mapping it if possible
+        imginput_close - release the file
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGINPUT
+#define _IMGINPUT 1
+
+#include <stdio.h>
+
+#include "img_rgb.h"
+
+
+/*** Data Structures ***/
+
+/* an open input, either mapped (buf non-NULL) or a stream (fin non-NULL) */
+typedef struct {
+  FILE *fin;                            /* stream, if not mapped */
+  const uchar *buf;                     /* mapped file contents */
+  size_t nbuf;                          /* bytes mapped */
+} imginput;
+
+
+/*** External Functions ***/
+
+/* open a file for reading, mapping it if it is a regular, non-empty file
+     in - input to set up
+     fname - name of file to open (if NULL, use stdin)
+   returns < 0 on error
+   modifies in
+*/
+extern int imginput_open(imginput *, const char *);
+
+/* release an input opened with imginput_open
+     in - input to close
+     fname - name of file, for messages
+   returns < 0 on error
+   modifies in
+*/
+extern int imginput_close(imginput *, const char *);
+
+
+#endif   /* _IMGINPUT */
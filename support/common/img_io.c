@@ -0,0 +1,679 @@
+/*****
+      img_io.c -
+      Read and write images in whichever format they're in.  Reading a
+      file this way costs one open: the first bytes of the input are
+      checked for a signature and the input is passed, still open and
+      unread, to the PNG or JPEG decoder.  Checking with PNG_isa or
+      JPEG_isa first and then reading opens the file twice.
+
+      Public Interface:
+        image_sniff - identify the format of an open input
+        image_probe - read an image's size and layout from its header
+        image_probe_input - same, from an already open input
+        image_need - predict the memory an image takes to decode
+        image_read - read a PNG or JPEG image from disk
+        image_read_pool - read an image into a block from an image pool
+        image_read_ctx - read an image with kept codec contexts
+        image_read_input - read an image from an already open input
+        image_write - write an image in the format its name implies
+        image_write_ctx - write an image with kept codec contexts
+        image_ctx_create - make PNG and JPEG codec contexts
+        image_ctx_destroy - release the codec contexts
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "img_io.h"
+#include "img_err.h"
+#include "img_png_v3.h"
+#include "img_jpeg_v3.h"
+
+
+
+/**** Macros ****/
+
+/***
+    RETONERR:  If the previous function call returned an error code (< 0),
+               exit the function, returning the code.  Assumes the code has
+               been assigned to a local variable 'retval'.
+***/
+#define RETONERR     { if (retval < 0) { return retval; }}
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+/***
+    BE16, BE32:  Big-endian (network order) value starting at byte p.
+***/
+#define BE16(p)      (((p)[0] << 8) | (p)[1])
+#define BE32(p)      (((uint32_t) (p)[0] << 24) | ((p)[1] << 16) | \
+                      ((p)[2] << 8) | (p)[3])
+
+
+
+/**** Data Structures ****/
+
+/* a codec context for each format */
+struct __imgctx {
+  pngctx *png;                          /* PNG context */
+  jpgctx *jpeg;                         /* JPEG context */
+};
+
+/* an input being probed, with how far into a mapped file we've read */
+typedef struct {
+  imginput *in;                         /* input to read */
+  size_t pos;                           /* next byte if mapped */
+} probesrc;
+
+
+
+/**** Local Variables ****/
+
+/* PNG file signature */
+static const uchar png_sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a,
+                                  '\n' };
+
+/* JPEG SOI marker and the 0xff that starts the next marker */
+static const uchar jpeg_sig[3] = { 0xff, 0xd8, 0xff };
+
+
+
+
+/**** Local Functions ****/
+
+/***
+    probe_get:  Read the next bytes of a probed input.
+    args:       src - input to read
+                dst - buffer to fill
+                n - number of bytes
+    returns:   0 if successful
+               < 0 if the input ends first
+    modifies:  src, dst
+***/
+static int probe_get(probesrc *src, uchar *dst, size_t n) {
+
+  if (NULL != src->in->buf) {
+    if (src->in->nbuf - src->pos < n) {
+      return -1;
+    }
+    memcpy(dst, src->in->buf + src->pos, n);
+    src->pos += n;
+    return 0;
+  }
+
+  return (n == fread(dst, 1, n, src->in->fin)) ? 0 : -1;
+}
+
+/***
+    probe_skip:  Step over bytes of a probed input.  A stream may be a
+                 pipe, so we read through the bytes rather than seek.
+    args:        src - input to read
+                 n - number of bytes
+    returns:   0 if successful
+               < 0 if the input ends first
+    modifies:  src
+***/
+static int probe_skip(probesrc *src, size_t n) {
+  uchar skip[256];                      /* bytes read and dropped */
+  size_t nrd;                           /* bytes in one read */
+
+  if (NULL != src->in->buf) {
+    if (src->in->nbuf - src->pos < n) {
+      return -1;
+    }
+    src->pos += n;
+    return 0;
+  }
+
+  while (0 < n) {
+    nrd = (n < sizeof(skip)) ? n : sizeof(skip);
+    if (nrd != fread(skip, 1, nrd, src->in->fin)) {
+      return -1;
+    }
+    n -= nrd;
+  }
+
+  return 0;
+}
+
+/***
+    probe_png:  Read the IHDR chunk, which the PNG spec requires be first
+                after the signature, then walk the chunks up to the image
+                data looking for transparency (tRNS), which the decoder
+                turns into an alpha plane.  A file that ends before its
+                image data is left for the decoder to report.
+    args:       src - input to read, at its start
+                info - what the header holds
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  src, info
+***/
+static int probe_png(probesrc *src, imginfo *info) {
+  uchar hdr[8 + 8 + 13];                /* signature, chunk head, IHDR */
+  uchar chunk[8];                       /* length and type of a chunk */
+  const uchar *ihdr;                    /* IHDR data */
+  uint32_t w, h;                        /* image size */
+
+  if (probe_get(src, hdr, sizeof(hdr)) < 0) {
+    return img_error(IMGERR_FORMAT, "PNG header is truncated");
+  }
+  if ((0 != memcmp(hdr, png_sig, sizeof(png_sig))) ||
+      (13 != BE32(hdr + 8)) || (0 != memcmp(hdr + 12, "IHDR", 4))) {
+    return img_error(IMGERR_FORMAT, "input is not in PNG format");
+  }
+
+  ihdr = hdr + 16;
+  w = BE32(ihdr);
+  h = BE32(ihdr + 4);
+  if ((0 == w) || (0 == h) || (0x7fffffff < w) || (0x7fffffff < h)) {
+    return img_error(IMGERR_FORMAT, "bad PNG image size %u x %u", w, h);
+  }
+
+  info->fmt = IMG_PNG;
+  info->ncol = w;
+  info->nrow = h;
+  info->depth = ihdr[8];
+  info->interlace = (0 != ihdr[12]);
+  switch (ihdr[9]) {
+  case 0:
+    info->clr = IMGCLR_GREY;
+    info->nchan = 1;
+    break;
+  case 2:
+    info->clr = IMGCLR_RGB;
+    info->nchan = 3;
+    break;
+  case 3:
+    info->clr = IMGCLR_PALETTE;
+    info->nchan = 1;
+    break;
+  case 4:
+    info->clr = IMGCLR_GREYA;
+    info->nchan = 2;
+    break;
+  case 6:
+    info->clr = IMGCLR_RGBA;
+    info->nchan = 4;
+    break;
+  default:
+    return img_error(IMGERR_FORMAT, "bad PNG color type %d", ihdr[9]);
+  }
+  info->alpha = (IMGCLR_GREYA == info->clr) || (IMGCLR_RGBA == info->clr);
+
+  /* tRNS must come before the first IDAT; step over IHDR's CRC and then
+     each chunk's data and CRC until one or the other turns up. */
+  if (probe_skip(src, 4) < 0) {
+    return 0;
+  }
+  while (0 == probe_get(src, chunk, sizeof(chunk))) {
+    if (0 == memcmp(chunk + 4, "IDAT", 4)) {
+      break;
+    }
+    if (0 == memcmp(chunk + 4, "tRNS", 4)) {
+      info->alpha = 1;
+      break;
+    }
+    if (probe_skip(src, (size_t) BE32(chunk) + 4) < 0) {
+      break;
+    }
+  }
+
+  return 0;
+}
+
+/***
+    probe_jpeg:  Walk the markers of a JPEG up to its frame header (SOFn),
+                 noting the JFIF and Adobe markers that decide how three
+                 or four components are to be read, the same way libjpeg
+                 does.
+    args:        src - input to read, at its start
+                 info - what the header holds
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  src, info
+***/
+static int probe_jpeg(probesrc *src, imginfo *info) {
+  uchar seg[6 + 3 * 4];                 /* start of a marker segment */
+  uchar mk[2];                          /* marker */
+  int jfif;                             /* true if JFIF APP0 seen */
+  int adobe;                            /* Adobe transform, -1 if none */
+  int len;                              /* segment length after itself */
+  int nrd;                              /* bytes of segment read */
+  int ncomp;                            /* components in frame */
+  int retval;
+
+  retval = probe_get(src, mk, 2);
+  if ((retval < 0) || (0xff != mk[0]) || (0xd8 != mk[1])) {
+    return img_error(IMGERR_FORMAT, "input is not in JPEG format");
+  }
+
+  jfif = 0;
+  adobe = -1;
+  for (;;) {
+    /* Markers may be padded with any number of 0xff. */
+    retval = probe_get(src, mk, 1);
+    CLEANUPONERR;
+    if (0xff != mk[0]) {
+      return img_error(IMGERR_FORMAT, "bad JPEG marker 0x%02x", mk[0]);
+    }
+    do {
+      retval = probe_get(src, mk + 1, 1);
+      CLEANUPONERR;
+    } while (0xff == mk[1]);
+
+    /* Standalone markers have no segment. */
+    if ((0x01 == mk[1]) || ((0xd0 <= mk[1]) && (mk[1] <= 0xd7))) {
+      continue;
+    }
+    if ((0xd9 == mk[1]) || (0xda == mk[1])) {
+      return img_error(IMGERR_FORMAT,
+                       "JPEG has no frame header before its image data");
+    }
+
+    retval = probe_get(src, seg, 2);
+    CLEANUPONERR;
+    len = BE16(seg) - 2;
+    if (len < 0) {
+      return img_error(IMGERR_FORMAT, "bad JPEG marker length");
+    }
+
+    /* SOF0-SOF15, except DHT (c4), JPG (c8), and DAC (cc). */
+    if ((0xc0 <= mk[1]) && (mk[1] <= 0xcf) && (0xc4 != mk[1]) &&
+        (0xc8 != mk[1]) && (0xcc != mk[1])) {
+      break;
+    }
+
+    nrd = 0;
+    if ((0xe0 == mk[1]) && (5 <= len)) {
+      nrd = 5;
+      retval = probe_get(src, seg, nrd);
+      CLEANUPONERR;
+      jfif = (0 == memcmp(seg, "JFIF", 5));
+    } else if ((0xee == mk[1]) && (12 <= len)) {
+      nrd = 12;
+      retval = probe_get(src, seg, nrd);
+      CLEANUPONERR;
+      if (0 == memcmp(seg, "Adobe", 5)) {
+        adobe = seg[11];
+      }
+    }
+    retval = probe_skip(src, len - nrd);
+    CLEANUPONERR;
+  }
+
+  /* Precision, height, width, components, and each component's id. */
+  if ((len < 6) || (probe_get(src, seg, 6) < 0)) {
+    return img_error(IMGERR_FORMAT, "JPEG frame header is truncated");
+  }
+  ncomp = seg[5];
+  if ((ncomp < 1) || (len < 6 + 3 * ncomp)) {
+    return img_error(IMGERR_FORMAT, "bad JPEG frame header");
+  }
+  if (0 == BE16(seg + 1)) {
+    return img_error(IMGERR_UNSUPPORTED,
+                     "JPEG height is set after the image data (DNL), "
+                     "can't probe");
+  }
+
+  info->fmt = IMG_JPEG;
+  info->depth = seg[0];
+  info->nrow = BE16(seg + 1);
+  info->ncol = BE16(seg + 3);
+  info->nchan = ncomp;
+  info->interlace = ((0xc2 == mk[1]) || (0xc6 == mk[1]) ||
+                     (0xca == mk[1]) || (0xce == mk[1]));
+
+  if (1 == ncomp) {
+    info->clr = IMGCLR_GREY;
+  } else if (3 == ncomp) {
+    /* JFIF is always YCbCr; otherwise Adobe's transform 0 means RGB, and
+       with neither marker libjpeg takes ids 'R', 'G', 'B' to mean RGB. */
+    info->clr = IMGCLR_YCC;
+    if (!jfif && (0 == adobe)) {
+      info->clr = IMGCLR_RGB;
+    } else if (!jfif && (adobe < 0) &&
+               (0 == probe_get(src, seg + 6, 3 * ncomp)) &&
+               ('R' == seg[6]) && ('G' == seg[9]) && ('B' == seg[12])) {
+      info->clr = IMGCLR_RGB;
+    }
+  } else if (4 == ncomp) {
+    info->clr = (2 == adobe) ? IMGCLR_YCCK : IMGCLR_CMYK;
+  } else {
+    return img_error(IMGERR_UNSUPPORTED,
+                     "can't handle JPEG with %d components", ncomp);
+  }
+
+  retval = 0;
+
+ cleanup:
+  if (retval < 0) {
+    retval = img_error(IMGERR_FORMAT, "JPEG header is truncated");
+  }
+  return retval;
+}
+
+
+
+/**** Image I/O ****/
+
+/***
+    image_sniff:  Identify the format of an input.  A mapped input is
+                  matched against the whole signature.  A stream can only
+                  be peeked one byte without consuming it, so that byte
+                  picks the decoder, which then checks the full signature
+                  itself.
+    args:         in - input opened with imginput_open, not yet read from
+    returns:   IMG_PNG or IMG_JPEG, IMG_UNKNOWN if neither
+***/
+enum imgfmt image_sniff(imginput *in) {
+  int c;                                /* first byte of stream */
+
+  if (NULL != in->buf) {
+    if ((sizeof(png_sig) <= in->nbuf) &&
+        (0 == memcmp(in->buf, png_sig, sizeof(png_sig)))) {
+      return IMG_PNG;
+    }
+    if ((sizeof(jpeg_sig) <= in->nbuf) &&
+        (0 == memcmp(in->buf, jpeg_sig, sizeof(jpeg_sig)))) {
+      return IMG_JPEG;
+    }
+    return IMG_UNKNOWN;
+  }
+
+  if (NULL == in->fin) {
+    return IMG_UNKNOWN;
+  }
+
+  c = getc(in->fin);
+  if (EOF == c) {
+    return IMG_UNKNOWN;
+  }
+  ungetc(c, in->fin);
+
+  if (png_sig[0] == c) {
+    return IMG_PNG;
+  } else if (jpeg_sig[0] == c) {
+    return IMG_JPEG;
+  }
+  return IMG_UNKNOWN;
+}
+
+/***
+    image_probe:  Read the size and layout of an image from its header,
+                  without decoding it.  The file is opened the same way
+                  the decoders open it, so for a mapped file only the
+                  pages holding the header are touched.
+    args:         fname - name of file to check, if NULL take from stdin
+                  info - what the header holds
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  info
+***/
+int image_probe(const char *fname, imginfo *info) {
+  imginput in;                          /* file to read */
+  int retval;
+
+  retval = imginput_open(&in, fname);
+  RETONERR;
+
+  retval = image_probe_input(&in, fname, info);
+
+  if (imginput_close(&in, fname) < 0) {
+    retval = img_errcode();
+  }
+
+  return retval;
+}
+
+/***
+    image_probe_input:  Read the size and layout of an image from the
+                        header of an open input.  A mapped input is only
+                        looked at, so it can still be decoded after; a
+                        stream is read past the header.
+    args:               in - input opened with imginput_open, not yet read
+                             from
+                        fname - name of file, for messages; NULL for stdin
+                        info - what the header holds
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  in (if a stream), info
+***/
+int image_probe_input(imginput *in, const char *fname, imginfo *info) {
+  probesrc src;                         /* how far we've read */
+
+  memset(info, 0, sizeof(*info));
+
+  src.in = in;
+  src.pos = 0;
+  switch (image_sniff(in)) {
+  case IMG_PNG:
+    return probe_png(&src, info);
+  case IMG_JPEG:
+    return probe_jpeg(&src, info);
+  default:
+    return img_error(IMGERR_FORMAT, "%s is not a PNG or JPEG image",
+                     fname ? fname : "stdin");
+  }
+}
+
+/***
+    image_need:  Predict the bytes an image will take to decode: the block
+                 holding its planes, allocated ALLOC_ALIGNED as the
+                 decoders do, and for an interlaced PNG the whole image
+                 libpng has to hold at once.  libpng hands that back as
+                 8-bit grey or RGB (palettes expanded), plus alpha if the
+                 file has an alpha channel or a tRNS chunk.
+    args:        info - what the header holds, from image_probe
+    returns:   bytes needed
+               0 if the image is too large to allocate
+***/
+size_t image_need(const imginfo *info) {
+  size_t need;                          /* bytes predicted */
+  int nchan;                            /* color channels decoded */
+
+  need = size_rgbimage(info->ncol, info->nrow,
+                       ALLOC_ALIGNED | (info->alpha ? ALLOC_ALPHA : 0));
+  if ((0 < need) && (IMG_PNG == info->fmt) && info->interlace) {
+    nchan = ((IMGCLR_GREY == info->clr) || (IMGCLR_GREYA == info->clr)) ?
+      1 : 3;
+    need += (size_t) info->ncol * info->nrow * (nchan + info->alpha);
+  }
+
+  return need;
+}
+
+/***
+    image_read:  Bring in a PNG or JPEG image, allocating fresh storage for
+                 it.
+    args:        fname - name of file with image, if NULL take from stdin
+                 img - image read (if non-NULL, will free old image)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int image_read(const char *fname, _rgbimage **img) {
+
+  return image_read_pool(fname, img, NULL);
+}
+
+/***
+    image_read_pool:  Bring in a PNG or JPEG image, drawing it from an image
+                      pool.  The file is opened once and sniffed, and the
+                      same input goes to the decoder.
+    args:             fname - name of file with image, if NULL take from
+                              stdin
+                      img - image read (if non-NULL, old image released to
+                            pool)
+                      pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int image_read_pool(const char *fname, _rgbimage **img, rgbpool *pool) {
+
+  return image_read_ctx(NULL, fname, img, pool);
+}
+
+/***
+    image_read_ctx:  Bring in a PNG or JPEG image with the codec contexts
+                     kept from earlier images, drawing it from an image
+                     pool.
+    args:            ctx - codec contexts, NULL to use fresh ones
+                     fname - name of file with image, if NULL take from
+                             stdin
+                     img - image read (if non-NULL, old image released to
+                           pool)
+                     pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
+***/
+int image_read_ctx(imgctx *ctx, const char *fname, _rgbimage **img,
+                   rgbpool *pool) {
+  imginput in;                          /* file to read */
+  int retval;
+
+  retval = imginput_open(&in, fname);
+  RETONERR;
+
+  retval = image_read_input(ctx, fname, &in, img, pool);
+
+  if (imginput_close(&in, fname) < 0) {
+    retval = img_errcode();
+  }
+
+  return retval;
+}
+
+/***
+    image_read_input:  Sniff an open input and hand it to the PNG or JPEG
+                       decoder.  The caller opened the input and closes it.
+    args:              ctx - codec contexts, NULL to use fresh ones
+                       fname - name of file, for messages; NULL for stdin
+                       in - input to read
+                       img - image read (if non-NULL, old image released
+                             to pool)
+                       pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, in, img
+***/
+int image_read_input(imgctx *ctx, const char *fname, imginput *in,
+                     _rgbimage **img, rgbpool *pool) {
+
+  switch (image_sniff(in)) {
+  case IMG_PNG:
+    return PNG_read_input(ctx ? ctx->png : NULL, fname, in, img, pool);
+  case IMG_JPEG:
+    return JPEG_read_input(ctx ? ctx->jpeg : NULL, fname, in, img, pool);
+  default:
+    return img_error(IMGERR_FORMAT, "%s is not a PNG or JPEG image",
+                     fname ? fname : "stdin");
+  }
+}
+
+/***
+    image_write:  Save an image in the format named by the file's extension
+                  (.png, or .jpg/.jpeg at the default quality), ignoring
+                  case.
+    args:         fname - name of file to create
+                  img - image to save
+                  plane - CLR_* which plane to write
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+***/
+int image_write(const char *fname, _rgbimage *img, enum clrplane plane) {
+
+  return image_write_ctx(NULL, fname, img, plane);
+}
+
+/***
+    image_write_ctx:  Save an image as image_write does, with the codec
+                      contexts kept from earlier images.
+    args:             ctx - codec contexts, NULL to use fresh ones
+                      fname - name of file to create
+                      img - image to save
+                      plane - CLR_* which plane to write
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx
+***/
+int image_write_ctx(imgctx *ctx, const char *fname, _rgbimage *img,
+                    enum clrplane plane) {
+  const char *ext;                      /* file extension, after the . */
+
+  ext = (NULL == fname) ? NULL : strrchr(fname, '.');
+  if ((NULL == ext) || (NULL != strchr(ext, '/'))) {
+    return img_error(IMGERR_ARG,
+                     "can't tell what format to write %s in without an "
+                     "extension", fname ? fname : "stdout");
+  }
+  ext++;
+
+  if (0 == strcasecmp(ext, "png")) {
+    return PNG_write_ctx(ctx ? ctx->png : NULL, fname, img, plane);
+  } else if ((0 == strcasecmp(ext, "jpg")) || (0 == strcasecmp(ext, "jpeg"))) {
+    return JPEG_write_ctx(ctx ? ctx->jpeg : NULL, fname, img, plane, 0);
+  }
+
+  return img_error(IMGERR_UNSUPPORTED,
+                   "don't know how to write .%s files (use .png, .jpg, or "
+                   ".jpeg)", ext);
+}
+
+/***
+    image_ctx_create:  Make a PNG and a JPEG codec context to read and write
+                       with.  Like the codecs' own, it is for one thread at
+                       a time.
+    args:              ctx - contexts to create
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx
+***/
+int image_ctx_create(imgctx **ctx) {
+  int retval;
+
+  if (NULL == (*ctx = (imgctx *) calloc(1, sizeof(**ctx)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate image context");
+  }
+
+  retval = PNG_ctx_create(&(*ctx)->png);
+  CLEANUPONERR;
+  retval = JPEG_ctx_create(&(*ctx)->jpeg);
+  CLEANUPONERR;
+
+  return 0;
+
+ cleanup:
+  image_ctx_destroy(ctx);
+  return retval;
+}
+
+/***
+    image_ctx_destroy:  Release the codec contexts.
+    args:               ctx - contexts to destroy
+    modifies:  ctx (set to NULL when done)
+***/
+void image_ctx_destroy(imgctx **ctx) {
+
+  if (NULL == *ctx) {
+    return;
+  }
+
+  PNG_ctx_destroy(&(*ctx)->png);
+  JPEG_ctx_destroy(&(*ctx)->jpeg);
+  free(*ctx);
+  *ctx = NULL;
+}
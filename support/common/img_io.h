@@ -0,0 +1,193 @@
+/*****
+      img_io.h -
+      Public declarations for reading and writing images without knowing
+      their format in advance.  The reader opens the file once, looks at
+      the first bytes for a PNG or JPEG signature, and hands the same open
+      input to that decoder.  The writer picks the encoder from the file
+      extension.
+
+      Public Interface:
+        image_sniff - identify the format of an open input
+        image_probe - read an image's size and layout from its header
+        image_probe_input - same, from an already open input
+        image_need - predict the memory an image takes to decode
+        image_read - read a PNG or JPEG image from disk
+        image_read_pool - read an image into a block from an image pool
+        image_read_ctx - read an image with kept codec contexts
+        image_read_input - read an image from an already open input
+        image_write - write an image in the format its name implies
+        image_write_ctx - write an image with kept codec contexts
+        image_ctx_create - make PNG and JPEG codec contexts
+        image_ctx_destroy - release the codec contexts
+
+      Required Libraries:
+        libpng, libjpeg
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGIO
+#define _IMGIO 1
+
+#include "img_rgb.h"
+#include "img_rgbpool.h"
+#include "img_input.h"
+
+
+/*** Data Structures ***/
+
+/* the formats we can read and write */
+enum imgfmt {
+  IMG_UNKNOWN = 0,                      /* not a format we handle */
+  IMG_PNG = 1,                          /* PNG */
+  IMG_JPEG = 2                          /* JPEG (JFIF, Exif) */
+};
+
+/* how color is stored in the file */
+enum imgclr {
+  IMGCLR_GREY = 0,                      /* grey */
+  IMGCLR_GREYA = 1,                     /* grey + alpha (PNG) */
+  IMGCLR_RGB = 2,                       /* RGB */
+  IMGCLR_RGBA = 3,                      /* RGB + alpha (PNG) */
+  IMGCLR_PALETTE = 4,                   /* indices into a palette (PNG) */
+  IMGCLR_YCC = 5,                       /* YCbCr (JPEG) */
+  IMGCLR_CMYK = 6,                      /* CMYK (JPEG) */
+  IMGCLR_YCCK = 7                       /* YCbCr + K (JPEG) */
+};
+
+/* what the header says about an image */
+typedef struct {
+  enum imgfmt fmt;                      /* IMG_* file format */
+  int ncol;                             /* width (columns) of image */
+  int nrow;                             /* height (rows) of image */
+  int nchan;                            /* channels stored, incl. alpha */
+  int depth;                            /* bits per channel sample */
+  enum imgclr clr;                      /* IMGCLR_* color type */
+  int interlace;                        /* true if PNG Adam7 interlaced or
+                                           progressive JPEG */
+  int alpha;                            /* true if decoded with an alpha
+                                           plane, from an alpha channel or
+                                           a PNG tRNS chunk */
+} imginfo;
+
+/* a PNG and a JPEG codec context (private to img_io.c); one per thread */
+typedef struct __imgctx imgctx;
+
+
+/*** External Functions ***/
+
+/* identify the format of an input from its first bytes, without consuming
+   any of them; a mapped input has its whole signature checked, a stream
+   only its first byte (the decoder checks the rest)
+     in - input opened with imginput_open and not yet read from
+   returns IMG_* format, IMG_UNKNOWN if not recognized
+*/
+extern enum imgfmt image_sniff(imginput *);
+
+/* read the header of a PNG (IHDR, and any tRNS before the image data) or
+   JPEG (SOF) image without decoding the pixels; a stream is left part way
+   through, so stdin can't be read after
+     fname - name of file to check (if NULL, use stdin)
+     info - what the header holds
+   returns < 0 on error, including a format we don't know
+   modifies info
+*/
+extern int image_probe(const char *, imginfo *);
+
+/* read the header of an image from an input the caller has opened, which
+   is left open; a mapped input can still be decoded after, a stream is
+   left part way through
+     in - input to read, not yet read from
+     fname - name of file, for messages (NULL for stdin)
+     info - what the header holds
+   returns < 0 on error, including a format we don't know
+   modifies in (if a stream), info
+*/
+extern int image_probe_input(imginput *, const char *, imginfo *);
+
+/* predict the bytes an image takes to decode: its planes as the decoders
+   allocate them (ALLOC_ALIGNED, with alpha if info says so), plus the
+   whole-image buffer libpng needs for an interlaced PNG
+     info - what the header holds, from image_probe
+   returns bytes needed, 0 if the size is too large to allocate
+*/
+extern size_t image_need(const imginfo *);
+
+/* read a PNG or JPEG image, converting it to an rgbimage
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (frees old if non-NULL)
+   returns < 0 on error
+   modifies img
+*/
+extern int image_read(const char *, _rgbimage **);
+
+/* read a PNG or JPEG image into an image from a pool
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as image_read)
+   returns < 0 on error
+   modifies img
+*/
+extern int image_read_pool(const char *, _rgbimage **, rgbpool *);
+
+/* read a PNG or JPEG image with the codec contexts kept from earlier
+   images, into an image from a pool
+     ctx - contexts to decode with (if NULL, use fresh ones as image_read)
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as image_read)
+   returns < 0 on error
+   modifies ctx, img
+*/
+extern int image_read_ctx(imgctx *, const char *, _rgbimage **, rgbpool *);
+
+/* read a PNG or JPEG image from an input the caller has opened (or filled
+   in with a buffer of its own), which is left open
+     ctx - contexts to decode with (if NULL, use fresh ones)
+     fname - name of file, for messages (NULL for stdin)
+     in - input to read, not yet read from
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as image_read)
+   returns < 0 on error
+   modifies ctx, in, img
+*/
+extern int image_read_input(imgctx *, const char *, imginput *, _rgbimage **,
+                            rgbpool *);
+
+/* write an rgbimage to disk, as PNG if the name ends in .png or as JPEG
+   (default quality) if it ends in .jpg or .jpeg, case ignored
+     fname - name of file to write to
+     img - image to write
+     clrplane - CLR_* which plane to write
+   returns < 0 on error, including an extension we don't know
+*/
+extern int image_write(const char *, _rgbimage *, enum clrplane);
+
+/* write an rgbimage to disk as image_write does, with the codec contexts
+   kept from earlier images
+     ctx - contexts to encode with (if NULL, use fresh ones)
+     fname - name of file to write to
+     img - image to write
+     clrplane - CLR_* which plane to write
+   returns < 0 on error
+   modifies ctx
+*/
+extern int image_write_ctx(imgctx *, const char *, _rgbimage *,
+                           enum clrplane);
+
+/* make a PNG and a JPEG codec context, which keep the codecs' setup and
+   buffers between images; use one per thread
+     ctx - contexts to create
+   returns < 0 on error
+   modifies ctx
+*/
+extern int image_ctx_create(imgctx **);
+
+/* release the codec contexts
+     ctx - contexts to destroy
+   modifies ctx (set to NULL when done)
+*/
+extern void image_ctx_destroy(imgctx **);
+
+
+#endif   /* _IMGIO */
@@ -0,0 +1,1552 @@
+/*****
+      img_kern.c -
+      Pixel kernels moving data between interleaved rows and our separate
+      planes.  The vector versions use byte shuffles (pshufb) to gather
+      or scatter each channel, so they need at least SSSE3 (plain SSE2
+      has no byte shuffle); with AVX2 they work on two 128-bit lanes at
+      once.  Any pixels left over after the last full vector go through
+      the scalar code.  Loads and stores are unaligned, so rows need no
+      particular alignment, though ALLOC_ALIGNED planes keep the stores on
+      vector boundaries.
+
+      The YCbCr conversion works in 16-bit fixed point with rounding
+      multiplies (pmulhrsw, also SSSE3).  The scalar version does the same
+      arithmetic, so all versions give identical results.
+
+      The alpha kernels work on premultiplied color, where compositing is
+      one multiply-add per sample.  Products are scaled back by 255 in 16
+      bits with an exact rounding divide; unpremultiplying divides in
+      single precision, which is exact enough to round the same as the
+      scalar integer division.
+
+      Public Interface:
+        kern_deint1 - copy a grey row into the r, g, and b planes
+        kern_deint2 - split a grey + alpha row into planes, alpha optional
+        kern_deint3 - split an RGB row into planes
+        kern_deint4 - split an RGBA row into planes, alpha optional
+        kern_int3 - merge r, g, and b planes into an RGB row
+        kern_int4 - merge r, g, b, and alpha planes into an RGBA row
+        kern_premul - premultiply color planes by alpha
+        kern_unpremul - divide premultiplied color planes by alpha
+        kern_over - composite premultiplied planes over others
+        kern_ycc2rgb - convert Y, Cb, Cr rows to r, g, and b planes
+        kern_ycc2rgb_h2 - same, with half-width chroma rows
+        kern_up2 - double each sample of a row
+        kern_deint1_c, kern_deint2_c, kern_deint3_c, kern_deint4_c,
+        kern_int3_c, kern_int4_c, kern_premul_c, kern_unpremul_c,
+        kern_over_c, kern_ycc2rgb_c, kern_ycc2rgb_h2_c,
+        kern_up2_c - scalar versions
+        kern_name - which vector instruction set the kernels use
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+#include "img_kern.h"
+
+
+/**** Macros ****/
+
+/* shuffle masks (pshufb), -1 clears a byte */
+
+/* 3-channel: pick out one channel from each of three consecutive 16-byte
+   pieces of 16 RGB pixels; OR the three results to get the 16 samples */
+#define DEINT3_RA   0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define DEINT3_RB  -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1
+#define DEINT3_RC  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13
+#define DEINT3_GA   1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define DEINT3_GB  -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1
+#define DEINT3_GC  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14
+#define DEINT3_BA   2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define DEINT3_BB  -1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1
+#define DEINT3_BC  -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15
+
+/* 2-channel: split 8 grey + alpha pixels as gggggggg aaaaaaaa */
+#define DEINT2_SPL  0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15
+
+/* 4-channel: group 4 RGBA pixels as rrrr gggg bbbb aaaa */
+#define DEINT4_GRP  0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15
+
+/* 3-channel interleave: place 16 samples of each plane into the three
+   16-byte pieces of 16 RGB pixels; OR the planes' results per piece */
+#define INT3_0R   0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5
+#define INT3_0G  -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1
+#define INT3_0B  -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1
+#define INT3_1R  -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1
+#define INT3_1G   5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10
+#define INT3_1B  -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1
+#define INT3_2R  -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1
+#define INT3_2G  -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1
+#define INT3_2B  10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15
+
+/* JFIF YCbCr to RGB factors as Q15 fractions.  The integer parts (1 for
+   Cr in red and for Cb in blue) are added separately so every factor
+   fits a signed 16-bit multiply. */
+#define YCC_CRR    13173                /* 1.402 - 1 */
+#define YCC_CBG   -11277                /* -0.344136 */
+#define YCC_CRG   -23401                /* -0.714136 */
+#define YCC_CBB    25297                /* 1.772 - 1 */
+
+/***
+    MULQ15:  Rounding Q15 multiply, bit-for-bit the same as pmulhrsw.
+             Evaluates as an expression.
+    args:    c - sample, -128 to 127
+             k - Q15 factor
+***/
+#define MULQ15(c, k)   ((((c) * (k)) + (1 << 14)) >> 15)
+
+/***
+    CLAMP8:  Saturate an int to 0 - 255, as packuswb does.  Evaluates as an
+             expression, using its argument more than once.
+    args:    v - value to clamp
+***/
+#define CLAMP8(v)      ((uchar) (((v) < 0) ? 0 : (((v) > 255) ? 255 : (v))))
+
+/***
+    MUL255:  Product of two samples scaled back to 0 - 255, rounded to
+             nearest, exactly x * y / 255.  The +128 then *257 >> 16 is
+             bit-for-bit the same as paddw then pmulhuw by 257.  Evaluates
+             as an expression.
+    args:    x, y - samples, 0 - 255
+***/
+#define MUL255(x, y)   (((((x) * (y)) + 128) * 257) >> 16)
+
+
+
+/**** Scalar Kernels ****/
+
+/***
+    kern_deint1_c:  Copy a grey row into all three planes.
+    args:           src - n grey samples
+                    r, g, b - planes to fill
+                    n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint1_c(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x<n; x++) {
+    r[x] = src[x];
+    g[x] = src[x];
+    b[x] = src[x];
+  }
+}
+
+/***
+    kern_deint3_c:  Split an RGB row into planes.
+    args:           src - 3n interleaved samples
+                    r, g, b - planes to fill
+                    n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint3_c(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  int x, i;                             /* pixel, sample */
+
+  for (x=0, i=0; x<n; x++, i+=3) {
+    r[x] = src[i];
+    g[x] = src[i+1];
+    b[x] = src[i+2];
+  }
+}
+
+/***
+    kern_deint4_c:  Split an RGBA row into planes.
+    args:           src - 4n interleaved samples
+                    r, g, b - planes to fill
+                    a - alpha plane to fill, NULL to drop alpha
+                    n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint4_c(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                   int n) {
+  int x, i;                             /* pixel, sample */
+
+  for (x=0, i=0; x<n; x++, i+=4) {
+    r[x] = src[i];
+    g[x] = src[i+1];
+    b[x] = src[i+2];
+  }
+
+  if (NULL != a) {
+    for (x=0, i=3; x<n; x++, i+=4) {
+      a[x] = src[i];
+    }
+  }
+}
+
+/***
+    kern_deint2_c:  Split a grey + alpha row into planes.
+    args:           src - 2n interleaved samples
+                    r, g, b - planes to fill, each with the grey
+                    a - alpha plane to fill, NULL to drop alpha
+                    n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint2_c(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                   int n) {
+  int x, i;                             /* pixel, sample */
+
+  for (x=0, i=0; x<n; x++, i+=2) {
+    r[x] = src[i];
+    g[x] = src[i];
+    b[x] = src[i];
+  }
+
+  if (NULL != a) {
+    for (x=0, i=1; x<n; x++, i+=2) {
+      a[x] = src[i];
+    }
+  }
+}
+
+/***
+    kern_int3_c:  Merge the r, g, and b planes into an RGB row.
+    args:         r, g, b - planes to read
+                  dst - 3n interleaved samples to fill
+                  n - number of pixels
+    modifies:  dst
+***/
+void kern_int3_c(const uchar *r, const uchar *g, const uchar *b, uchar *dst,
+                 int n) {
+  int x, i;                             /* pixel, sample */
+
+  for (x=0, i=0; x<n; x++, i+=3) {
+    dst[i] = r[x];
+    dst[i+1] = g[x];
+    dst[i+2] = b[x];
+  }
+}
+
+/***
+    kern_int4_c:  Merge the r, g, b, and alpha planes into an RGBA row.
+    args:         r, g, b, a - planes to read
+                  dst - 4n interleaved samples to fill
+                  n - number of pixels
+    modifies:  dst
+***/
+void kern_int4_c(const uchar *r, const uchar *g, const uchar *b,
+                 const uchar *a, uchar *dst, int n) {
+  int x, i;                             /* pixel, sample */
+
+  for (x=0, i=0; x<n; x++, i+=4) {
+    dst[i] = r[x];
+    dst[i+1] = g[x];
+    dst[i+2] = b[x];
+    dst[i+3] = a[x];
+  }
+}
+
+/***
+    kern_premul_c:  Premultiply a row's color by its alpha, in place.
+    args:           r, g, b - planes to scale
+                    a - alpha plane
+                    n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_premul_c(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x<n; x++) {
+    r[x] = MUL255(r[x], a[x]);
+    g[x] = MUL255(g[x], a[x]);
+    b[x] = MUL255(b[x], a[x]);
+  }
+}
+
+/***
+    kern_unpremul_c:  Divide a premultiplied row's color by its alpha, in
+                      place, rounding to nearest.  Fully transparent
+                      pixels become black; color above alpha (not valid
+                      premultiplied data) saturates at 255.
+    args:             r, g, b - planes to scale
+                      a - alpha plane
+                      n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_unpremul_c(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  int x;                                /* pixel */
+  int q;                                /* unscaled sample */
+
+  for (x=0; x<n; x++) {
+    if (0 == a[x]) {
+      r[x] = g[x] = b[x] = 0;
+      continue;
+    }
+    q = ((r[x] * 255) + (a[x] / 2)) / a[x];
+    r[x] = CLAMP8(q);
+    q = ((g[x] * 255) + (a[x] / 2)) / a[x];
+    g[x] = CLAMP8(q);
+    q = ((b[x] * 255) + (a[x] / 2)) / a[x];
+    b[x] = CLAMP8(q);
+  }
+}
+
+/***
+    kern_over_c:  Composite a premultiplied row over another, in place:
+                  dst = src + dst * (1 - src alpha), for color and alpha.
+    args:         sr, sg, sb, sa - source planes, premultiplied
+                  dr, dg, db - destination planes, premultiplied
+                  da - destination alpha, NULL if the destination is opaque
+                  n - number of pixels
+    modifies:  dr, dg, db, da
+***/
+void kern_over_c(const uchar *sr, const uchar *sg, const uchar *sb,
+                 const uchar *sa, uchar *dr, uchar *dg, uchar *db, uchar *da,
+                 int n) {
+  int x;                                /* pixel */
+  int t;                                /* transparency of source */
+  int v;                                /* blended sample */
+
+  for (x=0; x<n; x++) {
+    t = 255 - sa[x];
+    v = sr[x] + MUL255(dr[x], t);
+    dr[x] = CLAMP8(v);
+    v = sg[x] + MUL255(dg[x], t);
+    dg[x] = CLAMP8(v);
+    v = sb[x] + MUL255(db[x], t);
+    db[x] = CLAMP8(v);
+  }
+
+  if (NULL != da) {
+    for (x=0; x<n; x++) {
+      da[x] = sa[x] + MUL255(da[x], 255 - sa[x]);
+    }
+  }
+}
+
+
+/***
+    kern_ycc2rgb_c:  Convert a row of YCbCr samples to RGB planes.
+    args:            y, cb, cr - n samples of each component
+                     r, g, b - planes to fill
+                     n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb_c(const uchar *y, const uchar *cb, const uchar *cr,
+                    uchar *r, uchar *g, uchar *b, int n) {
+  int u, v;                             /* chroma, centered on 0 */
+  int x;                                /* pixel */
+
+  for (x=0; x<n; x++) {
+    u = cb[x] - 128;
+    v = cr[x] - 128;
+    r[x] = CLAMP8(y[x] + v + MULQ15(v, YCC_CRR));
+    g[x] = CLAMP8(y[x] + MULQ15(u, YCC_CBG) + MULQ15(v, YCC_CRG));
+    b[x] = CLAMP8(y[x] + u + MULQ15(u, YCC_CBB));
+  }
+}
+
+/***
+    kern_ycc2rgb_h2_c:  Convert a row of YCbCr samples to RGB planes, where
+                        the chroma rows have one sample per two pixels.
+    args:               y - n luma samples
+                        cb, cr - (n + 1) / 2 samples of each chroma
+                        r, g, b - planes to fill
+                        n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb_h2_c(const uchar *y, const uchar *cb, const uchar *cr,
+                       uchar *r, uchar *g, uchar *b, int n) {
+  int u, v;                             /* chroma, centered on 0 */
+  int x;                                /* pixel */
+
+  for (x=0; x<n; x++) {
+    u = cb[x >> 1] - 128;
+    v = cr[x >> 1] - 128;
+    r[x] = CLAMP8(y[x] + v + MULQ15(v, YCC_CRR));
+    g[x] = CLAMP8(y[x] + MULQ15(u, YCC_CBG) + MULQ15(v, YCC_CRG));
+    b[x] = CLAMP8(y[x] + u + MULQ15(u, YCC_CBB));
+  }
+}
+
+/***
+    kern_up2_c:  Double each sample of a row.
+    args:        src - (n + 1) / 2 samples
+                 dst - n samples to fill
+                 n - number of samples out
+    modifies:  dst
+***/
+void kern_up2_c(const uchar *src, uchar *dst, int n) {
+  int x;                                /* sample out */
+
+  for (x=0; x<n; x++) {
+    dst[x] = src[x >> 1];
+  }
+}
+
+
+
+/**** Vector Kernels ****/
+
+#if defined(__AVX2__)
+
+/***
+    LOAD2X128:  Build a 256-bit register from two unaligned 16-byte pieces.
+                Evaluates as an expression.
+    args:       lo, hi - addresses of the low and high lanes
+***/
+#define LOAD2X128(lo, hi)                                               \
+  _mm256_inserti128_si256(                                              \
+    _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (lo))),    \
+    _mm_loadu_si128((const __m128i *) (hi)), 1)
+
+/***
+    kern_deint1:  Copy a grey row into all three planes, 32 pixels per
+                  step.
+    args:         src - n grey samples
+                  r, g, b - planes to fill
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint1(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  __m256i v;                            /* 32 grey samples */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    v = _mm256_loadu_si256((const __m256i *) (src + x));
+    _mm256_storeu_si256((__m256i *) (r + x), v);
+    _mm256_storeu_si256((__m256i *) (g + x), v);
+    _mm256_storeu_si256((__m256i *) (b + x), v);
+  }
+
+  kern_deint1_c(src + x, r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_deint3:  Split an RGB row into planes, 32 pixels per step.  The
+                  low lanes hold pixels 0-15 and the high lanes 16-31, so
+                  the same in-lane shuffles as the SSSE3 version apply.
+    args:         src - 3n interleaved samples
+                  r, g, b - planes to fill
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint3(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  const __m256i ra = _mm256_setr_epi8(DEINT3_RA, DEINT3_RA);
+  const __m256i rb = _mm256_setr_epi8(DEINT3_RB, DEINT3_RB);
+  const __m256i rc = _mm256_setr_epi8(DEINT3_RC, DEINT3_RC);
+  const __m256i ga = _mm256_setr_epi8(DEINT3_GA, DEINT3_GA);
+  const __m256i gb = _mm256_setr_epi8(DEINT3_GB, DEINT3_GB);
+  const __m256i gc = _mm256_setr_epi8(DEINT3_GC, DEINT3_GC);
+  const __m256i ba = _mm256_setr_epi8(DEINT3_BA, DEINT3_BA);
+  const __m256i bb = _mm256_setr_epi8(DEINT3_BB, DEINT3_BB);
+  const __m256i bc = _mm256_setr_epi8(DEINT3_BC, DEINT3_BC);
+  __m256i va, vb, vc;                   /* three 16-byte pieces per lane */
+  __m256i out;                          /* one plane's 32 samples */
+  const uchar *s;                       /* start of 32 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    s = src + (3 * x);
+    va = LOAD2X128(s, s + 48);
+    vb = LOAD2X128(s + 16, s + 64);
+    vc = LOAD2X128(s + 32, s + 80);
+
+    out = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(va, ra),
+                                          _mm256_shuffle_epi8(vb, rb)),
+                          _mm256_shuffle_epi8(vc, rc));
+    _mm256_storeu_si256((__m256i *) (r + x), out);
+    out = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(va, ga),
+                                          _mm256_shuffle_epi8(vb, gb)),
+                          _mm256_shuffle_epi8(vc, gc));
+    _mm256_storeu_si256((__m256i *) (g + x), out);
+    out = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(va, ba),
+                                          _mm256_shuffle_epi8(vb, bb)),
+                          _mm256_shuffle_epi8(vc, bc));
+    _mm256_storeu_si256((__m256i *) (b + x), out);
+  }
+
+  kern_deint3_c(src + (3 * x), r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_deint4:  Split an RGBA row into planes, 32 pixels per step.  Each
+                  lane is shuffled to rrrr gggg bbbb aaaa, then the groups
+                  are transposed with 32- and 64-bit unpacks.  The unpacks
+                  leave the groups of 4 pixels lane-interleaved, which one
+                  cross-lane permute puts back in order.
+    args:         src - 4n interleaved samples
+                  r, g, b - planes to fill
+                  a - alpha plane to fill, NULL to drop alpha
+                  n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint4(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+  const __m256i grp = _mm256_setr_epi8(DEINT4_GRP, DEINT4_GRP);
+  const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+  __m256i v0, v1, v2, v3;               /* 8 pixels each */
+  __m256i t0, t1, t2, t3;               /* after 32-bit unpack */
+  const uchar *s;                       /* start of 32 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    s = src + (4 * x);
+    v0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) s), grp);
+    v1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (s + 32)),
+                             grp);
+    v2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (s + 64)),
+                             grp);
+    v3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (s + 96)),
+                             grp);
+
+    t0 = _mm256_unpacklo_epi32(v0, v1);
+    t1 = _mm256_unpackhi_epi32(v0, v1);
+    t2 = _mm256_unpacklo_epi32(v2, v3);
+    t3 = _mm256_unpackhi_epi32(v2, v3);
+
+    _mm256_storeu_si256((__m256i *) (r + x),
+                        _mm256_permutevar8x32_epi32(
+                          _mm256_unpacklo_epi64(t0, t2), order));
+    _mm256_storeu_si256((__m256i *) (g + x),
+                        _mm256_permutevar8x32_epi32(
+                          _mm256_unpackhi_epi64(t0, t2), order));
+    _mm256_storeu_si256((__m256i *) (b + x),
+                        _mm256_permutevar8x32_epi32(
+                          _mm256_unpacklo_epi64(t1, t3), order));
+    if (NULL != a) {
+      _mm256_storeu_si256((__m256i *) (a + x),
+                          _mm256_permutevar8x32_epi32(
+                            _mm256_unpackhi_epi64(t1, t3), order));
+    }
+  }
+
+  kern_deint4_c(src + (4 * x), r + x, g + x, b + x,
+                (NULL != a) ? a + x : NULL, n - x);
+}
+
+/***
+    kern_deint2:  Split a grey + alpha row into planes, 32 pixels per step.
+                  Each lane is shuffled to 8 greys then 8 alphas, and
+                  64-bit unpacks gather the greys and the alphas of two
+                  registers; one cross-lane permute puts them in order.
+    args:         src - 2n interleaved samples
+                  r, g, b - planes to fill, each with the grey
+                  a - alpha plane to fill, NULL to drop alpha
+                  n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint2(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+  const __m256i spl = _mm256_setr_epi8(DEINT2_SPL, DEINT2_SPL);
+  __m256i v0, v1;                       /* 16 pixels each */
+  __m256i grey;                         /* 32 grey samples */
+  const uchar *s;                       /* start of 32 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    s = src + (2 * x);
+    v0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) s), spl);
+    v1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *) (s + 32)),
+                             spl);
+
+    grey = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(v0, v1), 0xd8);
+    _mm256_storeu_si256((__m256i *) (r + x), grey);
+    _mm256_storeu_si256((__m256i *) (g + x), grey);
+    _mm256_storeu_si256((__m256i *) (b + x), grey);
+    if (NULL != a) {
+      _mm256_storeu_si256((__m256i *) (a + x),
+                          _mm256_permute4x64_epi64(
+                            _mm256_unpackhi_epi64(v0, v1), 0xd8));
+    }
+  }
+
+  kern_deint2_c(src + (2 * x), r + x, g + x, b + x,
+                (NULL != a) ? a + x : NULL, n - x);
+}
+
+/***
+    kern_int3:  Merge the r, g, and b planes into an RGB row, 32 pixels per
+                step.  Each lane builds the 48 output bytes for its 16
+                pixels; the six 16-byte pieces are then paired up across
+                lanes for three 32-byte stores.
+    args:       r, g, b - planes to read
+                dst - 3n interleaved samples to fill
+                n - number of pixels
+    modifies:  dst
+***/
+void kern_int3(const uchar *r, const uchar *g, const uchar *b, uchar *dst,
+               int n) {
+  const __m256i m0r = _mm256_setr_epi8(INT3_0R, INT3_0R);
+  const __m256i m0g = _mm256_setr_epi8(INT3_0G, INT3_0G);
+  const __m256i m0b = _mm256_setr_epi8(INT3_0B, INT3_0B);
+  const __m256i m1r = _mm256_setr_epi8(INT3_1R, INT3_1R);
+  const __m256i m1g = _mm256_setr_epi8(INT3_1G, INT3_1G);
+  const __m256i m1b = _mm256_setr_epi8(INT3_1B, INT3_1B);
+  const __m256i m2r = _mm256_setr_epi8(INT3_2R, INT3_2R);
+  const __m256i m2g = _mm256_setr_epi8(INT3_2G, INT3_2G);
+  const __m256i m2b = _mm256_setr_epi8(INT3_2B, INT3_2B);
+  __m256i vr, vg, vb;                   /* 32 samples of each plane */
+  __m256i o0, o1, o2;                   /* output pieces, per lane */
+  uchar *d;                             /* start of 32 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    vr = _mm256_loadu_si256((const __m256i *) (r + x));
+    vg = _mm256_loadu_si256((const __m256i *) (g + x));
+    vb = _mm256_loadu_si256((const __m256i *) (b + x));
+
+    o0 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(vr, m0r),
+                                         _mm256_shuffle_epi8(vg, m0g)),
+                         _mm256_shuffle_epi8(vb, m0b));
+    o1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(vr, m1r),
+                                         _mm256_shuffle_epi8(vg, m1g)),
+                         _mm256_shuffle_epi8(vb, m1b));
+    o2 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(vr, m2r),
+                                         _mm256_shuffle_epi8(vg, m2g)),
+                         _mm256_shuffle_epi8(vb, m2b));
+
+    d = dst + (3 * x);
+    _mm256_storeu_si256((__m256i *) d, _mm256_permute2x128_si256(o0, o1,
+                                                                 0x20));
+    _mm256_storeu_si256((__m256i *) (d + 32),
+                        _mm256_permute2x128_si256(o2, o0, 0x30));
+    _mm256_storeu_si256((__m256i *) (d + 64),
+                        _mm256_permute2x128_si256(o1, o2, 0x31));
+  }
+
+  kern_int3_c(r + x, g + x, b + x, dst + (3 * x), n - x);
+}
+
+/***
+    kern_int4:  Merge the r, g, b, and alpha planes into an RGBA row, 32
+                pixels per step.  Byte then 16-bit unpacks build the
+                pixels within each lane; the four results are paired up
+                across lanes for the stores.
+    args:       r, g, b, a - planes to read
+                dst - 4n interleaved samples to fill
+                n - number of pixels
+    modifies:  dst
+***/
+void kern_int4(const uchar *r, const uchar *g, const uchar *b,
+               const uchar *a, uchar *dst, int n) {
+  __m256i vr, vg, vb, va;               /* 32 samples of each plane */
+  __m256i rglo, rghi, balo, bahi;       /* after byte unpack */
+  __m256i o0, o1, o2, o3;               /* 4 pixels per lane each */
+  uchar *d;                             /* start of 32 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    vr = _mm256_loadu_si256((const __m256i *) (r + x));
+    vg = _mm256_loadu_si256((const __m256i *) (g + x));
+    vb = _mm256_loadu_si256((const __m256i *) (b + x));
+    va = _mm256_loadu_si256((const __m256i *) (a + x));
+
+    rglo = _mm256_unpacklo_epi8(vr, vg);
+    rghi = _mm256_unpackhi_epi8(vr, vg);
+    balo = _mm256_unpacklo_epi8(vb, va);
+    bahi = _mm256_unpackhi_epi8(vb, va);
+
+    o0 = _mm256_unpacklo_epi16(rglo, balo);
+    o1 = _mm256_unpackhi_epi16(rglo, balo);
+    o2 = _mm256_unpacklo_epi16(rghi, bahi);
+    o3 = _mm256_unpackhi_epi16(rghi, bahi);
+
+    d = dst + (4 * x);
+    _mm256_storeu_si256((__m256i *) d, _mm256_permute2x128_si256(o0, o1,
+                                                                 0x20));
+    _mm256_storeu_si256((__m256i *) (d + 32),
+                        _mm256_permute2x128_si256(o2, o3, 0x20));
+    _mm256_storeu_si256((__m256i *) (d + 64),
+                        _mm256_permute2x128_si256(o0, o1, 0x31));
+    _mm256_storeu_si256((__m256i *) (d + 96),
+                        _mm256_permute2x128_si256(o2, o3, 0x31));
+  }
+
+  kern_int4_c(r + x, g + x, b + x, a + x, dst + (4 * x), n - x);
+}
+
+/***
+    mul255:  MUL255 on 32 pairs of samples.  Widens to 16 bits, where the
+             product, rounding, and division by 255 (pmulhuw by 257) all
+             fit, and packs back.
+    args:    x, y - 32 samples each
+    returns:   x * y / 255, rounded
+***/
+static inline __m256i mul255(__m256i x, __m256i y) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i half = _mm256_set1_epi16(128);
+  const __m256i k257 = _mm256_set1_epi16(257);
+  __m256i lo, hi;                       /* 16 products each */
+
+  lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(x, zero),
+                          _mm256_unpacklo_epi8(y, zero));
+  hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(x, zero),
+                          _mm256_unpackhi_epi8(y, zero));
+  lo = _mm256_mulhi_epu16(_mm256_add_epi16(lo, half), k257);
+  hi = _mm256_mulhi_epu16(_mm256_add_epi16(hi, half), k257);
+
+  return _mm256_packus_epi16(lo, hi);
+}
+
+/***
+    kern_premul:  Premultiply a row's color by its alpha, in place, 32
+                  pixels per step.
+    args:         r, g, b - planes to scale
+                  a - alpha plane
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_premul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  __m256i va;                           /* 32 alphas */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    va = _mm256_loadu_si256((const __m256i *) (a + x));
+    _mm256_storeu_si256((__m256i *) (r + x),
+                        mul255(_mm256_loadu_si256((__m256i *) (r + x)), va));
+    _mm256_storeu_si256((__m256i *) (g + x),
+                        mul255(_mm256_loadu_si256((__m256i *) (g + x)), va));
+    _mm256_storeu_si256((__m256i *) (b + x),
+                        mul255(_mm256_loadu_si256((__m256i *) (b + x)), va));
+  }
+
+  kern_premul_c(r + x, g + x, b + x, a + x, n - x);
+}
+
+/***
+    load8f:  Load 8 samples as floats.
+    args:    p - 8 samples
+    returns:   the samples, converted
+***/
+static inline __m256 load8f(const uchar *p) {
+
+  return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(
+                              _mm_loadl_epi64((const __m128i *) p)));
+}
+
+/***
+    unpremul8:  Unscale 8 samples by their alphas in single precision.
+                The quotient is exact to well under the 1/(2 * alpha) it
+                can be from a rounding boundary, so truncating q + 0.5
+                matches the integer division.  A zero alpha gives an
+                infinite or NaN quotient, which cvttps turns into
+                INT_MIN, and the packs to 0.
+    args:       c - 8 samples
+                fa - their alphas, as floats
+    returns:   8 unscaled samples, as ints
+***/
+static inline __m256i unpremul8(const uchar *c, __m256 fa) {
+  __m256 q;                             /* quotient */
+
+  q = _mm256_div_ps(_mm256_mul_ps(load8f(c), _mm256_set1_ps(255.0f)), fa);
+  return _mm256_cvttps_epi32(_mm256_add_ps(q, _mm256_set1_ps(0.5f)));
+}
+
+/***
+    unpremul16:  Unscale 16 samples in place, saturating to 0 - 255.  The
+                 packs work per lane, so a permute after each puts the
+                 samples back in order.
+    args:        c - 16 samples
+                 fa0, fa1 - alphas of the first and last 8, as floats
+    modifies:  c
+***/
+static inline void unpremul16(uchar *c, __m256 fa0, __m256 fa1) {
+  __m256i v;                            /* unscaled samples */
+
+  v = _mm256_packs_epi32(unpremul8(c, fa0), unpremul8(c + 8, fa1));
+  v = _mm256_permute4x64_epi64(v, 0xd8);
+  v = _mm256_packus_epi16(v, v);
+  v = _mm256_permute4x64_epi64(v, 0x08);
+  _mm_storeu_si128((__m128i *) c, _mm256_castsi256_si128(v));
+}
+
+/***
+    kern_unpremul:  Divide a premultiplied row's color by its alpha, in
+                    place, 16 pixels per step.  Same results as
+                    kern_unpremul_c, including black for zero alpha.
+    args:           r, g, b - planes to scale
+                    a - alpha plane
+                    n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_unpremul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  __m256 fa0, fa1;                      /* 16 alphas, as floats */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    fa0 = load8f(a + x);
+    fa1 = load8f(a + x + 8);
+    unpremul16(r + x, fa0, fa1);
+    unpremul16(g + x, fa0, fa1);
+    unpremul16(b + x, fa0, fa1);
+  }
+
+  kern_unpremul_c(r + x, g + x, b + x, a + x, n - x);
+}
+
+/***
+    kern_over:  Composite a premultiplied row over another, in place, 32
+                pixels per step.  The add saturates as CLAMP8 does.
+    args:       sr, sg, sb, sa - source planes, premultiplied
+                dr, dg, db - destination planes, premultiplied
+                da - destination alpha, NULL if the destination is opaque
+                n - number of pixels
+    modifies:  dr, dg, db, da
+***/
+void kern_over(const uchar *sr, const uchar *sg, const uchar *sb,
+               const uchar *sa, uchar *dr, uchar *dg, uchar *db, uchar *da,
+               int n) {
+  __m256i vsa;                          /* 32 source alphas */
+  __m256i t;                            /* 255 - source alpha */
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    vsa = _mm256_loadu_si256((const __m256i *) (sa + x));
+    t = _mm256_xor_si256(vsa, _mm256_set1_epi8(-1));
+
+    _mm256_storeu_si256((__m256i *) (dr + x), _mm256_adds_epu8(
+                          _mm256_loadu_si256((const __m256i *) (sr + x)),
+                          mul255(_mm256_loadu_si256((__m256i *) (dr + x)),
+                                 t)));
+    _mm256_storeu_si256((__m256i *) (dg + x), _mm256_adds_epu8(
+                          _mm256_loadu_si256((const __m256i *) (sg + x)),
+                          mul255(_mm256_loadu_si256((__m256i *) (dg + x)),
+                                 t)));
+    _mm256_storeu_si256((__m256i *) (db + x), _mm256_adds_epu8(
+                          _mm256_loadu_si256((const __m256i *) (sb + x)),
+                          mul255(_mm256_loadu_si256((__m256i *) (db + x)),
+                                 t)));
+    if (NULL != da) {
+      _mm256_storeu_si256((__m256i *) (da + x), _mm256_adds_epu8(vsa,
+                            mul255(_mm256_loadu_si256((__m256i *) (da + x)),
+                                   t)));
+    }
+  }
+
+  kern_over_c(sr + x, sg + x, sb + x, sa + x, dr + x, dg + x, db + x,
+              (NULL != da) ? da + x : NULL, n - x);
+}
+
+/***
+    ycc16:  Convert 16 pixels of YCbCr, widened to 16 bits, to RGB.  The
+            results are not yet clamped.
+    args:   y, u, v - luma, and chroma centered on 0
+            r, g, b - RGB results
+    modifies:  r, g, b
+***/
+static inline void ycc16(__m256i y, __m256i u, __m256i v, __m256i *r,
+                         __m256i *g, __m256i *b) {
+
+  *r = _mm256_add_epi16(_mm256_add_epi16(y, v),
+                        _mm256_mulhrs_epi16(v, _mm256_set1_epi16(YCC_CRR)));
+  *g = _mm256_add_epi16(y,
+         _mm256_add_epi16(_mm256_mulhrs_epi16(u, _mm256_set1_epi16(YCC_CBG)),
+                          _mm256_mulhrs_epi16(v, _mm256_set1_epi16(YCC_CRG))));
+  *b = _mm256_add_epi16(_mm256_add_epi16(y, u),
+                        _mm256_mulhrs_epi16(u, _mm256_set1_epi16(YCC_CBB)));
+}
+
+/***
+    ycc32:  Convert 32 pixels of YCbCr to RGB and store them.  Each half
+            is widened, converted, then packed back with saturation; the
+            pack works within lanes, so the 64-bit pieces are put back in
+            order afterwards.
+    args:   vy, vcb, vcr - 32 samples of each component
+            r, g, b - where to store 32 samples of each plane
+    modifies:  r, g, b
+***/
+static inline void ycc32(__m256i vy, __m256i vcb, __m256i vcr, uchar *r,
+                         uchar *g, uchar *b) {
+  const __m256i bias = _mm256_set1_epi16(128);
+  __m256i rlo, glo, blo;                /* results, pixels 0-15 */
+  __m256i rhi, ghi, bhi;                /* results, pixels 16-31 */
+
+  ycc16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(vy)),
+        _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(vcb)),
+                         bias),
+        _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(vcr)),
+                         bias),
+        &rlo, &glo, &blo);
+  ycc16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(vy, 1)),
+        _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(vcb, 1)),
+                         bias),
+        _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm256_extracti128_si256(vcr, 1)),
+                         bias),
+        &rhi, &ghi, &bhi);
+
+  _mm256_storeu_si256((__m256i *) r, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(rlo, rhi), 0xd8));
+  _mm256_storeu_si256((__m256i *) g, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(glo, ghi), 0xd8));
+  _mm256_storeu_si256((__m256i *) b, _mm256_permute4x64_epi64(
+                        _mm256_packus_epi16(blo, bhi), 0xd8));
+}
+
+/***
+    DUP16:  Load 16 samples and double each one.  Evaluates as an
+            expression.
+    args:   src - address of the samples
+***/
+#define DUP16(src)                                                      \
+  _mm256_inserti128_si256(                                              \
+    _mm256_castsi128_si256(                                             \
+      _mm_unpacklo_epi8(_mm_loadu_si128((const __m128i *) (src)),       \
+                        _mm_loadu_si128((const __m128i *) (src)))),     \
+    _mm_unpackhi_epi8(_mm_loadu_si128((const __m128i *) (src)),         \
+                      _mm_loadu_si128((const __m128i *) (src))), 1)
+
+/***
+    kern_ycc2rgb:  Convert a row of YCbCr samples to RGB planes, 32 pixels
+                   per step.
+    args:          y, cb, cr - n samples of each component
+                   r, g, b - planes to fill
+                   n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb(const uchar *y, const uchar *cb, const uchar *cr,
+                  uchar *r, uchar *g, uchar *b, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    ycc32(_mm256_loadu_si256((const __m256i *) (y + x)),
+          _mm256_loadu_si256((const __m256i *) (cb + x)),
+          _mm256_loadu_si256((const __m256i *) (cr + x)),
+          r + x, g + x, b + x);
+  }
+
+  kern_ycc2rgb_c(y + x, cb + x, cr + x, r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_ycc2rgb_h2:  Convert a row of YCbCr samples to RGB planes, where
+                      the chroma rows have one sample per two pixels, 32
+                      pixels per step.
+    args:             y - n luma samples
+                      cb, cr - (n + 1) / 2 samples of each chroma
+                      r, g, b - planes to fill
+                      n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb_h2(const uchar *y, const uchar *cb, const uchar *cr,
+                     uchar *r, uchar *g, uchar *b, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x+32<=n; x+=32) {
+    ycc32(_mm256_loadu_si256((const __m256i *) (y + x)),
+          DUP16(cb + (x / 2)), DUP16(cr + (x / 2)), r + x, g + x, b + x);
+  }
+
+  kern_ycc2rgb_h2_c(y + x, cb + (x / 2), cr + (x / 2), r + x, g + x, b + x,
+                    n - x);
+}
+
+/***
+    kern_up2:  Double each sample of a row, 32 samples out per step.
+    args:      src - (n + 1) / 2 samples
+               dst - n samples to fill
+               n - number of samples out
+    modifies:  dst
+***/
+void kern_up2(const uchar *src, uchar *dst, int n) {
+  int x;                                /* sample out */
+
+  for (x=0; x+32<=n; x+=32) {
+    _mm256_storeu_si256((__m256i *) (dst + x), DUP16(src + (x / 2)));
+  }
+
+  kern_up2_c(src + (x / 2), dst + x, n - x);
+}
+
+/***
+    kern_name:  Report which instruction set the vector kernels use.
+    returns:   "avx2"
+***/
+const char *kern_name(void) {
+
+  return "avx2";
+}
+
+#elif defined(__SSSE3__)
+
+/***
+    kern_deint1:  Copy a grey row into all three planes, 16 pixels per
+                  step.
+    args:         src - n grey samples
+                  r, g, b - planes to fill
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint1(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  __m128i v;                            /* 16 grey samples */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    v = _mm_loadu_si128((const __m128i *) (src + x));
+    _mm_storeu_si128((__m128i *) (r + x), v);
+    _mm_storeu_si128((__m128i *) (g + x), v);
+    _mm_storeu_si128((__m128i *) (b + x), v);
+  }
+
+  kern_deint1_c(src + x, r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_deint3:  Split an RGB row into planes, 16 pixels per step.
+    args:         src - 3n interleaved samples
+                  r, g, b - planes to fill
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_deint3(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+  const __m128i ra = _mm_setr_epi8(DEINT3_RA);
+  const __m128i rb = _mm_setr_epi8(DEINT3_RB);
+  const __m128i rc = _mm_setr_epi8(DEINT3_RC);
+  const __m128i ga = _mm_setr_epi8(DEINT3_GA);
+  const __m128i gb = _mm_setr_epi8(DEINT3_GB);
+  const __m128i gc = _mm_setr_epi8(DEINT3_GC);
+  const __m128i ba = _mm_setr_epi8(DEINT3_BA);
+  const __m128i bb = _mm_setr_epi8(DEINT3_BB);
+  const __m128i bc = _mm_setr_epi8(DEINT3_BC);
+  __m128i va, vb, vc;                   /* 48 bytes = 16 pixels */
+  __m128i out;                          /* one plane's 16 samples */
+  const uchar *s;                       /* start of 16 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    s = src + (3 * x);
+    va = _mm_loadu_si128((const __m128i *) s);
+    vb = _mm_loadu_si128((const __m128i *) (s + 16));
+    vc = _mm_loadu_si128((const __m128i *) (s + 32));
+
+    out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(va, ra),
+                                    _mm_shuffle_epi8(vb, rb)),
+                       _mm_shuffle_epi8(vc, rc));
+    _mm_storeu_si128((__m128i *) (r + x), out);
+    out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(va, ga),
+                                    _mm_shuffle_epi8(vb, gb)),
+                       _mm_shuffle_epi8(vc, gc));
+    _mm_storeu_si128((__m128i *) (g + x), out);
+    out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(va, ba),
+                                    _mm_shuffle_epi8(vb, bb)),
+                       _mm_shuffle_epi8(vc, bc));
+    _mm_storeu_si128((__m128i *) (b + x), out);
+  }
+
+  kern_deint3_c(src + (3 * x), r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_deint4:  Split an RGBA row into planes, 16 pixels per step.  Each
+                  register is shuffled to rrrr gggg bbbb aaaa, then the
+                  groups are transposed with 32- and 64-bit unpacks.
+    args:         src - 4n interleaved samples
+                  r, g, b - planes to fill
+                  a - alpha plane to fill, NULL to drop alpha
+                  n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint4(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+  const __m128i grp = _mm_setr_epi8(DEINT4_GRP);
+  __m128i v0, v1, v2, v3;               /* 4 pixels each */
+  __m128i t0, t1, t2, t3;               /* after 32-bit unpack */
+  const uchar *s;                       /* start of 16 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    s = src + (4 * x);
+    v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) s), grp);
+    v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (s + 16)), grp);
+    v2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (s + 32)), grp);
+    v3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (s + 48)), grp);
+
+    t0 = _mm_unpacklo_epi32(v0, v1);
+    t1 = _mm_unpackhi_epi32(v0, v1);
+    t2 = _mm_unpacklo_epi32(v2, v3);
+    t3 = _mm_unpackhi_epi32(v2, v3);
+
+    _mm_storeu_si128((__m128i *) (r + x), _mm_unpacklo_epi64(t0, t2));
+    _mm_storeu_si128((__m128i *) (g + x), _mm_unpackhi_epi64(t0, t2));
+    _mm_storeu_si128((__m128i *) (b + x), _mm_unpacklo_epi64(t1, t3));
+    if (NULL != a) {
+      _mm_storeu_si128((__m128i *) (a + x), _mm_unpackhi_epi64(t1, t3));
+    }
+  }
+
+  kern_deint4_c(src + (4 * x), r + x, g + x, b + x,
+                (NULL != a) ? a + x : NULL, n - x);
+}
+
+/***
+    kern_deint2:  Split a grey + alpha row into planes, 16 pixels per step.
+                  Each register is shuffled to 8 greys then 8 alphas, and
+                  64-bit unpacks gather the greys and the alphas of two
+                  registers.
+    args:         src - 2n interleaved samples
+                  r, g, b - planes to fill, each with the grey
+                  a - alpha plane to fill, NULL to drop alpha
+                  n - number of pixels
+    modifies:  r, g, b, a
+***/
+void kern_deint2(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+  const __m128i spl = _mm_setr_epi8(DEINT2_SPL);
+  __m128i v0, v1;                       /* 8 pixels each */
+  __m128i grey;                         /* 16 grey samples */
+  const uchar *s;                       /* start of 16 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    s = src + (2 * x);
+    v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) s), spl);
+    v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (s + 16)), spl);
+
+    grey = _mm_unpacklo_epi64(v0, v1);
+    _mm_storeu_si128((__m128i *) (r + x), grey);
+    _mm_storeu_si128((__m128i *) (g + x), grey);
+    _mm_storeu_si128((__m128i *) (b + x), grey);
+    if (NULL != a) {
+      _mm_storeu_si128((__m128i *) (a + x), _mm_unpackhi_epi64(v0, v1));
+    }
+  }
+
+  kern_deint2_c(src + (2 * x), r + x, g + x, b + x,
+                (NULL != a) ? a + x : NULL, n - x);
+}
+
+/***
+    kern_int3:  Merge the r, g, and b planes into an RGB row, 16 pixels per
+                step.
+    args:       r, g, b - planes to read
+                dst - 3n interleaved samples to fill
+                n - number of pixels
+    modifies:  dst
+***/
+void kern_int3(const uchar *r, const uchar *g, const uchar *b, uchar *dst,
+               int n) {
+  const __m128i m0r = _mm_setr_epi8(INT3_0R);
+  const __m128i m0g = _mm_setr_epi8(INT3_0G);
+  const __m128i m0b = _mm_setr_epi8(INT3_0B);
+  const __m128i m1r = _mm_setr_epi8(INT3_1R);
+  const __m128i m1g = _mm_setr_epi8(INT3_1G);
+  const __m128i m1b = _mm_setr_epi8(INT3_1B);
+  const __m128i m2r = _mm_setr_epi8(INT3_2R);
+  const __m128i m2g = _mm_setr_epi8(INT3_2G);
+  const __m128i m2b = _mm_setr_epi8(INT3_2B);
+  __m128i vr, vg, vb;                   /* 16 samples of each plane */
+  uchar *d;                             /* start of 16 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    vr = _mm_loadu_si128((const __m128i *) (r + x));
+    vg = _mm_loadu_si128((const __m128i *) (g + x));
+    vb = _mm_loadu_si128((const __m128i *) (b + x));
+
+    d = dst + (3 * x);
+    _mm_storeu_si128((__m128i *) d,
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, m0r),
+                                               _mm_shuffle_epi8(vg, m0g)),
+                                  _mm_shuffle_epi8(vb, m0b)));
+    _mm_storeu_si128((__m128i *) (d + 16),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, m1r),
+                                               _mm_shuffle_epi8(vg, m1g)),
+                                  _mm_shuffle_epi8(vb, m1b)));
+    _mm_storeu_si128((__m128i *) (d + 32),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, m2r),
+                                               _mm_shuffle_epi8(vg, m2g)),
+                                  _mm_shuffle_epi8(vb, m2b)));
+  }
+
+  kern_int3_c(r + x, g + x, b + x, dst + (3 * x), n - x);
+}
+
+/***
+    kern_int4:  Merge the r, g, b, and alpha planes into an RGBA row, 16
+                pixels per step, with byte then 16-bit unpacks.
+    args:       r, g, b, a - planes to read
+                dst - 4n interleaved samples to fill
+                n - number of pixels
+    modifies:  dst
+***/
+void kern_int4(const uchar *r, const uchar *g, const uchar *b,
+               const uchar *a, uchar *dst, int n) {
+  __m128i vr, vg, vb, va;               /* 16 samples of each plane */
+  __m128i rglo, rghi, balo, bahi;       /* after byte unpack */
+  uchar *d;                             /* start of 16 pixels */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    vr = _mm_loadu_si128((const __m128i *) (r + x));
+    vg = _mm_loadu_si128((const __m128i *) (g + x));
+    vb = _mm_loadu_si128((const __m128i *) (b + x));
+    va = _mm_loadu_si128((const __m128i *) (a + x));
+
+    rglo = _mm_unpacklo_epi8(vr, vg);
+    rghi = _mm_unpackhi_epi8(vr, vg);
+    balo = _mm_unpacklo_epi8(vb, va);
+    bahi = _mm_unpackhi_epi8(vb, va);
+
+    d = dst + (4 * x);
+    _mm_storeu_si128((__m128i *) d, _mm_unpacklo_epi16(rglo, balo));
+    _mm_storeu_si128((__m128i *) (d + 16), _mm_unpackhi_epi16(rglo, balo));
+    _mm_storeu_si128((__m128i *) (d + 32), _mm_unpacklo_epi16(rghi, bahi));
+    _mm_storeu_si128((__m128i *) (d + 48), _mm_unpackhi_epi16(rghi, bahi));
+  }
+
+  kern_int4_c(r + x, g + x, b + x, a + x, dst + (4 * x), n - x);
+}
+
+/***
+    mul255:  MUL255 on 16 pairs of samples, in 16 bits.
+    args:    x, y - 16 samples each
+    returns:   x * y / 255, rounded
+***/
+static inline __m128i mul255(__m128i x, __m128i y) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i k257 = _mm_set1_epi16(257);
+  __m128i lo, hi;                       /* 8 products each */
+
+  lo = _mm_mullo_epi16(_mm_unpacklo_epi8(x, zero),
+                       _mm_unpacklo_epi8(y, zero));
+  hi = _mm_mullo_epi16(_mm_unpackhi_epi8(x, zero),
+                       _mm_unpackhi_epi8(y, zero));
+  lo = _mm_mulhi_epu16(_mm_add_epi16(lo, half), k257);
+  hi = _mm_mulhi_epu16(_mm_add_epi16(hi, half), k257);
+
+  return _mm_packus_epi16(lo, hi);
+}
+
+/***
+    kern_premul:  Premultiply a row's color by its alpha, in place, 16
+                  pixels per step.
+    args:         r, g, b - planes to scale
+                  a - alpha plane
+                  n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_premul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  __m128i va;                           /* 16 alphas */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    va = _mm_loadu_si128((const __m128i *) (a + x));
+    _mm_storeu_si128((__m128i *) (r + x),
+                     mul255(_mm_loadu_si128((__m128i *) (r + x)), va));
+    _mm_storeu_si128((__m128i *) (g + x),
+                     mul255(_mm_loadu_si128((__m128i *) (g + x)), va));
+    _mm_storeu_si128((__m128i *) (b + x),
+                     mul255(_mm_loadu_si128((__m128i *) (b + x)), va));
+  }
+
+  kern_premul_c(r + x, g + x, b + x, a + x, n - x);
+}
+
+/***
+    unpremul4:  Unscale 4 samples by their alphas in single precision; see
+                the AVX2 version for why this matches the integer
+                division, and zero alpha gives 0.
+    args:       c - 4 samples, widened to 32 bits
+                fa - their alphas, as floats
+    returns:   4 unscaled samples, as ints
+***/
+static inline __m128i unpremul4(__m128i c, __m128 fa) {
+  __m128 q;                             /* quotient */
+
+  q = _mm_div_ps(_mm_mul_ps(_mm_cvtepi32_ps(c), _mm_set1_ps(255.0f)), fa);
+  return _mm_cvttps_epi32(_mm_add_ps(q, _mm_set1_ps(0.5f)));
+}
+
+/***
+    unpremul16:  Unscale 16 samples in place, saturating to 0 - 255.
+    args:        c - 16 samples
+                 fa - alphas of each group of 4, as floats
+    modifies:  c
+***/
+static inline void unpremul16(uchar *c, const __m128 *fa) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128i v, lo, hi;                    /* samples, widened to 16 bits */
+
+  v = _mm_loadu_si128((const __m128i *) c);
+  lo = _mm_unpacklo_epi8(v, zero);
+  hi = _mm_unpackhi_epi8(v, zero);
+  lo = _mm_packs_epi32(unpremul4(_mm_unpacklo_epi16(lo, zero), fa[0]),
+                       unpremul4(_mm_unpackhi_epi16(lo, zero), fa[1]));
+  hi = _mm_packs_epi32(unpremul4(_mm_unpacklo_epi16(hi, zero), fa[2]),
+                       unpremul4(_mm_unpackhi_epi16(hi, zero), fa[3]));
+  _mm_storeu_si128((__m128i *) c, _mm_packus_epi16(lo, hi));
+}
+
+/***
+    kern_unpremul:  Divide a premultiplied row's color by its alpha, in
+                    place, 16 pixels per step.  Same results as
+                    kern_unpremul_c, including black for zero alpha.
+    args:           r, g, b - planes to scale
+                    a - alpha plane
+                    n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_unpremul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128 fa[4];                         /* 16 alphas, as floats */
+  __m128i va, lo, hi;                   /* alphas, widened to 16 bits */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    va = _mm_loadu_si128((const __m128i *) (a + x));
+    lo = _mm_unpacklo_epi8(va, zero);
+    hi = _mm_unpackhi_epi8(va, zero);
+    fa[0] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero));
+    fa[1] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero));
+    fa[2] = _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero));
+    fa[3] = _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero));
+    unpremul16(r + x, fa);
+    unpremul16(g + x, fa);
+    unpremul16(b + x, fa);
+  }
+
+  kern_unpremul_c(r + x, g + x, b + x, a + x, n - x);
+}
+
+/***
+    kern_over:  Composite a premultiplied row over another, in place, 16
+                pixels per step.  The add saturates as CLAMP8 does.
+    args:       sr, sg, sb, sa - source planes, premultiplied
+                dr, dg, db - destination planes, premultiplied
+                da - destination alpha, NULL if the destination is opaque
+                n - number of pixels
+    modifies:  dr, dg, db, da
+***/
+void kern_over(const uchar *sr, const uchar *sg, const uchar *sb,
+               const uchar *sa, uchar *dr, uchar *dg, uchar *db, uchar *da,
+               int n) {
+  __m128i vsa;                          /* 16 source alphas */
+  __m128i t;                            /* 255 - source alpha */
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    vsa = _mm_loadu_si128((const __m128i *) (sa + x));
+    t = _mm_xor_si128(vsa, _mm_set1_epi8(-1));
+
+    _mm_storeu_si128((__m128i *) (dr + x), _mm_adds_epu8(
+                       _mm_loadu_si128((const __m128i *) (sr + x)),
+                       mul255(_mm_loadu_si128((__m128i *) (dr + x)), t)));
+    _mm_storeu_si128((__m128i *) (dg + x), _mm_adds_epu8(
+                       _mm_loadu_si128((const __m128i *) (sg + x)),
+                       mul255(_mm_loadu_si128((__m128i *) (dg + x)), t)));
+    _mm_storeu_si128((__m128i *) (db + x), _mm_adds_epu8(
+                       _mm_loadu_si128((const __m128i *) (sb + x)),
+                       mul255(_mm_loadu_si128((__m128i *) (db + x)), t)));
+    if (NULL != da) {
+      _mm_storeu_si128((__m128i *) (da + x), _mm_adds_epu8(vsa,
+                         mul255(_mm_loadu_si128((__m128i *) (da + x)), t)));
+    }
+  }
+
+  kern_over_c(sr + x, sg + x, sb + x, sa + x, dr + x, dg + x, db + x,
+              (NULL != da) ? da + x : NULL, n - x);
+}
+
+/***
+    ycc16:  Convert 16 pixels of YCbCr to RGB and store them.  Each half
+            is widened to 16 bits, converted, then packed back with
+            saturation.
+    args:   vy, vcb, vcr - 16 samples of each component
+            r, g, b - where to store 16 samples of each plane
+    modifies:  r, g, b
+***/
+static inline void ycc16(__m128i vy, __m128i vcb, __m128i vcr, uchar *r,
+                         uchar *g, uchar *b) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i bias = _mm_set1_epi16(128);
+  const __m128i crr = _mm_set1_epi16(YCC_CRR);
+  const __m128i cbg = _mm_set1_epi16(YCC_CBG);
+  const __m128i crg = _mm_set1_epi16(YCC_CRG);
+  const __m128i cbb = _mm_set1_epi16(YCC_CBB);
+  __m128i y[2], u[2], v[2];             /* widened halves */
+  __m128i vr[2], vg[2], vb[2];          /* results per half */
+  int i;                                /* half */
+
+  y[0] = _mm_unpacklo_epi8(vy, zero);
+  y[1] = _mm_unpackhi_epi8(vy, zero);
+  u[0] = _mm_sub_epi16(_mm_unpacklo_epi8(vcb, zero), bias);
+  u[1] = _mm_sub_epi16(_mm_unpackhi_epi8(vcb, zero), bias);
+  v[0] = _mm_sub_epi16(_mm_unpacklo_epi8(vcr, zero), bias);
+  v[1] = _mm_sub_epi16(_mm_unpackhi_epi8(vcr, zero), bias);
+
+  for (i=0; i<2; i++) {
+    vr[i] = _mm_add_epi16(_mm_add_epi16(y[i], v[i]),
+                          _mm_mulhrs_epi16(v[i], crr));
+    vg[i] = _mm_add_epi16(y[i], _mm_add_epi16(_mm_mulhrs_epi16(u[i], cbg),
+                                              _mm_mulhrs_epi16(v[i], crg)));
+    vb[i] = _mm_add_epi16(_mm_add_epi16(y[i], u[i]),
+                          _mm_mulhrs_epi16(u[i], cbb));
+  }
+
+  _mm_storeu_si128((__m128i *) r, _mm_packus_epi16(vr[0], vr[1]));
+  _mm_storeu_si128((__m128i *) g, _mm_packus_epi16(vg[0], vg[1]));
+  _mm_storeu_si128((__m128i *) b, _mm_packus_epi16(vb[0], vb[1]));
+}
+
+/***
+    DUP8:  Load 8 samples and double each one.  Evaluates as an expression.
+    args:  src - address of the samples
+***/
+#define DUP8(src)                                                       \
+  _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) (src)),           \
+                    _mm_loadl_epi64((const __m128i *) (src)))
+
+/***
+    kern_ycc2rgb:  Convert a row of YCbCr samples to RGB planes, 16 pixels
+                   per step.
+    args:          y, cb, cr - n samples of each component
+                   r, g, b - planes to fill
+                   n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb(const uchar *y, const uchar *cb, const uchar *cr,
+                  uchar *r, uchar *g, uchar *b, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    ycc16(_mm_loadu_si128((const __m128i *) (y + x)),
+          _mm_loadu_si128((const __m128i *) (cb + x)),
+          _mm_loadu_si128((const __m128i *) (cr + x)),
+          r + x, g + x, b + x);
+  }
+
+  kern_ycc2rgb_c(y + x, cb + x, cr + x, r + x, g + x, b + x, n - x);
+}
+
+/***
+    kern_ycc2rgb_h2:  Convert a row of YCbCr samples to RGB planes, where
+                      the chroma rows have one sample per two pixels, 16
+                      pixels per step.
+    args:             y - n luma samples
+                      cb, cr - (n + 1) / 2 samples of each chroma
+                      r, g, b - planes to fill
+                      n - number of pixels
+    modifies:  r, g, b
+***/
+void kern_ycc2rgb_h2(const uchar *y, const uchar *cb, const uchar *cr,
+                     uchar *r, uchar *g, uchar *b, int n) {
+  int x;                                /* pixel */
+
+  for (x=0; x+16<=n; x+=16) {
+    ycc16(_mm_loadu_si128((const __m128i *) (y + x)),
+          DUP8(cb + (x / 2)), DUP8(cr + (x / 2)), r + x, g + x, b + x);
+  }
+
+  kern_ycc2rgb_h2_c(y + x, cb + (x / 2), cr + (x / 2), r + x, g + x, b + x,
+                    n - x);
+}
+
+/***
+    kern_up2:  Double each sample of a row, 16 samples out per step.
+    args:      src - (n + 1) / 2 samples
+               dst - n samples to fill
+               n - number of samples out
+    modifies:  dst
+***/
+void kern_up2(const uchar *src, uchar *dst, int n) {
+  int x;                                /* sample out */
+
+  for (x=0; x+16<=n; x+=16) {
+    _mm_storeu_si128((__m128i *) (dst + x), DUP8(src + (x / 2)));
+  }
+
+  kern_up2_c(src + (x / 2), dst + x, n - x);
+}
+
+/***
+    kern_name:  Report which instruction set the vector kernels use.
+    returns:   "ssse3"
+***/
+const char *kern_name(void) {
+
+  return "ssse3";
+}
+
+#else
+
+/***
+    kern_deint1, kern_deint2, kern_deint3, kern_deint4, kern_int3,
+    kern_int4, kern_premul, kern_unpremul, kern_over, kern_ycc2rgb,
+    kern_ycc2rgb_h2, kern_up2:  Without a byte shuffle there is no vector
+        version, so use the scalar kernels.
+***/
+void kern_deint1(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+
+  kern_deint1_c(src, r, g, b, n);
+}
+
+void kern_deint2(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+
+  kern_deint2_c(src, r, g, b, a, n);
+}
+
+void kern_deint3(const uchar *src, uchar *r, uchar *g, uchar *b, int n) {
+
+  kern_deint3_c(src, r, g, b, n);
+}
+
+void kern_deint4(const uchar *src, uchar *r, uchar *g, uchar *b, uchar *a,
+                 int n) {
+
+  kern_deint4_c(src, r, g, b, a, n);
+}
+
+void kern_int3(const uchar *r, const uchar *g, const uchar *b, uchar *dst,
+               int n) {
+
+  kern_int3_c(r, g, b, dst, n);
+}
+
+void kern_int4(const uchar *r, const uchar *g, const uchar *b,
+               const uchar *a, uchar *dst, int n) {
+
+  kern_int4_c(r, g, b, a, dst, n);
+}
+
+void kern_premul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+
+  kern_premul_c(r, g, b, a, n);
+}
+
+void kern_unpremul(uchar *r, uchar *g, uchar *b, const uchar *a, int n) {
+
+  kern_unpremul_c(r, g, b, a, n);
+}
+
+void kern_over(const uchar *sr, const uchar *sg, const uchar *sb,
+               const uchar *sa, uchar *dr, uchar *dg, uchar *db, uchar *da,
+               int n) {
+
+  kern_over_c(sr, sg, sb, sa, dr, dg, db, da, n);
+}
+
+void kern_ycc2rgb(const uchar *y, const uchar *cb, const uchar *cr,
+                  uchar *r, uchar *g, uchar *b, int n) {
+
+  kern_ycc2rgb_c(y, cb, cr, r, g, b, n);
+}
+
+void kern_ycc2rgb_h2(const uchar *y, const uchar *cb, const uchar *cr,
+                     uchar *r, uchar *g, uchar *b, int n) {
+
+  kern_ycc2rgb_h2_c(y, cb, cr, r, g, b, n);
+}
+
+void kern_up2(const uchar *src, uchar *dst, int n) {
+
+  kern_up2_c(src, dst, n);
+}
+
+/***
+    kern_name:  Report which instruction set the vector kernels use.
+    returns:   "scalar"
+***/
+const char *kern_name(void) {
+
+  return "scalar";
+}
+
+#endif
@@ -0,0 +1,170 @@
+/*****
+      img_kern.h -
+      Public declarations for the pixel kernels that move data between
+      the interleaved rows the codecs work with and our separate planes,
+      and that blend planes with an alpha plane.
+
+      Each kernel has a vector version, picked at compile time from the
+      instruction sets the compiler targets (AVX2, else SSSE3), and a
+      plain C version with a _c suffix that gives the same results and is
+      used when neither is available.
+
+      Public Interface:
+        kern_deint1 - copy a grey row into the r, g, and b planes
+        kern_deint2 - split a grey + alpha row into planes, alpha optional
+        kern_deint3 - split an RGB row into planes
+        kern_deint4 - split an RGBA row into planes, alpha optional
+        kern_int3 - merge r, g, and b planes into an RGB row
+        kern_int4 - merge r, g, b, and alpha planes into an RGBA row
+        kern_premul - premultiply color planes by alpha
+        kern_unpremul - divide premultiplied color planes by alpha
+        kern_over - composite premultiplied planes over others
+        kern_ycc2rgb - convert Y, Cb, Cr rows to r, g, and b planes
+        kern_ycc2rgb_h2 - same, with half-width chroma rows
+        kern_up2 - double each sample of a row
+        kern_deint1_c, kern_deint2_c, kern_deint3_c, kern_deint4_c,
+        kern_int3_c, kern_int4_c, kern_premul_c, kern_unpremul_c,
+        kern_over_c, kern_ycc2rgb_c, kern_ycc2rgb_h2_c,
+        kern_up2_c - scalar versions
+        kern_name - which vector instruction set the kernels use
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGKERN
+#define _IMGKERN 1
+
+#include "img_rgb.h"
+
+
+/*** External Functions ***/
+
+/* copy a row of 1-channel (grey) samples into all three planes
+     src - n samples
+     r, g, b - planes to fill, n samples each
+     n - number of pixels
+*/
+extern void kern_deint1(const uchar *, uchar *, uchar *, uchar *, int);
+extern void kern_deint1_c(const uchar *, uchar *, uchar *, uchar *, int);
+
+/* split a row of 2-channel (grey + alpha) samples into planes
+     src - 2n samples, y a y a ...
+     r, g, b - planes to fill with the grey, n samples each
+     a - alpha plane to fill (if NULL, alpha is dropped)
+     n - number of pixels
+*/
+extern void kern_deint2(const uchar *, uchar *, uchar *, uchar *, uchar *,
+                        int);
+extern void kern_deint2_c(const uchar *, uchar *, uchar *, uchar *, uchar *,
+                          int);
+
+/* split a row of 3-channel (RGB) samples into planes
+     src - 3n samples, r g b r g b ...
+     r, g, b - planes to fill, n samples each
+     n - number of pixels
+*/
+extern void kern_deint3(const uchar *, uchar *, uchar *, uchar *, int);
+extern void kern_deint3_c(const uchar *, uchar *, uchar *, uchar *, int);
+
+/* split a row of 4-channel (RGBA) samples into planes
+     src - 4n samples, r g b a r g b a ...
+     r, g, b - planes to fill, n samples each
+     a - alpha plane to fill (if NULL, alpha is dropped)
+     n - number of pixels
+*/
+extern void kern_deint4(const uchar *, uchar *, uchar *, uchar *, uchar *,
+                        int);
+extern void kern_deint4_c(const uchar *, uchar *, uchar *, uchar *, uchar *,
+                          int);
+
+/* merge the r, g, and b planes into a row of 3-channel (RGB) samples
+     r, g, b - planes to read, n samples each
+     dst - 3n samples to fill, r g b r g b ...
+     n - number of pixels
+*/
+extern void kern_int3(const uchar *, const uchar *, const uchar *, uchar *,
+                      int);
+extern void kern_int3_c(const uchar *, const uchar *, const uchar *, uchar *,
+                        int);
+
+/* merge the r, g, b, and alpha planes into a row of 4-channel (RGBA)
+   samples
+     r, g, b, a - planes to read, n samples each
+     dst - 4n samples to fill, r g b a r g b a ...
+     n - number of pixels
+*/
+extern void kern_int4(const uchar *, const uchar *, const uchar *,
+                      const uchar *, uchar *, int);
+extern void kern_int4_c(const uchar *, const uchar *, const uchar *,
+                        const uchar *, uchar *, int);
+
+/* premultiply a row of color by its alpha, in place: c = c * a / 255,
+   rounded
+     r, g, b - planes to scale, n samples each
+     a - alpha plane, n samples
+     n - number of pixels
+*/
+extern void kern_premul(uchar *, uchar *, uchar *, const uchar *, int);
+extern void kern_premul_c(uchar *, uchar *, uchar *, const uchar *, int);
+
+/* undo kern_premul, in place: c = c * 255 / a, rounded and saturated, and
+   0 where a is 0
+     r, g, b - planes to scale, n samples each
+     a - alpha plane, n samples
+     n - number of pixels
+*/
+extern void kern_unpremul(uchar *, uchar *, uchar *, const uchar *, int);
+extern void kern_unpremul_c(uchar *, uchar *, uchar *, const uchar *, int);
+
+/* composite a premultiplied row over another (Porter-Duff over), in
+   place: d = s + d * (255 - sa) / 255, rounded and saturated, for each
+   color plane and the destination alpha
+     sr, sg, sb, sa - source planes, n samples each
+     dr, dg, db - destination planes, n samples each
+     da - destination alpha plane (if NULL, the destination is opaque and
+          stays so)
+     n - number of pixels
+*/
+extern void kern_over(const uchar *, const uchar *, const uchar *,
+                      const uchar *, uchar *, uchar *, uchar *, uchar *, int);
+extern void kern_over_c(const uchar *, const uchar *, const uchar *,
+                        const uchar *, uchar *, uchar *, uchar *, uchar *,
+                        int);
+
+/* convert a row of JFIF YCbCr samples to RGB planes
+     y, cb, cr - n samples of each component
+     r, g, b - planes to fill, n samples each
+     n - number of pixels
+*/
+extern void kern_ycc2rgb(const uchar *, const uchar *, const uchar *,
+                         uchar *, uchar *, uchar *, int);
+extern void kern_ycc2rgb_c(const uchar *, const uchar *, const uchar *,
+                           uchar *, uchar *, uchar *, int);
+
+/* convert a row of JFIF YCbCr samples to RGB planes, with chroma
+   subsampled 2:1 across the row (each chroma sample covers two pixels)
+     y - n luma samples
+     cb, cr - (n + 1) / 2 samples of each chroma
+     r, g, b - planes to fill, n samples each
+     n - number of pixels
+*/
+extern void kern_ycc2rgb_h2(const uchar *, const uchar *, const uchar *,
+                            uchar *, uchar *, uchar *, int);
+extern void kern_ycc2rgb_h2_c(const uchar *, const uchar *, const uchar *,
+                              uchar *, uchar *, uchar *, int);
+
+/* double each sample of a row (2:1 upsampling by replication)
+     src - (n + 1) / 2 samples
+     dst - n samples to fill
+     n - number of samples out
+*/
+extern void kern_up2(const uchar *, uchar *, int);
+extern void kern_up2_c(const uchar *, uchar *, int);
+
+/* name of the instruction set the vector kernels were built for
+   returns "avx2", "ssse3", or "scalar"
+*/
+extern const char *kern_name(void);
+
+
+#endif   /* _IMGKERN */
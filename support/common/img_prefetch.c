@@ -0,0 +1,386 @@
+/*****
+      img_prefetch.c -
+      Read ahead through a list of images.  A loader thread keeps the next
+      'depth' files of the list in memory.  As it starts on a file it opens
+      the ones after it, up to the depth, and advises the kernel it will
+      need them (POSIX_FADV_WILLNEED), which starts their reads in the
+      background; on RAID or network storage several are then in flight at
+      once.  The file itself is mapped with MAP_POPULATE, so the loader
+      rather than the decoder takes the page faults, or read into a buffer
+      if it can't be mapped.  The reader decodes from that memory through
+      image_read_input, and frees it.
+
+      io_uring would let a single thread keep the reads in flight without
+      blocking, but needs liburing; the advice plus one loader thread gets
+      the same overlap with only the C library.
+
+      Public Interface:
+        prefetch_create - start reading ahead through a list of files
+        prefetch_destroy - stop reading ahead and release the buffers
+        prefetch_read - decode the next file in the list
+
+      c @parthsarthiprasad
+*****/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "img_prefetch.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/* size of the first buffer for a file that can't be mapped; it doubles
+   as needed */
+#define PF_READCHUNK         65536
+
+
+/**** Data Structures ****/
+
+/* a file opened and advised, waiting to be loaded */
+typedef struct {
+  int fd;                               /* open file, -1 if not */
+  int errnum;                           /* errno if open failed */
+} pfopen;
+
+/* a file loaded ahead of the reader */
+typedef struct {
+  int errnum;                           /* errno if open or read failed */
+  uchar *buf;                           /* file contents */
+  size_t nbuf;                          /* bytes in buf */
+  int mapped;                           /* true if buf is mapped, not
+                                           malloc'd */
+} pfslot;
+
+struct __imgprefetch {
+  const char **fnames;                  /* files to read */
+  long n;                               /* number of files */
+  int depth;                            /* files loaded ahead */
+  pfslot *slot;                         /* file i in slot[i % depth] */
+  pfopen *open;                         /* and in open[i % depth] from
+                                           being advised until loaded */
+  long advised;                         /* files opened so far (loader
+                                           only) */
+  pthread_t loader;                     /* thread loading files */
+  pthread_mutex_t lock;                 /* guards everything below */
+  pthread_cond_t change;                /* file loaded or read, or quit */
+  long loaded;                          /* files loaded so far */
+  long taken;                           /* files given to the reader */
+  int quit;                             /* true to stop the loader */
+};
+
+
+
+/**** Local Functions ****/
+
+/***
+    slot_free:  Release a slot's buffer, unmapping or freeing it.
+    args:       s - slot to empty
+    modifies:   s
+***/
+static void slot_free(pfslot *s) {
+
+  if (s->mapped) {
+    munmap(s->buf, s->nbuf);
+  } else {
+    free(s->buf);
+  }
+  s->errnum = 0;
+  s->buf = NULL;
+  s->nbuf = 0;
+  s->mapped = 0;
+}
+
+/***
+    advise_ahead:  Open the files up to 'depth' past the one about to be
+                   loaded and tell the kernel to start reading them.  The
+                   open ring holds exactly those files, as each is taken
+                   out when loaded.
+    args:          pf - prefetcher
+                   i - file about to be loaded
+    modifies:      pf
+***/
+static void advise_ahead(imgprefetch *pf, long i) {
+  pfopen *s;                            /* file being opened */
+
+  for (; (pf->advised < pf->n) && (pf->advised < i + pf->depth);
+       pf->advised++) {
+    s = &pf->open[pf->advised % pf->depth];
+    s->errnum = 0;
+    s->fd = open(pf->fnames[pf->advised], O_RDONLY);
+    if (s->fd < 0) {
+      s->errnum = errno;
+    } else {
+      /* Only a hint; the load works the same if it's ignored. */
+      (void) posix_fadvise(s->fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+  }
+}
+
+/***
+    load_file:  Bring a file opened by advise_ahead into memory, mapping it
+                if it's a regular file and reading it if not, and close
+                it.  Errors are kept in the slot for the reader to report.
+    args:       f - the open file
+                s - slot to fill
+    modifies:   f, s
+***/
+static void load_file(pfopen *f, pfslot *s) {
+  struct stat st;                       /* file information */
+  uchar *bigger;                        /* grown read buffer */
+  size_t bufsz;                         /* size of read buffer */
+  ssize_t nread;                        /* bytes from one read */
+  void *map;                            /* mapped file */
+
+  if (f->fd < 0) {
+    s->errnum = f->errnum;
+    return;
+  }
+
+  if ((0 == fstat(f->fd, &st)) && S_ISREG(st.st_mode) && (0 < st.st_size)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE,
+               f->fd, 0);
+    if (MAP_FAILED != map) {
+      s->buf = (uchar *) map;
+      s->nbuf = st.st_size;
+      s->mapped = 1;
+      close(f->fd);
+      f->fd = -1;
+      return;
+    }
+  }
+
+  bufsz = 0;
+  while (1) {
+    if (s->nbuf == bufsz) {
+      bufsz = bufsz ? (2 * bufsz) : PF_READCHUNK;
+      if (NULL == (bigger = (uchar *) realloc(s->buf, bufsz))) {
+        s->errnum = ENOMEM;
+        break;
+      }
+      s->buf = bigger;
+    }
+    nread = read(f->fd, s->buf + s->nbuf, bufsz - s->nbuf);
+    if (0 < nread) {
+      s->nbuf += nread;
+    } else if (0 == nread) {
+      break;
+    } else if (EINTR != errno) {
+      s->errnum = errno;
+      break;
+    }
+  }
+
+  close(f->fd);
+  f->fd = -1;
+}
+
+/***
+    loader:  Main loop of the loading thread, filling slots as the reader
+             frees them until the list is done or we're told to quit.
+    args:    arg - prefetcher
+    returns:   NULL
+***/
+static void *loader(void *arg) {
+  imgprefetch *pf;                      /* prefetcher */
+  long i;                               /* file being loaded */
+
+  pf = (imgprefetch *) arg;
+
+  for (i=0; i<pf->n; i++) {
+    pthread_mutex_lock(&pf->lock);
+    while (!pf->quit && (pf->taken + pf->depth <= i)) {
+      pthread_cond_wait(&pf->change, &pf->lock);
+    }
+    if (pf->quit) {
+      pthread_mutex_unlock(&pf->lock);
+      break;
+    }
+    pthread_mutex_unlock(&pf->lock);
+
+    advise_ahead(pf, i);
+    load_file(&pf->open[i % pf->depth], &pf->slot[i % pf->depth]);
+
+    pthread_mutex_lock(&pf->lock);
+    pf->loaded = i + 1;
+    pthread_cond_broadcast(&pf->change);
+    pthread_mutex_unlock(&pf->lock);
+  }
+
+  return NULL;
+}
+
+
+
+/**** Prefetch Functions ****/
+
+/***
+    prefetch_create:  Start a thread loading the files of a list ahead of
+                      the reader.
+    args:             pf - prefetcher to create
+                      fnames - files to read, in order
+                      n - number of files
+                      depth - files to hold loaded ahead
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  pf
+***/
+int prefetch_create(imgprefetch **pf, const char **fnames, long n,
+                    int depth) {
+  int i;
+  int retval;
+
+  if ((NULL == fnames) || (n < 0)) {
+    return img_error(IMGERR_ARG, "no files to prefetch");
+  }
+
+  if (depth < 1) {
+    depth = 1;
+  }
+
+  if (NULL == (*pf = (imgprefetch *) calloc(1, sizeof(imgprefetch)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate prefetcher");
+  }
+  if ((NULL == ((*pf)->slot = (pfslot *) calloc(depth, sizeof(pfslot)))) ||
+      (NULL == ((*pf)->open = (pfopen *) calloc(depth, sizeof(pfopen))))) {
+    free((*pf)->slot);
+    free(*pf);
+    *pf = NULL;
+    return img_error(IMGERR_NOMEM, "can't allocate prefetch buffers");
+  }
+  for (i=0; i<depth; i++) {
+    (*pf)->open[i].fd = -1;
+  }
+
+  (*pf)->fnames = fnames;
+  (*pf)->n = n;
+  (*pf)->depth = depth;
+
+  if (0 != pthread_mutex_init(&(*pf)->lock, NULL)) {
+    retval = img_error(IMGERR_FAIL, "can't initialize prefetch lock");
+    goto cleanup;
+  }
+  if (0 != pthread_cond_init(&(*pf)->change, NULL)) {
+    pthread_mutex_destroy(&(*pf)->lock);
+    retval = img_error(IMGERR_FAIL, "can't initialize prefetch condition");
+    goto cleanup;
+  }
+
+  retval = pthread_create(&(*pf)->loader, NULL, loader, *pf);
+  if (0 != retval) {
+    pthread_cond_destroy(&(*pf)->change);
+    pthread_mutex_destroy(&(*pf)->lock);
+    retval = img_syserror(IMGERR_FAIL, retval,
+                          "can't start prefetch thread");
+    goto cleanup;
+  }
+
+  return 0;
+
+ cleanup:
+  free((*pf)->open);
+  free((*pf)->slot);
+  free(*pf);
+  *pf = NULL;
+  return retval;
+}
+
+/***
+    prefetch_destroy:  Stop the loading thread, waiting for it to finish
+                       the file it's on, and free everything not yet read.
+    args:              pf - prefetcher to destroy
+    modifies:  pf (set to NULL when done)
+***/
+void prefetch_destroy(imgprefetch **pf) {
+  int i;
+
+  if (NULL == *pf) {
+    return;
+  }
+
+  pthread_mutex_lock(&(*pf)->lock);
+  (*pf)->quit = 1;
+  pthread_cond_broadcast(&(*pf)->change);
+  pthread_mutex_unlock(&(*pf)->lock);
+
+  pthread_join((*pf)->loader, NULL);
+
+  for (i=0; i<(*pf)->depth; i++) {
+    slot_free(&(*pf)->slot[i]);
+    if (0 <= (*pf)->open[i].fd) {
+      close((*pf)->open[i].fd);
+    }
+  }
+
+  pthread_cond_destroy(&(*pf)->change);
+  pthread_mutex_destroy(&(*pf)->lock);
+  free((*pf)->open);
+  free((*pf)->slot);
+  free(*pf);
+  *pf = NULL;
+}
+
+/***
+    prefetch_read:  Decode the next file of the list from the memory the
+                    loader filled, then hand its slot back to the loader.
+    args:           pf - prefetcher
+                    ctx - codec contexts, NULL to use fresh ones
+                    idx - index of the file read
+                    img - image read (if non-NULL, old image released to
+                          pool)
+                    pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               1 if every file has been read
+               < 0 on failure (value depends on error)
+    modifies:  pf, ctx, idx, img
+***/
+int prefetch_read(imgprefetch *pf, imgctx *ctx, long *idx, _rgbimage **img,
+                  rgbpool *pool) {
+  const char *fname;                    /* file being read */
+  imginput in;                          /* its contents */
+  pfslot *s;                            /* its slot */
+  int retval;
+
+  pthread_mutex_lock(&pf->lock);
+  if (pf->n <= pf->taken) {
+    pthread_mutex_unlock(&pf->lock);
+    return 1;
+  }
+  *idx = pf->taken;
+  while (pf->loaded <= *idx) {
+    pthread_cond_wait(&pf->change, &pf->lock);
+  }
+  pthread_mutex_unlock(&pf->lock);
+
+  fname = pf->fnames[*idx];
+  s = &pf->slot[*idx % pf->depth];
+
+  if (0 != s->errnum) {
+    retval = img_syserror(IMGERR_IO, s->errnum, "can't read file %s", fname);
+  } else if (0 == s->nbuf) {
+    retval = img_error(IMGERR_FORMAT, "%s is empty", fname);
+  } else {
+    in.fin = NULL;
+    in.buf = s->buf;
+    in.nbuf = s->nbuf;
+    retval = image_read_input(ctx, fname, &in, img, pool);
+  }
+
+  slot_free(s);
+
+  pthread_mutex_lock(&pf->lock);
+  pf->taken++;
+  pthread_cond_broadcast(&pf->change);
+  pthread_mutex_unlock(&pf->lock);
+
+  return retval;
+}
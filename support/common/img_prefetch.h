@@ -0,0 +1,69 @@
+/*****
+      img_prefetch.h -
+      Public declarations for reading a list of images in order with the
+      file reads done ahead, on another thread, while the current image
+      decodes.  The next few files are loaded into memory so the decoder
+      never waits on the disk unless the disk is the slower of the two; a
+      loop over the list then takes about the longer of its I/O and its
+      decoding, rather than their sum.
+
+      Public Interface:
+        prefetch_create - start reading ahead through a list of files
+        prefetch_destroy - stop reading ahead and release the buffers
+        prefetch_read - decode the next file in the list
+
+      Required Libraries:
+        libpng, libjpeg
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGPREFETCH
+#define _IMGPREFETCH 1
+
+#include "img_rgb.h"
+#include "img_rgbpool.h"
+#include "img_io.h"
+
+
+/*** Data Structures ***/
+
+/* the prefetcher itself is private to img_prefetch.c */
+typedef struct __imgprefetch imgprefetch;
+
+
+/*** External Functions ***/
+
+/* start a thread loading the files of a list, at most depth ahead of the
+   reader; the list must stay valid until prefetch_destroy
+     pf - prefetcher to create
+     fnames - files to read, in order (none NULL)
+     n - number of files
+     depth - files to hold loaded ahead (if < 1, 1)
+   returns < 0 on error
+   modifies pf
+*/
+extern int prefetch_create(imgprefetch **, const char **, long, int);
+
+/* stop the loading thread and free any files loaded and not read
+     pf - prefetcher to destroy
+   modifies pf (set to NULL when done)
+*/
+extern void prefetch_destroy(imgprefetch **);
+
+/* decode the next file of the list, waiting for it to be loaded if need
+   be; one thread at a time
+     pf - prefetcher
+     ctx - codec contexts to decode with (if NULL, use fresh ones)
+     idx - index in the list of the file read
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate the image)
+   returns 0 if read, 1 if the list is done, < 0 on error (idx is still
+   set, and the next call goes on with the next file)
+   modifies pf, ctx, idx, img
+*/
+extern int prefetch_read(imgprefetch *, imgctx *, long *, _rgbimage **,
+                         rgbpool *);
+
+
+#endif   /* _IMGPREFETCH */
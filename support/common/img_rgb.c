@@ -0,0 +1,280 @@
+/*****
+      img_rgb.c -
+      Routines to support our in-memory image data structure.  The header
+      and all three color planes, plus the alpha plane if the image has
+      one, live in a single RGB_BLKALIGN-aligned block, so an image costs
+      one allocator call and the planes can be walked with aligned vector
+      loads.
+
+      Public Interface:
+        alloc_rgbimage - allocate an image in our format
+        alloc_rgbimage_mode - allocate with a given row layout
+        alloc_rgbimage_raw - allocate without zeroing the planes
+        size_rgbimage - bytes needed for an image's block
+        carve_rgbimage - lay out an image in a block
+        free_rgbimage - release an image
+        read_rgb - retrieve the value of a pixel
+        write_rgb - set the value of a pixel
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+
+#include "img_rgb.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    RETONERR:  If the previous function call returned an error code (< 0),
+               exit the function, returning the code.  Assumes the code has
+               been assigned to a local variable 'retval'.
+***/
+#define RETONERR     { if (retval < 0) { return retval; }}
+
+/***
+    ROUNDUP:  Round a size up to the next multiple of a power of two.
+              Evaluates as an expression.
+    args:     n - size to round
+              align - power of two to round to
+***/
+#define ROUNDUP(n, align)      (((n) + ((align) - 1)) & ~((size_t) (align) - 1))
+
+
+
+/**** rgbimage Support ****/
+
+/***
+    alloc_rgbimage:  Reserve memory for our internal storage of a color image
+                     with packed rows (stride == ncol).  Pixel arrays are
+                     zeroed.
+    args:            img - structure to set up (first freed if non-NULL)
+                     ncol, nrow - size of image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int alloc_rgbimage(_rgbimage **img, int ncol, int nrow) {
+
+  return alloc_rgbimage_mode(img, ncol, nrow, ALLOC_PACKED);
+}
+
+/***
+    alloc_rgbimage_mode:  Reserve memory for our internal storage of a color
+                          image, in one block laid out by carve_rgbimage.
+                          Pixel arrays (including padding) are zeroed.
+    args:                 img - structure to set up (first freed if non-NULL)
+                          ncol, nrow - size of image
+                          mode - ALLOC_* row layout, or'd with ALLOC_ALPHA
+                                 for an alpha plane
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int alloc_rgbimage_mode(_rgbimage **img, int ncol, int nrow,
+                        enum allocmode mode) {
+  int retval;
+
+  retval = alloc_rgbimage_raw(img, ncol, nrow, mode);
+  RETONERR;
+
+  memset((*img)->r, 0, (*img)->blksz - ((*img)->r - (uchar *) *img));
+
+  return 0;
+}
+
+/***
+    alloc_rgbimage_raw:  Reserve memory for our internal storage of a color
+                         image, in one block laid out by carve_rgbimage.
+                         Pixel arrays are NOT initialized, which saves a
+                         full pass over memory (and moves the page faults
+                         into the first real write) for callers that fill
+                         every pixel anyway.
+    args:                img - structure to set up (first freed if non-NULL)
+                         ncol, nrow - size of image
+                         mode - ALLOC_* row layout, or'd with ALLOC_ALPHA
+                                for an alpha plane
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int alloc_rgbimage_raw(_rgbimage **img, int ncol, int nrow,
+                       enum allocmode mode) {
+  size_t blksz;                         /* bytes for header and planes */
+  void *blk;                            /* storage for header and planes */
+
+  /* The 'free if non-NULL' means we don't try to resize the image, just
+     start from scratch. */
+  free_rgbimage(img);
+
+  if (0 == (blksz = size_rgbimage(ncol, nrow, mode))) {
+    return img_error(IMGERR_ARG, "illegal image size %d x %d or mode %d",
+                     ncol, nrow, mode);
+  }
+
+  if (0 != posix_memalign(&blk, RGB_BLKALIGN, blksz)) {
+    return img_error(IMGERR_NOMEM, "can't allocate rgb image");
+  }
+
+  *img = carve_rgbimage(blk, blksz, ncol, nrow, mode);
+
+  return 0;
+}
+
+/***
+    size_rgbimage:  Determine the size of the block holding an image.  The
+                    header is rounded up to RGB_BLKALIGN, as is each plane,
+                    so every plane starts on an aligned boundary.  A plane
+                    (stride * nrow bytes) must fit in an int, so npix and
+                    every pixel index do too.
+    args:           ncol, nrow - size of image
+                    mode - ALLOC_* row layout, or'd with ALLOC_ALPHA to
+                           count an alpha plane
+    returns:   number of bytes needed
+               0 if the size or mode is illegal, or the image too large
+***/
+size_t size_rgbimage(int ncol, int nrow, enum allocmode mode) {
+  size_t stride;                        /* bytes per plane row */
+  int nplane;                           /* color planes, plus alpha */
+
+  if ((ncol < 0) || (nrow < 0)) {
+    return 0;
+  }
+
+  nplane = (mode & ALLOC_ALPHA) ? 4 : 3;
+  mode &= ~ALLOC_ALPHA;
+
+  if (ALLOC_ALIGNED == mode) {
+    stride = ROUNDUP((size_t) ncol, RGB_VECWIDTH);
+  } else if (ALLOC_PACKED == mode) {
+    stride = ncol;
+  } else {
+    return 0;
+  }
+
+  if ((INT_MAX < stride) ||
+      ((0 < nrow) && ((size_t) INT_MAX / nrow < stride)) ||
+      ((0 < nrow) && ((SIZE_MAX / (nplane + 1)) / nrow < stride))) {
+    return 0;
+  }
+
+  return ROUNDUP(sizeof(_rgbimage), RGB_BLKALIGN) +
+    (nplane * ROUNDUP(stride * nrow, RGB_BLKALIGN));
+}
+
+/***
+    carve_rgbimage:  Lay out an image in a block: the header first, then
+                     the r, g, and b planes, then with ALLOC_ALPHA the
+                     alpha plane, each starting on a RGB_BLKALIGN
+                     boundary.  With ALLOC_ALIGNED each row is padded to a
+                     multiple of RGB_VECWIDTH so every row start is
+                     aligned too.  Pixel contents are not touched; the
+                     image is marked CSP_RGB.  The block must be at least
+                     size_rgbimage() bytes.
+    args:            blk - aligned storage for the image
+                     blksz - number of bytes in blk
+                     ncol, nrow - size of image
+                     mode - ALLOC_* row layout, or'd with ALLOC_ALPHA for
+                            an alpha plane
+    returns:   the image (which is blk)
+***/
+_rgbimage *carve_rgbimage(void *blk, size_t blksz, int ncol, int nrow,
+                          enum allocmode mode) {
+  _rgbimage *img;                       /* image in block */
+  size_t hdrsz;                         /* header size, rounded to align */
+  size_t planesz;                       /* plane size, rounded to align */
+  size_t stride;                        /* bytes per plane row */
+
+  if (ALLOC_ALIGNED == (mode & ~ALLOC_ALPHA)) {
+    stride = ROUNDUP((size_t) ncol, RGB_VECWIDTH);
+  } else {
+    stride = ncol;
+  }
+
+  hdrsz = ROUNDUP(sizeof(_rgbimage), RGB_BLKALIGN);
+  planesz = ROUNDUP(stride * nrow, RGB_BLKALIGN);
+
+  img = (_rgbimage *) blk;
+  img->ncol = ncol;
+  img->nrow = nrow;
+  img->npix = ncol * nrow;
+  img->stride = (int) stride;
+  img->r = (uchar *) blk + hdrsz;
+  img->g = img->r + planesz;
+  img->b = img->g + planesz;
+  img->a = (mode & ALLOC_ALPHA) ? img->b + planesz : NULL;
+  img->cspace = CSP_RGB;
+  img->blksz = blksz;
+
+  return img;
+}
+
+/***
+    free_rgbimage:  Release the memory stored with an image.  The planes
+                    share the header's block, so one free releases all.
+    args:           img - data structure to free
+    modifies:  img (set to NULL when done)
+***/
+void free_rgbimage(_rgbimage **img) {
+
+  if (*img) {
+    free(*img);
+    *img = NULL;
+  }
+}
+
+/***
+    read_rgb:  Get a pixel from the image.
+    args:      img - image
+               x, y - coordinates of pixel to read
+               r, g, b - color planes (all equal if greyscale image)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  r, g, b
+***/
+int read_rgb(_rgbimage *img, int x, int y, uchar *r, uchar *g, uchar *b) {
+  size_t xy;                            /* pixel index */
+
+  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
+    return img_error(IMGERR_ARG, "pixel %d,%4d is OOB (image size %d x %4d)",
+                     x, y, img->ncol, img->nrow);
+  }
+
+  xy = ((size_t) y * img->stride) + x;
+  *r = img->r[xy];
+  *g = img->g[xy];
+  *b = img->b[xy];
+
+  return 0;
+}
+
+/***
+    write_rgb:  Change a pixel in the image.
+    args:       img - image
+                x, y - coordinates of pixel to write to
+                r, g, b - color planes
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int write_rgb(_rgbimage *img, int x, int y, uchar r, uchar g, uchar b) {
+  size_t xy;                            /* pixel index */
+
+  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
+    return img_error(IMGERR_ARG, "pixel %d,%4d is OOB (image size %d x %4d)",
+                     x, y, img->ncol, img->nrow);
+  }
+
+  xy = ((size_t) y * img->stride) + x;
+  img->r[xy] = r;
+  img->g[xy] = g;
+  img->b[xy] = b;
+
+  return 0;
+}
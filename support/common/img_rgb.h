@@ -0,0 +1,158 @@
+/*****
+      img_rgb.h -
+      Public declarations for our in-memory image data structure.  Shared
+      by the PNG and JPEG file support so both can be linked into one
+      program.
+
+      The three color planes and the image header are carved out of one
+      aligned block, with a fourth alpha plane after them only if asked
+      for (ALLOC_ALPHA).  Each plane row starts 'stride' bytes after the
+      previous one, so pixel x, y is at index (y * stride) + x.
+
+      Public Interface:
+        alloc_rgbimage - allocate our internal image storage
+        alloc_rgbimage_mode - allocate with a given row layout
+        alloc_rgbimage_raw - allocate without zeroing the planes
+        size_rgbimage - bytes needed for an image's block
+        carve_rgbimage - lay out an image in a caller's block
+        free_rgbimage - release image memory
+        read_rgb - get a pixel in the image
+        write_rgb - set a pixel
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGRGB
+#define _IMGRGB 1
+
+#include <stddef.h>
+
+
+/*** Data Types ***/
+
+typedef unsigned char uchar;
+
+
+/*** Data Structures ***/
+
+/* a color image with RGB planes stored separately */
+typedef struct __rgbimage {
+  int ncol;                             /* width (number columns) of image */
+  int nrow;                             /* height (number rows) of image */
+  int npix;                             /* number pixels = w * h */
+  int stride;                           /* bytes between rows, >= ncol */
+  uchar *r;                             /* red plane */
+  uchar *g;                             /* green plane */
+  uchar *b;                             /* blue plane */
+  uchar *a;                             /* alpha plane, NULL if none */
+  int cspace;                           /* CSP_* what the planes hold */
+  size_t blksz;                         /* bytes in block holding image */
+} _rgbimage, *rgbimage;
+
+
+/*** Constants / Enumerations ***/
+
+/*
+  CLR_GREY: save an 8-bit image, assumes r, g, and b planes have same value
+  CLR_RGB:  save a full-color image
+  CLR_RGBA: save a full-color image with its alpha plane (PNG only)
+  CLR_[RGB]: save an 8-bit image using one of the planes
+*/
+enum clrplane {
+  CLR_GREY = 0x10, CLR_RGB = 0x01, CLR_RGBA = 0x03, CLR_R = 0x12,
+  CLR_G = 0x14, CLR_B = 0x18
+};
+
+/*
+  CSP_RGB: the planes hold red, green, and blue (the default)
+  CSP_YCC: the r, g, and b planes hold JFIF Y, Cb, and Cr at full size,
+           as left by a raw JPEG decode
+*/
+enum clrspace {
+  CSP_RGB = 0x00, CSP_YCC = 0x01
+};
+
+/*
+  ALLOC_PACKED:  rows are back-to-back, stride == ncol
+  ALLOC_ALIGNED: rows padded so each starts on a RGB_VECWIDTH boundary
+  ALLOC_ALPHA:   or'd with either, also allocate the alpha plane
+*/
+enum allocmode {
+  ALLOC_PACKED = 0x00, ALLOC_ALIGNED = 0x01, ALLOC_ALPHA = 0x02
+};
+
+/* alignment of the allocated block and of each plane within it */
+#define RGB_BLKALIGN     64
+/* row padding for ALLOC_ALIGNED, one AVX2 register */
+#define RGB_VECWIDTH     32
+
+
+/*** External Functions ***/
+
+/* allocate an image in our format with packed rows, initializing
+   contents to 0
+     img - image to create (frees old if non-NULL)
+     ncol, nrow - size of image
+   returns < 0 on error
+   modifies img
+*/
+extern int alloc_rgbimage(_rgbimage **, int, int);
+
+/* allocate an image in our format, initializing contents to 0
+     img - image to create (frees old if non-NULL)
+     ncol, nrow - size of image
+     mode - ALLOC_* row layout, with ALLOC_ALPHA for an alpha plane
+   returns < 0 on error
+   modifies img
+*/
+extern int alloc_rgbimage_mode(_rgbimage **, int, int, enum allocmode);
+
+/* allocate an image in our format, leaving contents uninitialized; for
+   callers (like the decoders) that overwrite every pixel
+     img - image to create (frees old if non-NULL)
+     ncol, nrow - size of image
+     mode - ALLOC_* row layout, with ALLOC_ALPHA for an alpha plane
+   returns < 0 on error
+   modifies img
+*/
+extern int alloc_rgbimage_raw(_rgbimage **, int, int, enum allocmode);
+
+/* bytes needed for one block holding an image's header and planes
+     ncol, nrow - size of image
+     mode - ALLOC_* row layout, with ALLOC_ALPHA for an alpha plane
+   returns 0 if the size is illegal or too large (a plane, stride * nrow
+     bytes, over INT_MAX)
+*/
+extern size_t size_rgbimage(int, int, enum allocmode);
+
+/* lay out an image in a block, without touching pixel contents
+     blk - RGB_BLKALIGN aligned storage of at least blksz bytes
+     blksz - size of blk, >= size_rgbimage(ncol, nrow, mode)
+     ncol, nrow - size of image
+     mode - ALLOC_* row layout, with ALLOC_ALPHA for an alpha plane
+   returns the image, which is blk
+*/
+extern _rgbimage *carve_rgbimage(void *, size_t, int, int, enum allocmode);
+
+/* release memory for an image
+     img - image to free
+   modifies img (set to NULL when done)
+*/
+extern void free_rgbimage(_rgbimage **);
+
+/* get pixel's RGB values
+     img - image
+     x, y - pixel coordinates
+     r, g, b - color planes (all modified)
+*/
+extern int read_rgb(_rgbimage *, int, int, uchar *, uchar *, uchar *);
+
+/* change a pixel's RGB values
+     img - image
+     x, y - pixel coordinates
+     r, g, b - color values
+*/
+extern int write_rgb(_rgbimage *, int, int, uchar, uchar, uchar);
+
+
+#endif   /* _IMGRGB */
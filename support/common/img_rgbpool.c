@@ -0,0 +1,260 @@
+/*****
+      img_rgbpool.c -
+      A pool that recycles rgbimage blocks.  Block sizes are rounded up to
+      size classes, four per power of two (so at most 25% slack), and each
+      class keeps a free list threaded through the cached blocks
+      themselves.  The total cached is capped by the pool's budget; a
+      release that would go over is simply freed.
+
+      Public Interface:
+        rgbpool_create - make a new pool
+        rgbpool_destroy - release a pool and all its cached blocks
+        rgbpool_acquire - get an image from the pool
+        rgbpool_acquire_alpha - get an image, with or without alpha
+        rgbpool_release - return an image to the pool
+
+      c @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "img_rgbpool.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    ROUNDUP:  Round a size up to the next multiple of a power of two.
+              Evaluates as an expression.
+    args:     n - size to round
+              align - power of two to round to
+***/
+#define ROUNDUP(n, align)      (((n) + ((align) - 1)) & ~((size_t) (align) - 1))
+
+/* smallest block we hand out is 2^POOL_MINLG bytes, and there are
+   POOL_NSUB classes between each power of two above that */
+#define POOL_MINLG           12
+#define POOL_NSUB            4
+#define POOL_NCLASS          (1 + (POOL_NSUB * (62 - POOL_MINLG)))
+
+
+/**** Data Structures ****/
+
+/* header written over a cached block to link it into its free list */
+typedef struct __poolnode {
+  struct __poolnode *next;              /* next block in same class */
+} poolnode;
+
+struct __rgbpool {
+  pthread_mutex_t lock;                 /* guards everything below */
+  size_t budget;                        /* most bytes to cache */
+  size_t cached;                        /* bytes now in free lists */
+  poolnode *free[POOL_NCLASS];          /* cached blocks by size class */
+};
+
+
+
+/**** Local Functions ****/
+
+/***
+    class_of:  Find the size class for a block.
+    args:      need - bytes required
+               cls - index of class (free list) to use
+    returns:   size of blocks in the class, >= need
+               0 if need is too large for any class
+    modifies:  cls
+***/
+static size_t class_of(size_t need, int *cls) {
+  size_t step;                          /* spacing of classes at this size */
+  size_t sz;                            /* class size */
+  int lg;                               /* 2^lg < need <= 2^(lg+1) */
+
+  if (need <= ((size_t) 1 << POOL_MINLG)) {
+    *cls = 0;
+    return (size_t) 1 << POOL_MINLG;
+  }
+
+  for (lg=POOL_MINLG; ((size_t) 1 << (lg + 1)) < need; lg++) {
+    if (61 <= lg) {
+      return 0;
+    }
+  }
+
+  step = (size_t) 1 << (lg - 2);
+  sz = ROUNDUP(need, step);
+  *cls = (POOL_NSUB * (lg - POOL_MINLG)) +
+    (int) ((sz - ((size_t) 1 << lg)) / step);
+
+  return sz;
+}
+
+
+
+/**** rgbpool Functions ****/
+
+/***
+    rgbpool_create:  Set up an empty pool.
+    args:            pool - pool to create
+                     budget - most bytes to cache in free lists
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  pool
+***/
+int rgbpool_create(rgbpool **pool, size_t budget) {
+
+  if (NULL == (*pool = (rgbpool *) calloc(1, sizeof(rgbpool)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate image pool");
+  }
+
+  if (0 != pthread_mutex_init(&(*pool)->lock, NULL)) {
+    free(*pool);
+    *pool = NULL;
+    return img_error(IMGERR_FAIL, "can't initialize image pool lock");
+  }
+
+  (*pool)->budget = budget;
+
+  return 0;
+}
+
+/***
+    rgbpool_destroy:  Release all cached blocks and the pool.
+    args:             pool - pool to free
+    modifies:  pool (set to NULL when done)
+***/
+void rgbpool_destroy(rgbpool **pool) {
+  poolnode *node;                       /* block to free */
+  int cls;                              /* size class */
+
+  if (NULL == *pool) {
+    return;
+  }
+
+  for (cls=0; cls<POOL_NCLASS; cls++) {
+    while (NULL != (node = (*pool)->free[cls])) {
+      (*pool)->free[cls] = node->next;
+      free(node);
+    }
+  }
+
+  pthread_mutex_destroy(&(*pool)->lock);
+  free(*pool);
+  *pool = NULL;
+}
+
+/***
+    rgbpool_acquire:  Get an ALLOC_ALIGNED image from the pool, re-using a
+                      cached block of the right size class if there is one
+                      and allocating a new class-sized block if not.  Pixel
+                      contents are whatever the block last held.
+    args:             pool - pool to draw from (if NULL, allocate a new
+                             image with alloc_rgbimage_raw)
+                      img - image to set up (first released if non-NULL)
+                      ncol, nrow - size of image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int rgbpool_acquire(rgbpool *pool, _rgbimage **img, int ncol, int nrow) {
+
+  return rgbpool_acquire_alpha(pool, img, ncol, nrow, 0);
+}
+
+/***
+    rgbpool_acquire_alpha:  Get an ALLOC_ALIGNED image from the pool as
+                            rgbpool_acquire does, with an alpha plane if
+                            asked for.  Blocks of both kinds share the
+                            size classes, so a cached block that held an
+                            RGB image can come back with alpha.
+    args:                   pool - pool to draw from (if NULL, allocate a
+                                   new image with alloc_rgbimage_raw)
+                            img - image to set up (first released if
+                                  non-NULL)
+                            ncol, nrow - size of image
+                            alpha - true to include the alpha plane
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int rgbpool_acquire_alpha(rgbpool *pool, _rgbimage **img, int ncol,
+                          int nrow, int alpha) {
+  poolnode *node;                       /* cached block */
+  void *blk;                            /* new block */
+  size_t need;                          /* bytes image needs */
+  size_t sz;                            /* bytes in size class */
+  int mode;                             /* ALLOC_* layout */
+  int cls;                              /* size class */
+
+  mode = ALLOC_ALIGNED | (alpha ? ALLOC_ALPHA : 0);
+
+  if (NULL == pool) {
+    return alloc_rgbimage_raw(img, ncol, nrow, mode);
+  }
+
+  rgbpool_release(pool, img);
+
+  if ((0 == (need = size_rgbimage(ncol, nrow, mode))) ||
+      (0 == (sz = class_of(need, &cls)))) {
+    return img_error(IMGERR_ARG, "illegal image size %d x %d", ncol, nrow);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  if (NULL != (node = pool->free[cls])) {
+    pool->free[cls] = node->next;
+    pool->cached -= sz;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (NULL != node) {
+    blk = node;
+  } else if (0 != posix_memalign(&blk, RGB_BLKALIGN, sz)) {
+    return img_error(IMGERR_NOMEM, "can't allocate rgb image");
+  }
+
+  *img = carve_rgbimage(blk, sz, ncol, nrow, mode);
+
+  return 0;
+}
+
+/***
+    rgbpool_release:  Return an image's block to the pool.  Blocks that are
+                      not exactly a class size (ie. not from the pool) or
+                      that would take the pool over budget are freed.
+    args:             pool - pool to return to (if NULL, free the image)
+                      img - image to release
+    modifies:  img (set to NULL when done)
+***/
+void rgbpool_release(rgbpool *pool, _rgbimage **img) {
+  poolnode *node;                       /* block being cached */
+  size_t sz;                            /* bytes in block */
+  int cls;                              /* size class */
+
+  if (NULL == *img) {
+    return;
+  }
+
+  sz = (*img)->blksz;
+  if ((NULL == pool) || (sz != class_of(sz, &cls))) {
+    free_rgbimage(img);
+    return;
+  }
+
+  node = (poolnode *) *img;
+  *img = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if ((pool->cached + sz) <= pool->budget) {
+    node->next = pool->free[cls];
+    pool->free[cls] = node;
+    pool->cached += sz;
+    node = NULL;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (NULL != node) {
+    free(node);
+  }
+}
@@ -0,0 +1,80 @@
+/*****
+      img_rgbpool.h -
+      Public declarations for a pool that recycles rgbimage blocks.  Images
+      released to the pool are kept in free lists by size class, up to a
+      byte budget, and handed back out for later images that fit the same
+      class.  This skips the allocator, the page faults, and the zeroing
+      for loops that read many images of a few sizes.
+
+      Images from the pool are always ALLOC_ALIGNED.  Their pixel contents
+      are NOT initialized.  An image from the pool may also be released
+      with free_rgbimage; the pool just doesn't get it back.
+
+      Public Interface:
+        rgbpool_create - make a new pool
+        rgbpool_destroy - release a pool and all its cached blocks
+        rgbpool_acquire - get an image from the pool
+        rgbpool_acquire_alpha - get an image, with or without alpha
+        rgbpool_release - return an image to the pool
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGRGBPOOL
+#define _IMGRGBPOOL 1
+
+#include "img_rgb.h"
+
+
+/*** Data Structures ***/
+
+/* the pool itself is private to img_rgbpool.c */
+typedef struct __rgbpool rgbpool;
+
+
+/*** External Functions ***/
+
+/* make a new, empty pool
+     pool - pool to create
+     budget - most bytes to keep cached in the free lists
+   returns < 0 on error
+   modifies pool
+*/
+extern int rgbpool_create(rgbpool **, size_t);
+
+/* release a pool, freeing every block it holds (images acquired from it
+   and not yet released stay valid and must be freed by the caller)
+     pool - pool to destroy
+   modifies pool (set to NULL when done)
+*/
+extern void rgbpool_destroy(rgbpool **);
+
+/* get an aligned image from the pool, contents uninitialized
+     pool - pool to draw from (if NULL, allocate a new image)
+     img - image to create (released to the pool first if non-NULL)
+     ncol, nrow - size of image
+   returns < 0 on error
+   modifies img
+*/
+extern int rgbpool_acquire(rgbpool *, _rgbimage **, int, int);
+
+/* get an aligned image from the pool, contents uninitialized, with an
+   alpha plane if asked for
+     pool - pool to draw from (if NULL, allocate a new image)
+     img - image to create (released to the pool first if non-NULL)
+     ncol, nrow - size of image
+     alpha - true to include the alpha plane (img->a), false for none
+   returns < 0 on error
+   modifies img
+*/
+extern int rgbpool_acquire_alpha(rgbpool *, _rgbimage **, int, int, int);
+
+/* return an image to the pool, freeing it if over budget
+     pool - pool to return to (if NULL, the image is freed)
+     img - image to release
+   modifies img (set to NULL when done)
+*/
+extern void rgbpool_release(rgbpool *, _rgbimage **);
+
+
+#endif   /* _IMGRGBPOOL */
@@ -0,0 +1,579 @@
+/*****
+      img_thread.c -
+      A work-stealing pool of worker threads for parallel loops.  Each
+      worker has its own queue (a deque); a thread working on a range too
+      large for one piece pushes its upper half onto the back of its queue
+      and carries on with the lower half, so its queue holds ever smaller
+      pieces toward the back.  Owners pop from the back, staying with the
+      small, cache-warm pieces, while thieves steal from the front and get
+      the biggest.  Callers from outside the pool share one extra queue.
+
+      Each queue has its own lock, held only to move a piece in or out.
+      Threads with nothing to do sleep on a condition variable, which is
+      only signalled when some thread is known to be asleep.
+
+      Public Interface:
+        thrpool_create - start a pool of worker threads
+        thrpool_destroy - stop the workers and release the pool
+        thrpool_parfor - run a loop over a range on the pool
+        thrpool_size - number of threads a pool runs loops on
+        thrpool_ncpu - number of CPUs this process may run on
+        thrpool_shared - the pool the library kernels use
+        thrpool_setshared - set the size of the shared pool
+
+      c @parthsarthiprasad
+*****/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "img_thread.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/* initial number of pieces a queue holds; it doubles when full */
+#define THR_QLEN             64
+
+
+/**** Data Structures ****/
+
+/* one loop being run by thrpool_parfor */
+typedef struct {
+  thrbody body;                         /* loop body */
+  void *arg;                            /* its argument */
+  long grain;                           /* smallest piece to split off */
+  atomic_long left;                     /* iterations not yet done */
+} thrloop;
+
+/* a piece of a loop waiting in a queue */
+typedef struct {
+  thrloop *loop;                        /* loop it belongs to */
+  long lo, hi;                          /* range to do */
+} thrpiece;
+
+/* a worker's queue, a ring buffer used as a deque */
+typedef struct {
+  pthread_mutex_t lock;                 /* guards everything below */
+  thrpiece *piece;                      /* ring of pieces */
+  int cap;                              /* size of ring, power of two */
+  int first;                            /* index of front (oldest) */
+  int n;                                /* pieces in ring */
+} thrqueue;
+
+struct __thrpool {
+  int nworker;                          /* worker threads started */
+  pthread_t *worker;                    /* the workers */
+  int nqueue;                           /* queues set up */
+  thrqueue *queue;                      /* nworker + 1, last for outside
+                                           callers */
+  atomic_int nqueued;                   /* pieces in all queues */
+  atomic_int nsleep;                    /* threads waiting on wake */
+  atomic_int quit;                      /* true when workers should stop */
+  pthread_mutex_t lock;                 /* guards sleeping on wake */
+  pthread_cond_t wake;                  /* new work, loop done, or quit */
+};
+
+/* argument to start a worker */
+typedef struct {
+  thrpool *pool;                        /* pool it belongs to */
+  int id;                               /* index of its queue */
+} thrstart;
+
+
+
+/**** Local Variables ****/
+
+/* pool and queue of a worker thread, NULL for other threads */
+static _Thread_local thrpool *mypool = NULL;
+static _Thread_local int myid = 0;
+
+/* the shared pool, guarded by sharedlock */
+static pthread_mutex_t sharedlock = PTHREAD_MUTEX_INITIALIZER;
+static thrpool *shared = NULL;
+static int sharedsz = 0;                /* size wanted, 0 if not set */
+static int sharedbad = 0;               /* true if it couldn't start */
+
+
+
+/**** Local Functions ****/
+
+/***
+    queue_init:  Set up an empty queue.
+    args:        q - queue to set up
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  q
+***/
+static int queue_init(thrqueue *q) {
+
+  q->cap = THR_QLEN;
+  q->first = q->n = 0;
+  if (NULL == (q->piece = (thrpiece *) malloc(q->cap * sizeof(thrpiece)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate thread pool queue");
+  }
+  if (0 != pthread_mutex_init(&q->lock, NULL)) {
+    free(q->piece);
+    q->piece = NULL;
+    return img_error(IMGERR_FAIL, "can't initialize thread pool queue lock");
+  }
+
+  return 0;
+}
+
+/***
+    queue_free:  Release a queue's storage.
+    args:        q - queue to release
+    modifies:    q
+***/
+static void queue_free(thrqueue *q) {
+
+  if (NULL != q->piece) {
+    pthread_mutex_destroy(&q->lock);
+    free(q->piece);
+    q->piece = NULL;
+  }
+}
+
+/***
+    queue_push:  Add a piece at the back of a queue, growing it if full.
+    args:        q - queue to add to
+                 p - piece to add
+    returns:   1 if added
+               0 if the queue is full and can't grow (run p yourself)
+    modifies:  q
+***/
+static int queue_push(thrqueue *q, const thrpiece *p) {
+  thrpiece *bigger;                     /* grown ring */
+  int i;
+
+  pthread_mutex_lock(&q->lock);
+  if (q->n == q->cap) {
+    if (NULL == (bigger = (thrpiece *) malloc(2 * q->cap *
+                                              sizeof(thrpiece)))) {
+      pthread_mutex_unlock(&q->lock);
+      return 0;
+    }
+    for (i=0; i<q->n; i++) {
+      bigger[i] = q->piece[(q->first + i) & (q->cap - 1)];
+    }
+    free(q->piece);
+    q->piece = bigger;
+    q->cap *= 2;
+    q->first = 0;
+  }
+  q->piece[(q->first + q->n) & (q->cap - 1)] = *p;
+  q->n++;
+  pthread_mutex_unlock(&q->lock);
+
+  return 1;
+}
+
+/***
+    queue_take:  Remove a piece from the back (owner) or front (thief) of
+                 a queue.
+    args:        q - queue to take from
+                 back - true to take the newest piece, false the oldest
+                 p - piece taken
+    returns:   1 if a piece was taken
+               0 if the queue was empty
+    modifies:  q, p
+***/
+static int queue_take(thrqueue *q, int back, thrpiece *p) {
+
+  pthread_mutex_lock(&q->lock);
+  if (0 == q->n) {
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+  }
+  q->n--;
+  if (back) {
+    *p = q->piece[(q->first + q->n) & (q->cap - 1)];
+  } else {
+    *p = q->piece[q->first];
+    q->first = (q->first + 1) & (q->cap - 1);
+  }
+  pthread_mutex_unlock(&q->lock);
+
+  return 1;
+}
+
+/***
+    wake_up:  Wake sleeping threads, if there are any.  Called after
+              changing what they wait for (new work, a loop finishing, or
+              quit); as sleepers register and check under the pool lock,
+              none can miss the change.
+    args:     pool - pool to wake
+              all - true to wake every sleeper, false for one
+***/
+static void wake_up(thrpool *pool, int all) {
+
+  if (0 < atomic_load(&pool->nsleep)) {
+    pthread_mutex_lock(&pool->lock);
+    if (all) {
+      pthread_cond_broadcast(&pool->wake);
+    } else {
+      pthread_cond_signal(&pool->wake);
+    }
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+/***
+    sleep_idle:  Wait until there may be work queued, or the loop we're
+                 waiting on is done, or the pool is stopping.
+    args:        pool - pool to wait on
+                 loop - loop whose end to wait for, NULL for workers
+***/
+static void sleep_idle(thrpool *pool, thrloop *loop) {
+
+  pthread_mutex_lock(&pool->lock);
+  atomic_fetch_add(&pool->nsleep, 1);
+  while ((0 == atomic_load(&pool->nqueued)) && !atomic_load(&pool->quit) &&
+         ((NULL == loop) || (0 < atomic_load(&loop->left)))) {
+    pthread_cond_wait(&pool->wake, &pool->lock);
+  }
+  atomic_fetch_sub(&pool->nsleep, 1);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+/***
+    find_piece:  Get the next piece to work on, from our own queue first,
+                 then stealing from the others.
+    args:        pool - pool to search
+                 id - our queue
+                 p - piece found
+    returns:   1 if a piece was found
+               0 if all queues were empty
+    modifies:  p
+***/
+static int find_piece(thrpool *pool, int id, thrpiece *p) {
+  int nq;                               /* number of queues */
+  int i;
+
+  if (0 == atomic_load(&pool->nqueued)) {
+    return 0;
+  }
+
+  nq = pool->nworker + 1;
+  for (i=0; i<nq; i++) {
+    if (queue_take(&pool->queue[(id + i) % nq], 0 == i, p)) {
+      atomic_fetch_sub(&pool->nqueued, 1);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/***
+    run_piece:  Do a piece of a loop, first splitting it in halves down to
+                the grain and queueing the upper halves for others.
+    args:       pool - pool running the loop
+                id - our queue
+                p - piece to do
+***/
+static void run_piece(thrpool *pool, int id, thrpiece p) {
+  thrpiece half;                        /* upper half split off */
+  long n;                               /* iterations done */
+
+  while (p.loop->grain < (p.hi - p.lo)) {
+    half = p;
+    half.lo = p.lo + ((p.hi - p.lo) / 2);
+    /* Count it first, so nqueued is never below the pieces queued. */
+    atomic_fetch_add(&pool->nqueued, 1);
+    if (!queue_push(&pool->queue[id], &half)) {
+      atomic_fetch_sub(&pool->nqueued, 1);
+      break;
+    }
+    p.hi = half.lo;
+    wake_up(pool, 0);
+  }
+
+  p.loop->body(p.loop->arg, p.lo, p.hi);
+
+  n = p.hi - p.lo;
+  if (n == atomic_fetch_sub(&p.loop->left, n)) {
+    wake_up(pool, 1);
+  }
+}
+
+/***
+    worker:  Main loop of a worker thread, doing pieces until told to quit.
+    args:    arg - thrstart for the worker (freed here)
+    returns:   NULL
+***/
+static void *worker(void *arg) {
+  thrpool *pool;                        /* pool we belong to */
+  thrpiece p;                           /* piece to do */
+  int id;                               /* our queue */
+
+  pool = ((thrstart *) arg)->pool;
+  id = ((thrstart *) arg)->id;
+  free(arg);
+
+  mypool = pool;
+  myid = id;
+
+  while (1) {
+    if (find_piece(pool, id, &p)) {
+      run_piece(pool, id, p);
+    } else if (atomic_load(&pool->quit)) {
+      break;
+    } else {
+      sleep_idle(pool, NULL);
+    }
+  }
+
+  return NULL;
+}
+
+
+
+/**** thrpool Functions ****/
+
+/***
+    thrpool_create:  Start a pool of worker threads.
+    args:            pool - pool to create
+                     nthread - threads to run loops on, counting the
+                               caller; if <= 0 use thrpool_ncpu
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  pool
+***/
+int thrpool_create(thrpool **pool, int nthread) {
+  thrstart *start;                      /* argument for a new worker */
+  int i;
+  int retval;
+
+  if (nthread <= 0) {
+    nthread = thrpool_ncpu();
+  }
+
+  if (NULL == (*pool = (thrpool *) calloc(1, sizeof(thrpool)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate thread pool");
+  }
+
+  if (0 != pthread_mutex_init(&(*pool)->lock, NULL)) {
+    free(*pool);
+    *pool = NULL;
+    return img_error(IMGERR_FAIL, "can't initialize thread pool lock");
+  }
+  if (0 != pthread_cond_init(&(*pool)->wake, NULL)) {
+    pthread_mutex_destroy(&(*pool)->lock);
+    free(*pool);
+    *pool = NULL;
+    return img_error(IMGERR_FAIL, "can't initialize thread pool condition");
+  }
+
+  atomic_init(&(*pool)->nqueued, 0);
+  atomic_init(&(*pool)->nsleep, 0);
+  atomic_init(&(*pool)->quit, 0);
+
+  /* From here thrpool_destroy can undo whatever is done. */
+  if ((NULL == ((*pool)->queue = (thrqueue *) calloc(nthread,
+                                                     sizeof(thrqueue)))) ||
+      (NULL == ((*pool)->worker = (pthread_t *) calloc(nthread,
+                                                       sizeof(pthread_t))))) {
+    retval = img_error(IMGERR_NOMEM, "can't allocate thread pool queues");
+    goto cleanup;
+  }
+  for (i=0; i<nthread; i++) {
+    retval = queue_init(&(*pool)->queue[i]);
+    if (retval < 0) {
+      goto cleanup;
+    }
+    (*pool)->nqueue++;
+  }
+
+  for (i=0; i<nthread-1; i++) {
+    if (NULL == (start = (thrstart *) malloc(sizeof(thrstart)))) {
+      retval = img_error(IMGERR_NOMEM, "can't allocate thread pool worker");
+      goto cleanup;
+    }
+    start->pool = *pool;
+    start->id = i;
+    retval = pthread_create(&(*pool)->worker[i], NULL, worker, start);
+    if (0 != retval) {
+      free(start);
+      retval = img_syserror(IMGERR_FAIL, retval,
+                            "can't start thread pool worker");
+      goto cleanup;
+    }
+    (*pool)->nworker++;
+  }
+
+  return 0;
+
+ cleanup:
+  thrpool_destroy(pool);
+  return retval;
+}
+
+/***
+    thrpool_destroy:  Stop the workers, waiting for them to finish, and
+                      release the pool.
+    args:             pool - pool to destroy
+    modifies:  pool (set to NULL when done)
+***/
+void thrpool_destroy(thrpool **pool) {
+  int i;
+
+  if (NULL == *pool) {
+    return;
+  }
+
+  pthread_mutex_lock(&(*pool)->lock);
+  atomic_store(&(*pool)->quit, 1);
+  pthread_cond_broadcast(&(*pool)->wake);
+  pthread_mutex_unlock(&(*pool)->lock);
+
+  for (i=0; i<(*pool)->nworker; i++) {
+    pthread_join((*pool)->worker[i], NULL);
+  }
+
+  for (i=0; i<(*pool)->nqueue; i++) {
+    queue_free(&(*pool)->queue[i]);
+  }
+
+  pthread_cond_destroy(&(*pool)->wake);
+  pthread_mutex_destroy(&(*pool)->lock);
+  free((*pool)->queue);
+  free((*pool)->worker);
+  free(*pool);
+  *pool = NULL;
+}
+
+/***
+    thrpool_parfor:  Run a loop over a range on the pool.  The caller does
+                     the first piece, then keeps taking queued pieces (of
+                     this loop or any other) until the whole range is done,
+                     sleeping only when there's nothing left to take.
+    args:            pool - pool to run on, NULL to run on the caller
+                     lo, hi - range, lo <= i < hi
+                     grain - smallest piece to hand to another thread
+                     body - loop body
+                     arg - passed to body
+***/
+void thrpool_parfor(thrpool *pool, long lo, long hi, long grain,
+                    thrbody body, void *arg) {
+  thrloop loop;                         /* the loop to run */
+  thrpiece p;                           /* piece to do */
+  int id;                               /* our queue */
+
+  if (hi <= lo) {
+    return;
+  }
+
+  if ((NULL == pool) || (0 == pool->nworker) || ((hi - lo) <= grain)) {
+    body(arg, lo, hi);
+    return;
+  }
+
+  /* Workers use their own queue; everyone else shares the extra one. */
+  id = (pool == mypool) ? myid : pool->nworker;
+
+  loop.body = body;
+  loop.arg = arg;
+  loop.grain = (grain < 1) ? 1 : grain;
+  atomic_init(&loop.left, hi - lo);
+
+  p.loop = &loop;
+  p.lo = lo;
+  p.hi = hi;
+  run_piece(pool, id, p);
+
+  while (0 < atomic_load(&loop.left)) {
+    if (find_piece(pool, id, &p)) {
+      run_piece(pool, id, p);
+    } else {
+      sleep_idle(pool, &loop);
+    }
+  }
+}
+
+/***
+    thrpool_size:  Count the threads a pool runs loops on.
+    args:          pool - pool to check, may be NULL
+    returns:   workers plus the calling thread
+***/
+int thrpool_size(thrpool *pool) {
+
+  return (NULL == pool) ? 1 : (pool->nworker + 1);
+}
+
+/***
+    thrpool_ncpu:  Count the CPUs this process may run on, from its
+                   affinity mask (which taskset, cgroups, and job
+                   schedulers set), else the number online.
+    returns:   number of CPUs, at least 1
+***/
+int thrpool_ncpu(void) {
+  cpu_set_t cpus;                       /* affinity mask */
+  long n;                               /* CPUs online */
+
+  if (0 == sched_getaffinity(0, sizeof(cpus), &cpus)) {
+    return (0 < CPU_COUNT(&cpus)) ? CPU_COUNT(&cpus) : 1;
+  }
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (0 < n) ? (int) n : 1;
+}
+
+/***
+    thrpool_shared:  Get the pool the library kernels use, starting it on
+                     the first call.  Its size is the last given to
+                     thrpool_setshared, else IMG_THREADS from the
+                     environment, else thrpool_ncpu.
+    returns:   the pool
+               NULL if it couldn't be started
+***/
+thrpool *thrpool_shared(void) {
+  const char *env;                      /* IMG_THREADS setting */
+  thrpool *pool;                        /* pool to return */
+  int n;                                /* size of pool */
+
+  pthread_mutex_lock(&sharedlock);
+  if ((NULL == shared) && !sharedbad) {
+    n = sharedsz;
+    if ((0 == n) && (NULL != (env = getenv("IMG_THREADS")))) {
+      n = atoi(env);
+    }
+    sharedbad = (thrpool_create(&shared, n) < 0);
+  }
+  pool = shared;
+  pthread_mutex_unlock(&sharedlock);
+
+  return pool;
+}
+
+/***
+    thrpool_setshared:  Set the size of the shared pool.  If it has already
+                        started it is replaced, so no kernel may be running.
+    args:               nthread - threads to run on, counting the caller;
+                                  if <= 0 use thrpool_ncpu
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+***/
+int thrpool_setshared(int nthread) {
+  int retval;
+
+  pthread_mutex_lock(&sharedlock);
+  sharedsz = (nthread <= 0) ? thrpool_ncpu() : nthread;
+  sharedbad = 0;
+  retval = 0;
+  if (NULL != shared) {
+    thrpool_destroy(&shared);
+    retval = thrpool_create(&shared, sharedsz);
+    sharedbad = (retval < 0);
+  }
+  pthread_mutex_unlock(&sharedlock);
+
+  return retval;
+}
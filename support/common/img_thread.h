@@ -0,0 +1,94 @@
+/*****
+      img_thread.h -
+      Public declarations for the worker thread pool the library's kernels
+      share.  A pool runs parallel loops over index ranges (image rows, or
+      files in a batch): the range is split in halves down to a grain, the
+      halves go on per-worker queues, and idle workers steal the largest
+      pieces left from the others.  The thread calling thrpool_parfor
+      works on the loop too, so a pool of n threads starts n - 1 workers.
+
+      Several threads may run loops on one pool at once, and a loop body
+      may itself run a loop.  Each waits by doing queued work, never by
+      blocking a worker, so nesting doesn't deadlock.
+
+      The library uses one shared pool, sized on first use from the
+      IMG_THREADS environment variable, else the CPU affinity mask.  A
+      program that already runs one task per core (a Chapel forall, say)
+      should call thrpool_setshared(1) first, so kernels run on the
+      calling task and the cores aren't oversubscribed.
+
+      Public Interface:
+        thrpool_create - start a pool of worker threads
+        thrpool_destroy - stop the workers and release the pool
+        thrpool_parfor - run a loop over a range on the pool
+        thrpool_size - number of threads a pool runs loops on
+        thrpool_ncpu - number of CPUs this process may run on
+        thrpool_shared - the pool the library kernels use
+        thrpool_setshared - set the size of the shared pool
+
+      c @parthsarthiprasad
+*****/
+
+#ifndef _IMGTHREAD
+#define _IMGTHREAD 1
+
+
+/*** Data Structures ***/
+
+/* the pool itself is private to img_thread.c */
+typedef struct __thrpool thrpool;
+
+/* loop body, run on pieces of the range in any order and any thread
+     arg - argument given to thrpool_parfor
+     lo, hi - piece of the range to do, lo <= i < hi
+*/
+typedef void (*thrbody)(void *, long, long);
+
+
+/*** External Functions ***/
+
+/* start a pool
+     pool - pool to create
+     nthread - threads to run loops on, counting the caller (if <= 0, use
+               thrpool_ncpu; if 1, loops run entirely on the caller)
+   returns < 0 on error
+   modifies pool
+*/
+extern int thrpool_create(thrpool **, int);
+
+/* stop the workers and release the pool; no loop may be running on it
+     pool - pool to destroy
+   modifies pool (set to NULL when done)
+*/
+extern void thrpool_destroy(thrpool **);
+
+/* run body over lo <= i < hi, returning when all of it is done
+     pool - pool to run on (if NULL, run on the caller as one piece)
+     lo, hi - range of the loop
+     grain - smallest piece worth handing to another thread (>= 1)
+     body - loop body
+     arg - passed to body
+*/
+extern void thrpool_parfor(thrpool *, long, long, long, thrbody, void *);
+
+/* number of threads a pool runs loops on, counting the caller, 1 if pool
+   is NULL */
+extern int thrpool_size(thrpool *);
+
+/* number of CPUs in this process's affinity mask, at least 1 */
+extern int thrpool_ncpu(void);
+
+/* the pool shared by the library kernels, started on the first call
+   returns NULL if the pool can't be started (kernels then run serially)
+*/
+extern thrpool *thrpool_shared(void);
+
+/* set the size of the shared pool, replacing it if already started; do
+   this before any kernel runs
+     nthread - as thrpool_create
+   returns < 0 on error
+*/
+extern int thrpool_setshared(int);
+
+
+#endif   /* _IMGTHREAD */
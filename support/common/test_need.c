@@ -0,0 +1,268 @@
+
+/*****
+      test_need.c -
+      Test program for image_need, the memory image_read_batch budgets for
+      each file.  Writes small PNGs into memory with libpng in each color
+      type, with and without transparency (tRNS), plain and interlaced,
+      then probes and decodes each.  The probe must say there is alpha
+      exactly when the decoded image has an alpha plane, and the bytes
+      predicted must be the image's block (img->blksz), plus for an
+      interlaced file the whole image libpng buffers.  Prints a line per
+      case and exits with 1 if any failed.
+
+      Call:
+        test_need
+
+      @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+
+#include "img_io.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    NCOL, NROW:  Size of the test images.
+***/
+#define NCOL         300
+#define NROW         200
+
+
+/**** Data ****/
+
+/* a PNG being written into memory */
+typedef struct {
+  uchar *buf;                           /* encoded image */
+  size_t bufsz;                         /* size of buf */
+  size_t nbuf;                          /* bytes of buf used */
+} membuf;
+
+/* a test file, and what decoding it should give */
+typedef struct {
+  const char *name;                     /* description of case */
+  int pngtype;                          /* PNG_COLOR_TYPE_* to write */
+  int trns;                             /* true to add a tRNS chunk */
+  int nfile;                            /* bytes per pixel in file */
+  int nout;                             /* channels libpng decodes to,
+                                           incl. alpha */
+} needcase;
+
+static const needcase cases[] = {
+  { "palette",        PNG_COLOR_TYPE_PALETTE,    0, 1, 3 },
+  { "palette + tRNS", PNG_COLOR_TYPE_PALETTE,    1, 1, 4 },
+  { "grey",           PNG_COLOR_TYPE_GRAY,       0, 1, 1 },
+  { "grey + tRNS",    PNG_COLOR_TYPE_GRAY,       1, 1, 2 },
+  { "grey + alpha",   PNG_COLOR_TYPE_GRAY_ALPHA, 0, 2, 2 },
+  { "RGB",            PNG_COLOR_TYPE_RGB,        0, 3, 3 },
+  { "RGB + tRNS",     PNG_COLOR_TYPE_RGB,        1, 3, 4 },
+  { "RGBA",           PNG_COLOR_TYPE_RGB_ALPHA,  0, 4, 4 }
+};
+
+
+/**** Program ****/
+
+/***
+    write_mem:  libpng write function appending to a membuf.
+    args:       ptr - PNG being written, with the membuf as its I/O pointer
+                data - bytes to add
+                len - number of bytes
+    modifies:  I/O pointer's buffer
+***/
+static void write_mem(png_structp ptr, png_bytep data, png_size_t len) {
+  membuf *mb;                           /* buffer being written */
+  uchar *newbuf;                        /* buffer after growing */
+  size_t newsz;                         /* size of newbuf */
+
+  mb = (membuf *) png_get_io_ptr(ptr);
+  if ((mb->bufsz - mb->nbuf) < len) {
+    newsz = (0 == mb->bufsz) ? 65536 : mb->bufsz;
+    while ((newsz - mb->nbuf) < len) {
+      newsz *= 2;
+    }
+    if (NULL == (newbuf = (uchar *) realloc(mb->buf, newsz))) {
+      png_error(ptr, "can't grow output buffer");
+    }
+    mb->buf = newbuf;
+    mb->bufsz = newsz;
+  }
+
+  memcpy(mb->buf + mb->nbuf, data, len);
+  mb->nbuf += len;
+}
+
+/***
+    flush_mem:  libpng flush function for a membuf, which has nothing to do.
+    args:       ptr - PNG being written
+***/
+static void flush_mem(png_structp ptr) {
+
+  (void) ptr;
+}
+
+/***
+    write_png:  Encode a test pattern with libpng.
+    args:       tc - what to write
+                interlace - true to write Adam7 interlaced
+                mb - buffer to write into, emptied first
+    returns:   0 if successful
+               < 0 on failure
+    modifies:  mb
+***/
+static int write_png(const needcase *tc, int interlace, membuf *mb) {
+  png_structp ptr;                      /* internal reference to PNG data */
+  png_infop info;                       /* picture information */
+  png_color pal[256];                   /* palette */
+  png_byte trns[16];                    /* palette entries' alpha */
+  png_color_16 key;                     /* transparent grey or RGB */
+  png_byte *row;                        /* row to write */
+  int npass;                            /* interlace passes */
+  int p, x, y;
+  int retval;
+
+  ptr = NULL;
+  info = NULL;
+  row = NULL;
+  mb->nbuf = 0;
+
+  ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if ((NULL == ptr) || (NULL == (info = png_create_info_struct(ptr)))) {
+    retval = IMGERR_NOMEM;
+    goto cleanup;
+  }
+  if (NULL == (row = (png_byte *) malloc((size_t) tc->nfile * NCOL))) {
+    retval = IMGERR_NOMEM;
+    goto cleanup;
+  }
+  if (setjmp(png_jmpbuf(ptr))) {
+    retval = IMGERR_CODEC;
+    goto cleanup;
+  }
+
+  png_set_write_fn(ptr, mb, write_mem, flush_mem);
+  png_set_IHDR(ptr, info, NCOL, NROW, 8, tc->pngtype,
+               interlace ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE,
+               PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+  if (PNG_COLOR_TYPE_PALETTE == tc->pngtype) {
+    for (x=0; x<256; x++) {
+      pal[x].red = x;
+      pal[x].green = 255 - x;
+      pal[x].blue = x / 2;
+    }
+    png_set_PLTE(ptr, info, pal, 256);
+  }
+  if (tc->trns) {
+    memset(&key, 0, sizeof(key));
+    for (x=0; x<(int) sizeof(trns); x++) {
+      trns[x] = 16 * x;
+    }
+    png_set_tRNS(ptr, info, trns,
+                 (PNG_COLOR_TYPE_PALETTE == tc->pngtype) ? sizeof(trns) : 0,
+                 &key);
+  }
+  png_write_info(ptr, info);
+
+  npass = png_set_interlace_handling(ptr);
+  for (p=0; p<npass; p++) {
+    for (y=0; y<NROW; y++) {
+      for (x=0; x<tc->nfile * NCOL; x++) {
+        row[x] = (png_byte) (x + y);
+      }
+      png_write_row(ptr, row);
+    }
+  }
+  png_write_end(ptr, info);
+
+  retval = 0;
+
+ cleanup:
+  png_destroy_write_struct(&ptr, &info);
+  free(row);
+
+  return retval;
+}
+
+/***
+    check_case:  Probe and decode a test file, checking the prediction.
+    args:        tc - what was written
+                 interlace - true if written interlaced
+                 mb - buffer holding PNG
+    returns:   0 if the case passed, 1 if not
+***/
+static int check_case(const needcase *tc, int interlace, const membuf *mb) {
+  imginput in;                          /* the PNG as an input */
+  imginfo info;                         /* what the header says */
+  _rgbimage *img;                       /* image decoded */
+  size_t need;                          /* bytes predicted */
+  size_t want;                          /* bytes decoding took */
+  int failed;                           /* true if check failed */
+
+  img = NULL;
+  failed = 1;
+  in.fin = NULL;
+  in.buf = mb->buf;
+  in.nbuf = mb->nbuf;
+
+  if ((image_probe_input(&in, tc->name, &info) < 0) ||
+      (image_read_input(NULL, tc->name, &in, &img, NULL) < 0)) {
+    printf("FAIL  %-15s %s:  %s\n", tc->name, interlace ? "Adam7" : "plain",
+           img_errmsg());
+    goto cleanup;
+  }
+
+  need = image_need(&info);
+  want = img->blksz;
+  if (interlace) {
+    want += (size_t) NCOL * NROW * tc->nout;
+  }
+  if ((info.alpha != (NULL != img->a)) || (need != want)) {
+    printf("FAIL  %-15s %s:  alpha %s, decoded with %s; predicted %zu "
+           "bytes, took %zu\n", tc->name, interlace ? "Adam7" : "plain",
+           info.alpha ? "probed" : "not probed",
+           (NULL != img->a) ? "alpha" : "none", need, want);
+    goto cleanup;
+  }
+
+  printf("ok    %-15s %s:  %zu bytes\n", tc->name,
+         interlace ? "Adam7" : "plain", need);
+  failed = 0;
+
+ cleanup:
+  free_rgbimage(&img);
+
+  return failed;
+}
+
+
+int main(void) {
+  membuf mb;                            /* encoded image */
+  int interlace;                        /* true for Adam7 */
+  int nfail;                            /* cases that failed */
+  int i;
+
+  memset(&mb, 0, sizeof(mb));
+  nfail = 0;
+
+  img_setlog(NULL, NULL);
+
+  for (interlace=0; interlace<2; interlace++) {
+    for (i=0; i<(int) (sizeof(cases) / sizeof(cases[0])); i++) {
+      if (write_png(&cases[i], interlace, &mb) < 0) {
+        printf("test_need: libpng can't write test image\n");
+        free(mb.buf);
+        return 1;
+      }
+      nfail += check_case(&cases[i], interlace, &mb);
+    }
+  }
+
+  printf("\n%d case%s failed\n", nfail, (1 == nfail) ? "" : "s");
+  free(mb.buf);
+
+  return (0 == nfail) ? 0 : 1;
+}
@@ -7,11 +7,19 @@
       Public Interface:
         JPEG_isa - test if file is in JPEG format
         JPEG_read - read an image from disk
+        JPEG_read_pool - read an image into a block from an image pool
+        JPEG_read_input - read an image from an already open input
+        JPEG_read_ctx - read an image with a kept codec context
+        JPEG_read_mem - read an image from a buffer in memory
+        JPEG_read_scaled - read an image reduced in size for previews
+        JPEG_read_raw - read an image's YCbCr planes without libjpeg's
+                        color conversion
         JPEG_write - write an image to disk
-        alloc_rgbimage - allocate an image in our format
-        free_rgbimage - release an image
-        read_rgb - retrieve the value of a pixel
-        write_rgb - set the value of a pixel
+        JPEG_write_ctx - write an image with a kept codec context
+        JPEG_write_mem - write an image to a buffer in memory
+        JPEG_ctx_create - make a codec context to keep between images
+        JPEG_ctx_destroy - release a codec context
+      The rgbimage support routines are in img_rgb.c.
 
       @parthsarthiprasad
 *****/
@@ -19,11 +27,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <jpeglib.h>
+#include <jerror.h>
 #include <errno.h>
 #include <string.h>
 #include <setjmp.h>
 
-#include "img_jpeg_v2.h"
+#include "img_jpeg_v3.h"
+#include "img_input.h"
+#include "img_kern.h"
+#include "img_err.h"
 
 
 
@@ -46,7 +58,24 @@
 ***/
 #define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
 
-#define JPEG_write(...) JPEG_write_default((f_args){__VA_ARGS__});
+/***
+    JPEG_STRIP:  Number of rows passed to or from libjpeg per scanline call.
+                 Two MCU rows at the largest (2x2) sampling, so the codec
+                 has a full iMCU row to work on each call.
+***/
+#define JPEG_STRIP   16
+
+/***
+    JPEG_MAXSCALE:  Largest reduction libjpeg can make while decoding, as the
+                    denominator of 1/n.
+***/
+#define JPEG_MAXSCALE   8
+
+/***
+    JPEG_MEMCHUNK:  Starting size of a buffer JPEG_write_mem allocates.
+***/
+#define JPEG_MEMCHUNK   65536
+
 /*
  * ERROR HANDLING:
  *
@@ -69,13 +98,6 @@
  *
  * Here's the extended error handler struct:
  */
-//struct for wrapper funtion JPEG_read
-typedef struct {
-  const char *fname; 
-  _rgbimage *img;
-  int quality;
-} f_args;
-
 struct my_error_mgr {
   struct jpeg_error_mgr pub;	/* "public" fields */
 
@@ -94,190 +116,508 @@ my_error_exit (j_common_ptr cinfo)
   /* cinfo->err really points to a my_error_mgr struct, so coerce pointer */
   my_error_ptr myerr = (my_error_ptr) cinfo->err;
 
-  /* Always display the message. */
-  /* We could postpone this until after returning, if we chose. */
-  (*cinfo->err->output_message) (cinfo);
+  char buffer[JMSG_LENGTH_MAX];
+
+  /* Keep the message as this thread's last error rather than printing
+   * it; the caller decides whether to report it.
+   */
+  (*cinfo->err->format_message) (cinfo, buffer);
+  (void) img_error(IMGERR_CODEC, "JPEG: %s", buffer);
 
   /* Return control to the setjmp point */
   longjmp(myerr->setjmp_buffer, 1);
 }
 
+/*
+ * And this one replaces output_message, so warnings (corrupt data the
+ * library worked around) go to our log instead of straight to stderr.
+ */
+
+METHODDEF(void)
+my_output_message (j_common_ptr cinfo)
+{
+  char buffer[JMSG_LENGTH_MAX];
 
+  (*cinfo->err->format_message) (cinfo, buffer);
+  img_warning("JPEG: %s", buffer);
+}
 
-/**** JPEG Functions ****/
 
-int JPEG_write_wrapper(const char * fname, _rgbimage *img, int quality );
+
+/**** Local Functions ****/
+
+/* where read_jpeg gets its bytes: an open file, or a buffer in memory */
+typedef struct {
+  FILE *fin;				/* file to read, NULL to use buf */
+  const uchar *buf;			/* encoded image */
+  size_t nbuf;				/* bytes in buf */
+} jpgsrc;
+
+/* where write_jpeg puts its bytes: an open file, or a buffer in memory */
+typedef struct {
+  FILE *fout;				/* file to write, NULL to use buf */
+  uchar *buf;				/* encoded image */
+  size_t bufsz;				/* size of buf */
+  size_t nbuf;				/* bytes of buf used */
+} jpgdst;
+
+/* Our destination manager for a buffer in memory.  libjpeg's own
+   (jpeg_mem_dest) keeps the buffer it grows to private until the image
+   is finished, so it is lost if encoding fails partway.  This one grows
+   the jpgdst's buffer in place with realloc, so the buffer is always
+   where the caller can free or reuse it.
+ */
+struct my_dest_mgr {
+  struct jpeg_destination_mgr pub;	/* "public" fields */
+
+  jpgdst *dst;				/* buffer being written */
+};
+
+typedef struct my_dest_mgr * my_dest_ptr;
+
+/***
+    mem_grow:  Double the buffer an image is being encoded into, or make a
+               first one.  Running out of memory is a libjpeg error, which
+               doesn't return.
+    args:      cinfo - compressor, with a my_dest_mgr destination
+               dst - buffer being written
+    modifies:  dst
+***/
+static void mem_grow(j_compress_ptr cinfo, jpgdst *dst) {
+  uchar *newbuf;			/* buffer after growing */
+  size_t newsz;				/* size of newbuf */
+
+  newsz = (0 == dst->bufsz) ? JPEG_MEMCHUNK : 2 * dst->bufsz;
+  if (NULL == (newbuf = (uchar *) realloc(dst->buf, newsz))) {
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+  }
+  dst->buf = newbuf;
+  dst->bufsz = newsz;
+}
+
+/*
+ * The memory destination's methods.  init_destination starts at the
+ * front of the buffer, making one if there is none; empty_output_buffer
+ * is only called when the buffer is full; and term_destination records
+ * how much was written.
+ */
+
+METHODDEF(void)
+mem_init_destination (j_compress_ptr cinfo)
+{
+  my_dest_ptr dest = (my_dest_ptr) cinfo->dest;
+
+  if (0 == dest->dst->bufsz) {
+    mem_grow(cinfo, dest->dst);
+  }
+  dest->dst->nbuf = 0;
+  dest->pub.next_output_byte = dest->dst->buf;
+  dest->pub.free_in_buffer = dest->dst->bufsz;
+}
+
+METHODDEF(boolean)
+mem_empty_output_buffer (j_compress_ptr cinfo)
+{
+  my_dest_ptr dest = (my_dest_ptr) cinfo->dest;
+  size_t used = dest->dst->bufsz;	/* bytes written, all of buf */
+
+  mem_grow(cinfo, dest->dst);
+  dest->pub.next_output_byte = dest->dst->buf + used;
+  dest->pub.free_in_buffer = dest->dst->bufsz - used;
+
+  return TRUE;
+}
+
+METHODDEF(void)
+mem_term_destination (j_compress_ptr cinfo)
+{
+  my_dest_ptr dest = (my_dest_ptr) cinfo->dest;
+
+  dest->dst->nbuf = dest->dst->bufsz - dest->pub.free_in_buffer;
+}
+
+/***
+    my_mem_dest:  Point a compressor at a buffer in memory, the way
+                  jpeg_mem_dest does, making our destination manager the
+                  first time (in the permanent pool, so it lasts as long
+                  as the compressor).
+    args:         cinfo - compressor, whose dest is NULL or was made here
+                  dst - buffer to write
+    modifies:  cinfo
+***/
+static void my_mem_dest(j_compress_ptr cinfo, jpgdst *dst) {
+  my_dest_ptr dest;			/* our destination manager */
+
+  if (NULL == cinfo->dest) {
+    cinfo->dest = (struct jpeg_destination_mgr *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+                                  sizeof(struct my_dest_mgr));
+  }
+
+  dest = (my_dest_ptr) cinfo->dest;
+  dest->pub.init_destination = mem_init_destination;
+  dest->pub.empty_output_buffer = mem_empty_output_buffer;
+  dest->pub.term_destination = mem_term_destination;
+  dest->dst = dst;
+}
+
+/* codec state kept between images, so libjpeg's objects, their memory
+   pools, and the tables in them are set up once rather than per image.
+   Each compressor and decompressor has its own error manager (the
+   setjmp target) and remembers the stdio and memory source/destination
+   managers it has made, since libjpeg won't let a manager made by one
+   kind be reused for the other. */
+struct __jpgctx {
+  struct jpeg_decompress_struct dinfo;	/* decompressor */
+  struct my_error_mgr derr;		/* its error handler */
+  struct jpeg_source_mgr *stdsrc;	/* dinfo's stdio source, if made */
+  struct jpeg_source_mgr *memsrc;	/* dinfo's memory source, if made */
+  int hasd;				/* true once dinfo created */
+  struct jpeg_compress_struct cinfo;	/* compressor */
+  struct my_error_mgr cerr;		/* its error handler */
+  struct jpeg_destination_mgr *stddst;	/* cinfo's stdio destination */
+  struct jpeg_destination_mgr *memdst;	/* cinfo's memory destination */
+  int hasc;				/* true once cinfo created */
+  JSAMPLE *strip;			/* write_jpeg's strip buffer */
+  size_t stripsz;			/* bytes in strip */
+};
+
+/* a kernel splitting a row of interleaved samples into the r, g, b planes */
+typedef void (*deintfn)(const uchar *, uchar *, uchar *, uchar *, int);
+
+/***
+    deint4_noalpha:  Split a row of 4-channel samples into planes, dropping
+                     the fourth channel, so it fits the deintfn signature.
+    args:            src - samples, 4 per pixel
+                     r, g, b - planes to fill
+                     n - number of pixels
+***/
+static void deint4_noalpha(const uchar *src, uchar *r, uchar *g, uchar *b,
+                           int n) {
+
+  kern_deint4(src, r, g, b, NULL, n);
+}
+
+/***
+    decode_strips:  Read the decompressed, interleaved scanlines in strips
+                    and split them into the image's planes.  The decompressor
+                    must be started, and the image sized to its output.
+    args:           cinfo - decompressor
+                    img - image to fill
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int decode_strips(j_decompress_ptr cinfo, _rgbimage *img) {
+  JSAMPARRAY buffer;		/* Output strip buffer */
+  deintfn deint;		/* kernel splitting rows into planes */
+  JDIMENSION nread;		/* rows returned by last read */
+  int nstrip;			/* rows in strip buffer */
+  int row_stride;		/* physical row width in output buffer */
+  int y, i;			/* row, row in strip */
+  size_t xy;			/* index of row start */
+
+  /* Pick the kernel for the channel count once, not per row. */
+  if (1 == cinfo->output_components) {
+    /* Note this correctly reads 1-channel greyscale, where r == g == b. */
+    deint = kern_deint1;
+  } else if (3 == cinfo->output_components) {
+    deint = kern_deint3;
+  } else if (4 == cinfo->output_components) {
+    deint = deint4_noalpha;
+  } else {
+    return img_error(IMGERR_UNSUPPORTED, "JPEG: do not support %d channels",
+                     cinfo->output_components);
+  }
+
+  /* JSAMPLEs per row in output buffer */
+  row_stride = cinfo->output_width * cinfo->output_components;
+
+  /* Make a strip of at least JPEG_STRIP rows, and a whole multiple of the
+   * library's preferred output height, that will go away when done with
+   * the image.
+   */
+  nstrip = cinfo->rec_outbuf_height *
+    ((JPEG_STRIP + cinfo->rec_outbuf_height - 1) / cinfo->rec_outbuf_height);
+  buffer = (*cinfo->mem->alloc_sarray)
+		((j_common_ptr) cinfo, JPOOL_IMAGE, row_stride, nstrip);
+
+  /* Here we use the library's state variable output_scanline as the loop
+   * counter, so that we don't have to keep track ourselves.  Each call
+   * returns as many rows as the library has ready, up to the strip height.
+   */
+  while (cinfo->output_scanline < cinfo->output_height) {
+    y = cinfo->output_scanline;
+    nread = jpeg_read_scanlines(cinfo, buffer, nstrip);
+
+    xy = (size_t) y * img->stride;
+    for (i=0; i<(int) nread; i++, xy+=img->stride) {
+      deint(buffer[i], img->r + xy, img->g + xy, img->b + xy, img->ncol);
+    }
+  }
+
+  return 0;
+}
+
+/***
+    raw_ok:  Check if decode_raw can handle a file's layout: three YCbCr
+             components, Cb and Cr sampled 1x1, and Y sampled 1 or 2 in
+             each direction.  Covers 4:4:4, 4:2:2, 4:4:0, and 4:2:0.  The
+             header must have been read, and no scaling set.
+    args:    cinfo - decompressor
+    returns:   true if a raw decode is possible, 0 if not
+***/
+static int raw_ok(j_decompress_ptr cinfo) {
+  jpeg_component_info *comp;		/* per-component layout */
+
+  comp = cinfo->comp_info;
+  return (JCS_YCbCr == cinfo->jpeg_color_space) &&
+    (3 == cinfo->num_components) &&
+    (cinfo->scale_num == cinfo->scale_denom) &&
+    (1 == comp[1].h_samp_factor) && (1 == comp[1].v_samp_factor) &&
+    (1 == comp[2].h_samp_factor) && (1 == comp[2].v_samp_factor) &&
+    (comp[0].h_samp_factor <= 2) && (comp[0].v_samp_factor <= 2);
+}
 
 /***
-    JPEG_isa:  Read the header of the file and see if it's in JPEG format.
-    args:     fname - name of file to check
-    returns:   true if fname in PNG format, 0 if not
+    decode_raw:  Read the Y, Cb, and Cr planes from the decompressor one
+                 iMCU row (8 or 16 image rows) at a time.  Chroma is
+                 upsampled by replication: across the row by the kernels,
+                 and down by reusing a chroma row for each luma row it
+                 covers.  Depending on img->cspace the rows are converted
+                 to RGB or stored as is.  The decompressor must be started
+                 with raw_data_out set, and the image sized to its output.
+    args:        cinfo - decompressor
+                 img - image to fill
+    modifies:  img
+***/
+static void decode_raw(j_decompress_ptr cinfo, _rgbimage *img) {
+  JSAMPARRAY comp[3];		/* rows of each component */
+  JSAMPROW cb, cr;		/* chroma rows for a luma row */
+  int hsamp, vsamp;		/* luma samples per chroma sample */
+  int nline;			/* image rows per iMCU row */
+  int nrow;			/* rows of an iMCU row inside image */
+  int y, i, c;			/* row, row in iMCU, component */
+  size_t xy;			/* index of row start */
+
+  hsamp = cinfo->max_h_samp_factor;
+  vsamp = cinfo->max_v_samp_factor;
+  nline = vsamp * DCTSIZE;
+
+  for (c=0; c<3; c++) {
+    comp[c] = (*cinfo->mem->alloc_sarray)
+      ((j_common_ptr) cinfo, JPOOL_IMAGE,
+       cinfo->comp_info[c].width_in_blocks * DCTSIZE,
+       cinfo->comp_info[c].v_samp_factor * DCTSIZE);
+  }
+
+  while (cinfo->output_scanline < cinfo->output_height) {
+    y = cinfo->output_scanline;
+    (void) jpeg_read_raw_data(cinfo, comp, nline);
+
+    /* The last iMCU row is padded past the bottom of the image. */
+    nrow = img->nrow - y;
+    if (nline < nrow) {
+      nrow = nline;
+    }
+
+    xy = (size_t) y * img->stride;
+    for (i=0; i<nrow; i++, xy+=img->stride) {
+      cb = comp[1][i / vsamp];
+      cr = comp[2][i / vsamp];
+      if (CSP_YCC == img->cspace) {
+        memcpy(img->r + xy, comp[0][i], img->ncol);
+        if (2 == hsamp) {
+          kern_up2(cb, img->g + xy, img->ncol);
+          kern_up2(cr, img->b + xy, img->ncol);
+        } else {
+          memcpy(img->g + xy, cb, img->ncol);
+          memcpy(img->b + xy, cr, img->ncol);
+        }
+      } else if (2 == hsamp) {
+        kern_ycc2rgb_h2(comp[0][i], cb, cr, img->r + xy, img->g + xy,
+                        img->b + xy, img->ncol);
+      } else {
+        kern_ycc2rgb(comp[0][i], cb, cr, img->r + xy, img->g + xy,
+                     img->b + xy, img->ncol);
+      }
+    }
+  }
+}
+
+
+
+
+/**** JPEG Functions ****/
+
+/***
+    JPEG_isa:  Read the header of the file and see if it's in JPEG format,
+               ie. starts with the SOI marker and the start of another.
+    args:      fname - name of file to check
+    returns:   true if fname in JPEG format, 0 if not
                < 0 on failure (value depends on error)
 ***/
 int JPEG_isa(const char *fname) {
   FILE *fin;                            /* file handle to read from */
-  struct jpeg_error_mgr jerr  ;                   /* error message */
-  int isjpeg;                            /* true if PNG file */
-  char * buffer;                        // to read start index 
-  int * soi;
-  char* errmsg;
+  uchar soi[3];                         /* SOI marker, next marker's 0xff */
+  int isjpeg;                           /* true if JPEG file */
   int retval;
-  int marker;
-  int markerSize;
-  int four;
-/*
-  for jfif and exif support
-  UInt16 soi = br.ReadUInt16();  // Start of Image (SOI) marker (FFD8)
-                UInt16 marker = br.ReadUInt16(); // JFIF marker (FFE0) EXIF marker (FFE1)
-                UInt16 markerSize = br.ReadUInt16(); // size of marker data (incl. marker)
-                UInt32 four = br.ReadUInt32(); // JFIF 0x4649464a or Exif  0x66697845
-
-                Boolean isJpeg = soi == 0xd8ff && (marker & 0xe0ff) == 0xe0ff;
-                Boolean isExif = isJpeg && four == 0x66697845;
-                Boolean isJfif = isJpeg && four == 0x4649464a;
-  */
 
   /* For Windows, make this "rb". */
   fin = fopen(fname, "r");
   if (NULL == fin) {
-    errmsg = strerror(errno);
-    printf("can't open file %s to read: %s\n", fname, errmsg);
+    (void) img_syserror(IMGERR_IO, errno, "can't open file %s to read",
+                        fname);
     return 0;
   }
 
-  /* Verify is a jpeg. */
-  fread(&soi,2,1,fin);
-  //retval = fread(&header, 1, 8, fin);
-  retval = (soi[0] == 0xff && soi[1] == 0xd8) ? 0 : -1;
-  if (!retval) {
-    printf("only read %d header bytes from %s\n", retval, fname);
-    return 0;
-  }
-
-  isjpeg = !retval;
+  /* Verify is a JPEG. */
+  retval = fread(soi, 1, 3, fin);
+  isjpeg = (3 == retval) && (0xff == soi[0]) && (0xd8 == soi[1]) &&
+    (0xff == soi[2]);
 
   retval = fclose(fin);
   if (0 != retval) {
-    errmsg = strerror(errno);
-    printf("problem closing %s: %s\n", fname, errmsg);
-    return -1;
+    return img_syserror(IMGERR_IO, errno, "problem closing %s", fname);
   }
 
   return isjpeg;
 }
 
 /***
-    JPEG_read:  Bring in a PNG image.  See the libpng manpage for what we're
-               doing.  Stored internally as an rgbimage.  Alpha channel is
-               ignored.
+    JPEG_read:  Bring in a JPEG image, allocating fresh storage for it.
     args:      fname - name of file with image, if NULL take from stdin
                img - image read (if non-NULL, will free old image)
     returns:   0 if successful
                < 0 on failure (value depends on error)
     modifies:  img
 ***/
-int JPEG_read (const char * fname , _rgbimage **img)
+int JPEG_read(const char *fname, _rgbimage **img) {
+
+  return JPEG_read_pool(fname, img, NULL);
+}
+
+/***
+    read_jpeg:  Bring in a JPEG image.  See the libjpeg documentation for
+                what we're doing.  Stored internally as an rgbimage with
+                aligned, padded rows, drawn from the pool if given.  A raw
+                decode is never scaled.  If a
+                target size is given, libjpeg scales the image down by 1/2,
+                1/4, or 1/8 while decoding (in the DCT domain, so most of
+                the work of the full-size decode is skipped), using the
+                smallest scale that is still at least the target size.
+    args:       ctx - codec context to decode with, NULL to set one up and
+                      tear it down for just this image
+                src - file or buffer to read
+                img - image read (if non-NULL, old image released to pool)
+                pool - image pool, NULL to allocate a new image
+                mincol, minrow - smallest size wanted, 0 for no scaling
+                raw - true to decode YCbCr planes directly (see
+                      decode_raw) when the file's layout allows it
+                cspace - CSP_* for a raw decode, what the planes hold
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int read_jpeg(jpgctx *ctx, const jpgsrc *src, _rgbimage **img,
+                     rgbpool *pool, int mincol, int minrow, int raw,
+                     enum clrspace cspace)
 {
-  FILE * fin;		/* source file */
-  /* This struct contains the JPEG decompression parameters and pointers to
-   * working space (which is allocated as needed by the JPEG library).
+  /* A context for just this image if the caller has none; it is torn down
+   * at the end as the decompressor used to be every time.
    */
-  struct jpeg_decompress_struct cinfo;
-  /* We use our private extension JPEG error handler.
-   * Note that this struct must live as long as the main JPEG parameter
-   * struct, to avoid dangling-pointer problems.
+  jpgctx local;
+  /* The JPEG decompression parameters and pointers to working space
+   * (which is allocated as needed by the JPEG library), in the context.
    */
-  struct my_error_mgr jerr;
+  j_decompress_ptr cinfo;
   /* More stuff */
   
-  JSAMPARRAY buffer;		/* Output row buffer */
-  int row_stride;		/* physical row width in output buffer */
 	int w;
 	int h;
-	int numChannels;
-	int x, y, xy=0;                         /* pixel coordinates/index */
-  int i;
+  int denom;			/* scale reduction, 1/denom */
   int retval;
-  char * errmsg;
-  
 
-  /* In this example we want to open the input file before doing anything else,
-   * so that the setjmp() error recovery below can assume the file is open.
-   * VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
-   * requires it in order to read binary files.
-   */
-  //  uint8_t * soi;
-  //  bool isjpeg;
-
-  //  fin = NULL;
-  //  if (NULL = fname){
-  //      fin = stdin;
-  //  }else{
-  //      /* For Windows, make this "rb". */
-  //      fin = fopen(fname,"r");
-  //      if(NULL==fin){
-  //       errmsg = strerror(errno);
-  //       printf("can't open file %s to read: %s\n", fname, errmsg);
-  //       return -1;
-  //      }
-  //  }
-  //   /* Verify is a jpeg. */
-  // fread(&soi,2,1,fin);
-  // //retval = fread(&header, 1, 8, fin);
-  // retval = (soi[0] == 0xff && soi[1] == 0xd8) ? 0 : -1;
-  // if (!retval) {
-  //   printf("only read %d header bytes from %s\n", retval, fname);
-  //   return 0;
-  // }
-  // isjpeg = !retval
-
-	// if (!isjpeg) {
-  //   printf("%s is not in PNG format\n", fname);
-  //   retval = -1;
-  //   goto cleanup;
-  // }
+  if (NULL == ctx) {
+    local.hasd = local.hasc = 0;
+    local.strip = NULL;
+    ctx = &local;
+  }
+  cinfo = &ctx->dinfo;
 
   /* Step 1: allocate and initialize JPEG decompression object */
 
-  /* We set up the normal JPEG error routines, then override error_exit. */
-  cinfo.err = jpeg_std_error(&jerr.pub);
-  jerr.pub.error_exit = my_error_exit;
+  /* We set up the normal JPEG error routines, then override error_exit.
+   * This also clears the warning count left from the last image.
+   */
+  cinfo->err = jpeg_std_error(&ctx->derr.pub);
+  ctx->derr.pub.error_exit = my_error_exit;
+  ctx->derr.pub.output_message = my_output_message;
   /* Establish the setjmp return context for my_error_exit to use. */
-  if (setjmp(jerr.setjmp_buffer)) {
+  if (setjmp(ctx->derr.setjmp_buffer)) {
     /* If we get here, the JPEG code has signaled an error.
-     * We need to clean up the JPEG object, close the input file, and return.
+     * We need to reset the JPEG object and return; our caller closes
+     * the input file.
      */
-    jpeg_destroy_decompress(&cinfo);
-    fclose(fin);
-    return 0;
+    retval = IMGERR_CODEC;
+    goto cleanup;
+  }
+  /* Now we can initialize the JPEG decompression object, if the context
+   * doesn't have one from an earlier image.
+   */
+  if (!ctx->hasd) {
+    jpeg_create_decompress(cinfo);
+    ctx->stdsrc = ctx->memsrc = NULL;
+    ctx->hasd = 1;
   }
-  /* Now we can initialize the JPEG decompression object. */
-  jpeg_create_decompress(&cinfo);
 
-  /* Step 2: specify data source (eg, a file) */
+  /* Step 2: specify data source (a file, or a buffer in memory) */
 
-  jpeg_stdio_src(&cinfo, fin);
+  if (NULL != src->fin) {
+    cinfo->src = ctx->stdsrc;
+    jpeg_stdio_src(cinfo, src->fin);
+    ctx->stdsrc = cinfo->src;
+  } else {
+    cinfo->src = ctx->memsrc;
+    jpeg_mem_src(cinfo, (unsigned char *) src->buf, src->nbuf);
+    ctx->memsrc = cinfo->src;
+  }
 
   /* Step 3: read file parameters with jpeg_read_header() */
 
-  (void) jpeg_read_header(&cinfo, TRUE);
+  (void) jpeg_read_header(cinfo, TRUE);
   /* We can ignore the return value from jpeg_read_header since
-   *   (a) suspension is not possible with the stdio data source, and
+   *   (a) suspension is not possible with the stdio or memory source, and
    *   (b) we passed TRUE to reject a tables-only JPEG file as an error.
    * See libjpeg.txt for more info.
    */
 
   /* Step 4: set parameters for decompression */
 
-  /* In this example, we don't need to change any of the defaults set by
-   * jpeg_read_header(), so we do nothing here.
+  /* Pick the largest reduction that keeps the output at least the target
+   * size.  libjpeg rounds scaled dimensions up, so we do too.
    */
+  if ((0 < mincol) || (0 < minrow)) {
+    for (denom=JPEG_MAXSCALE; 1<denom; denom/=2) {
+      if ((mincol <= (int) ((cinfo->image_width + denom - 1) / denom)) &&
+          (minrow <= (int) ((cinfo->image_height + denom - 1) / denom))) {
+        break;
+      }
+    }
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = denom;
+  }
+
+  /* Take the component planes as they are if asked and we can handle
+   * their layout; otherwise libjpeg upsamples and converts to RGB.
+   */
+  cinfo->raw_data_out = raw && raw_ok(cinfo);
 
   /* Step 5: Start decompressor */
 
-  (void) jpeg_start_decompress(&cinfo);
+  (void) jpeg_start_decompress(cinfo);
   /* We can ignore the return value since suspension is not possible
-   * with the stdio data source.
+   * with the stdio or memory source.
    */
 
   /* We may need to do some setup of our own at this point before reading
@@ -287,369 +627,551 @@ int JPEG_read (const char * fname , _rgbimage **img)
    * In this example, we need to make an output work buffer of the right size.
    */ 
   	//width of the output
-	w= cinfo.output_width;
-	h=cinfo.output_height;
-	numChannels=cinfo.num_components;
-  //outputcomponents contain numchannels*row
-  retval = alloc_rgbimage(img, w, h);
+	w= cinfo->output_width;
+	h=cinfo->output_height;
+  retval = rgbpool_acquire(pool, img, w, h);
   CLEANUPONERR;
-	/* JSAMPLEs per row in output buffer */
-  row_stride = cinfo.output_width * cinfo.output_components;
-
-	
-  /* Make a one-row-high sample array that will go away when done with image */
-  buffer = (*cinfo.mem->alloc_sarray)
-		((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
-
-  /* Step 6: while (scan lines remain to be read) */
-  /*           jpeg_read_scanlines(...); */
-
-  /* Here we use the library's state variable cinfo.output_scanline as the
-   * loop counter, so that we don't have to keep track ourselves.
-   */
-  while (cinfo.output_scanline < cinfo.output_height) {
-    /* jpeg_read_scanlines expects an array of pointers to scanlines.
-     * Here the array is only one element long, but you could ask for
-     * more than one scanline at a time if that's more convenient.
-     */
-    (void) jpeg_read_scanlines(&cinfo, buffer, 1);
-
-
-	if (1 == numChannels) {
-	  /* Note this correctly reads 1-channel greyscale, where r == g == b. */
-      
-      for (x=0; x<w; x++, xy++) {
-        (*img)->r[xy] = buffer[0][x];
-        (*img)->g[xy] = buffer[0][x];
-        (*img)->b[xy] = buffer[0][x];
-      }
-    
-  } else if ((3 == numChannels) || (4 == numChannels)) {
-    
-      for (x=0, i=0; x<w; x++, xy++, i+=numChannels) {
-        (*img)->r[xy] = buffer[0][i];
-        (*img)->g[xy] = buffer[0][i+1];
-        (*img)->b[xy] = buffer[0][i+2];
-      }
+  if (cinfo->raw_data_out) {
+    (*img)->cspace = cspace;
+    decode_raw(cinfo, *img);
   } else {
-    printf("JPEG: do not support %d channels\n", numChannels);
-    retval = -1;
-    goto cleanup;
-  }
-
-    /* Assume put_scanline_someplace wants a pointer and sample count. */
-    //put_scanline_someplace(buffer[0], row_stride);
+    retval = decode_strips(cinfo, *img);
+    CLEANUPONERR;
   }
 
   /* Step 7: Finish decompression */
 
-  (void) jpeg_finish_decompress(&cinfo);
+  (void) jpeg_finish_decompress(cinfo);
   /* We can ignore the return value since suspension is not possible
-   * with the stdio data source.
+   * with the stdio or memory source.  This leaves the object ready for
+   * the next image, keeping its permanent pool and tables.
    */
 
-  /* Step 8: Release JPEG decompression object */
-
-  /* This is an important step since it will release a good deal of memory. */
-
-
-
   retval = 0;
   
 	cleanup:
-	jpeg_destroy_decompress(&cinfo);
+  /* Step 8: Release JPEG decompression object */
 
-  /* After finish_decompress, we can close the input file.
-   * Here we postpone it until after no more JPEG errors are possible,
-   * so as to simplify the setjmp error logic above.  (Actually, I don't
-   * think that jpeg_destroy can do an error exit, but why assume anything...)
+  /* A shared context is only reset, after an error, so it can be used
+   * again.  Our own is destroyed, which releases a good deal of memory.
    */
-	 if(NULL != fin){
-		 retval = fclose(fin);
-		 if (0 != retval) {
-      errmsg = strerror(errno);
-      printf("problem closing %s: %s\n", fname, errmsg);
-      retval = -1;
-    }
-	 }
-  
-
+  if (&local == ctx) {
+    jpeg_destroy_decompress(cinfo);
+  } else if (retval < 0) {
+    jpeg_abort_decompress(cinfo);
+  }
 
   /* At this point you may want to check to see whether any corrupt-data
    * warnings occurred (test whether jerr.pub.num_warnings is nonzero).
    */
-	
- 
+
   /* And we're done! */
-  return 1;
+  return retval;
 }
+
+/***
+    read_jpeg_file:  Open a file and bring in the JPEG image it holds, as
+                     read_jpeg.  Regular files are mapped and decoded from
+                     memory; stdin and pipes go through stdio.
+    args:            fname - name of file with image, if NULL take from
+                             stdin
+                     ctx, img, pool, mincol, minrow, raw, cspace - as
+                       read_jpeg
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int read_jpeg_file(jpgctx *ctx, const char *fname, _rgbimage **img,
+                          rgbpool *pool, int mincol, int minrow, int raw,
+                          enum clrspace cspace) {
+  imginput in;				/* file to read */
+  jpgsrc src;				/* how read_jpeg sees it */
+  int retval;
+
+  retval = imginput_open(&in, fname);
+  RETONERR;
+
+  src.fin = in.fin;
+  src.buf = in.buf;
+  src.nbuf = in.nbuf;
+  retval = read_jpeg(ctx, &src, img, pool, mincol, minrow, raw, cspace);
+
+  /* Close the input file after the decompressor is done with it. */
+  if (imginput_close(&in, fname) < 0) {
+    retval = img_errcode();
+  }
+
+  return retval;
+}
+
+/***
+    JPEG_read_pool:  Bring in a JPEG image at full size, drawing it from
+                     an image pool.
+    args:            fname - name of file with image, if NULL take from stdin
+                     img - image read (if non-NULL, old image released to
+                           pool)
+                     pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int JPEG_read_pool(const char *fname, _rgbimage **img, rgbpool *pool) {
+
+  return read_jpeg_file(NULL, fname, img, pool, 0, 0, 0, CSP_RGB);
+}
+
+/***
+    JPEG_read_ctx:  Bring in a JPEG image at full size with a codec context
+                    kept from earlier images, drawing it from an image pool.
+    args:           ctx - codec context, NULL to use a fresh one
+                    fname - name of file with image, if NULL take from
+                            stdin
+                    img - image read (if non-NULL, old image released to
+                          pool)
+                    pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
+***/
+int JPEG_read_ctx(jpgctx *ctx, const char *fname, _rgbimage **img,
+                  rgbpool *pool) {
+
+  return read_jpeg_file(ctx, fname, img, pool, 0, 0, 0, CSP_RGB);
+}
+
+/***
+    JPEG_read_input:  Bring in a JPEG image at full size from an input that
+                      is already open, so a caller that has looked at the
+                      first bytes to pick the format needn't open the file
+                      again.  A stream must still be at its start.
+    args:             ctx - codec context, NULL to use a fresh one
+                      fname - name of file, for messages (unused)
+                      in - open input to read (from imginput_open)
+                      img - image read (if non-NULL, old image released to
+                            pool)
+                      pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
+***/
+int JPEG_read_input(jpgctx *ctx, const char *fname, imginput *in,
+                    _rgbimage **img, rgbpool *pool) {
+  jpgsrc src;				/* how read_jpeg sees it */
+
+  (void) fname;
+  src.fin = in->fin;
+  src.buf = in->buf;
+  src.nbuf = in->nbuf;
+  return read_jpeg(ctx, &src, img, pool, 0, 0, 0, CSP_RGB);
+}
+
+/***
+    JPEG_read_mem:  Bring in a JPEG image already in memory, with libjpeg's
+                    jpeg_mem_src, so it needn't be written out to a file.
+    args:           buf - encoded image
+                    nbuf - number of bytes in buf
+                    img - image read (if non-NULL, will free old image)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int JPEG_read_mem(const uchar *buf, size_t nbuf, _rgbimage **img) {
+  jpgsrc src;				/* buffer to read */
+
+  if ((NULL == buf) || (0 == nbuf)) {
+    return img_error(IMGERR_ARG, "no JPEG data to read");
+  }
+
+  src.fin = NULL;
+  src.buf = buf;
+  src.nbuf = nbuf;
+  return read_jpeg(NULL, &src, img, NULL, 0, 0, 0, CSP_RGB);
+}
+
+/***
+    JPEG_read_scaled:  Bring in a JPEG image reduced by 1/2, 1/4, or 1/8
+                       while decoding, for previews.  The smallest scale
+                       that is at least mincol x minrow is used; if even the
+                       full image is smaller, it is read at full size.
+    args:              fname - name of file with image, if NULL take from
+                               stdin
+                       img - image read (if non-NULL, will free old image)
+                       mincol, minrow - smallest size wanted
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int JPEG_read_scaled(const char *fname, _rgbimage **img, int mincol,
+                     int minrow) {
+
+  if ((mincol < 0) || (minrow < 0)) {
+    return img_error(IMGERR_ARG, "bad target size %d x %d", mincol, minrow);
+  }
+
+  return read_jpeg_file(NULL, fname, img, NULL, mincol, minrow, 0, CSP_RGB);
+}
+
+/***
+    JPEG_read_raw:  Bring in a JPEG image, taking the Y, Cb, and Cr planes
+                    straight from the decoder (libjpeg's raw_data_out)
+                    instead of letting it upsample, convert to RGB, and
+                    interleave for us to split again.  With CSP_RGB our
+                    own vector kernels convert to RGB; with CSP_YCC the
+                    planes keep Y, Cb, Cr.  Chroma is upsampled by
+                    replication, which is not quite the smoothing libjpeg
+                    does by default.  Files that aren't YCbCr with 1x1
+                    chroma and 1x1 to 2x2 luma sampling are decoded the
+                    usual way; img->cspace says what was stored.
+    args:           fname - name of file with image, if NULL take from
+                            stdin
+                    img - image read (if non-NULL, will free old image)
+                    cspace - CSP_* what the planes should hold
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int JPEG_read_raw(const char *fname, _rgbimage **img, enum clrspace cspace) {
+
+  if ((CSP_RGB != cspace) && (CSP_YCC != cspace)) {
+    return img_error(IMGERR_ARG, "illegal color space %d", cspace);
+  }
+
+  return read_jpeg_file(NULL, fname, img, NULL, 0, 0, 1, cspace);
+}
+
 // wrapper function to provide default value 
 int JPEG_write_default( f_args in){
     const char * fname = in.fname;
     _rgbimage *img = in.img;
     int quality = in.quality?in.quality:75;
-    clrplane plane = in.plane;
+    enum clrplane plane = in.plane;
     return JPEG_write_wrapper(fname,img,quality,plane);
 }
 
 /***
-    PNG_write:  Copy a image to disk.  See the libpng manpage for the flow
-                here.
-    args:       fname - name of file to write to, if NULL use stdout
-                img - image to save
+    write_jpeg:  Encode an image as JPEG.  See the libjpeg documentation for
+                 the flow here.  Rows are passed to the library in strips of
+                 JPEG_STRIP.  Full-color strips are interleaved from the
+                 planes with kern_int3 into one reusable buffer; a single
+                 plane is written as a greyscale JPEG straight from the
+                 image's rows.  A CSP_YCC image is passed on as YCbCr, and
+                 its CLR_GREY plane is the luma.
+    args:        ctx - codec context to encode with, NULL to set one up
+                       and tear it down for just this image
+                 dst - file or buffer to write to
+                 img - image to save
+                 quality - compression quality 1-100
+                 plane - which data to store
     returns:   0 if successful
                < 0 on failure (value depends on error)
+    modifies:  ctx, dst (buffer updated by libjpeg when done)
 ***/
-
-int JPEG_write_wrapper(const char * fname, _rgbimage *img, int quality ,enum clrplane plane)
+static int write_jpeg(jpgctx *ctx, jpgdst *dst, _rgbimage *img, int quality,
+                      enum clrplane plane)
 {
-  /* This struct contains the JPEG compression parameters and pointers to
-   * working space (which is allocated as needed by the JPEG library).
-   * It is possible to have several such structures, representing multiple
-   * compression/decompression processes, in existence at once.  We refer
-   * to any one struct (and its associated working data) as a "JPEG object".
+  /* A context for just this image if the caller has none, as in
+   * read_jpeg.
    */
-  struct jpeg_compress_struct cinfo;
-  /* This struct represents a JPEG error handler.  It is declared separately
-   * because applications often want to supply a specialized error handler
-   * (see the second half of this file for an example).  But here we just
-   * take the easy way out and use the standard error handler, which will
-   * print a message on stderr and call exit() if compression fails.
-   * Note that this struct must live as long as the main JPEG parameter
-   * struct, to avoid dangling-pointer problems.
+  jpgctx local;
+  /* The JPEG compression parameters and pointers to working space (which
+   * is allocated as needed by the JPEG library), in the context.  It has
+   * our private extension JPEG error handler, as in read_jpeg, so a
+   * failed compression returns an error instead of exiting.
    */
-  struct jpeg_error_mgr jerr;
+  j_compress_ptr cinfo;
   /* More stuff */
-  FILE * fout;		/* target file */
-  JSAMPROW row_pointer[1];	/* pointer to JSAMPLE row[s] */
-  int row_stride;		/* physical row width in image buffer */
-	int retval=-1;
-  char * errmsg;
+  JSAMPROW rows[JPEG_STRIP];	/* pointers to the rows of a strip */
+  JSAMPLE *strip;		/* interleaved strip, NULL if one plane */
+  uchar *src;			/* plane to write, NULL if RGB */
+  size_t need;			/* bytes in strip */
+  size_t xy;			/* index of row start */
+  int row_stride;		/* JSAMPLEs per row in strip */
+  int nstrip;			/* rows in current strip */
+  int y, i;
+  int retval;
+
+  if (NULL == ctx) {
+    local.hasd = local.hasc = 0;
+    local.strip = NULL;
+    local.stripsz = 0;
+    ctx = &local;
+  }
+  cinfo = &ctx->cinfo;
+  strip = NULL;
+
+  switch (plane) {
+  case CLR_RGB:
+    src = NULL;
+    break;
+  case CLR_GREY:
+  case CLR_R:
+    src = img->r;
+    break;
+  case CLR_G:
+    src = img->g;
+    break;
+  case CLR_B:
+    src = img->b;
+    break;
+  default:
+    return img_error(IMGERR_ARG, "illegal color plane %d", plane);
+  }
+
+  /* The strip buffer is kept in the context, growing for wider images. */
+  row_stride = img->ncol * 3;
+  if (NULL == src) {
+    need = (size_t) JPEG_STRIP * row_stride;
+    if (ctx->stripsz < need) {
+      free(ctx->strip);
+      ctx->stripsz = 0;
+      if (NULL == (ctx->strip = (JSAMPLE *) malloc(need))) {
+        return img_error(IMGERR_NOMEM, "can't allocate strip buffer");
+      }
+      ctx->stripsz = need;
+    }
+    strip = ctx->strip;
+  }
+
   /* Step 1: allocate and initialize JPEG compression object */
 
-  /* We have to set up the error handler first, in case the initialization
-   * step fails.  (Unlikely, but it could happen if you are out of memory.)
-   * This routine fills in the contents of struct jerr, and returns jerr's
-   * address which we place into the link field in cinfo.
+  /* We set up the normal JPEG error routines, then override error_exit. */
+  cinfo->err = jpeg_std_error(&ctx->cerr.pub);
+  ctx->cerr.pub.error_exit = my_error_exit;
+  ctx->cerr.pub.output_message = my_output_message;
+  /* Establish the setjmp return context for my_error_exit to use. */
+  if (setjmp(ctx->cerr.setjmp_buffer)) {
+    retval = IMGERR_CODEC;
+    goto cleanup;
+  }
+  /* Now we can initialize the JPEG compression object, if the context
+   * doesn't have one from an earlier image.
    */
-  cinfo.err = jpeg_std_error(&jerr);
-  /* Now we can initialize the JPEG compression object. */
-  jpeg_create_compress(&cinfo);
+  if (!ctx->hasc) {
+    jpeg_create_compress(cinfo);
+    ctx->stddst = ctx->memdst = NULL;
+    ctx->hasc = 1;
+  }
 
-  /* Step 2: specify data destination (eg, a file) */
-  /* Note: steps 2 and 3 can be done in either order. */
+  /* Step 2: specify data destination (a file, or a buffer in memory) */
 
-  /* Here we use the library-supplied code to send compressed data to a
-   * stdio stream.  You can also write your own code to do something else.
-   * VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
-   * requires it in order to write binary files.
-   */
-  if ((fout = fopen(fname, "wb")) == NULL) {
-    errmsg = strerror(errno);
-   
-    printf("can't open %s: %s\n", fname, errmsg);
-    return -1;
-		goto cleanup;
+  if (NULL != dst->fout) {
+    cinfo->dest = ctx->stddst;
+    jpeg_stdio_dest(cinfo, dst->fout);
+    ctx->stddst = cinfo->dest;
+  } else {
+    cinfo->dest = ctx->memdst;
+    my_mem_dest(cinfo, dst);
+    ctx->memdst = cinfo->dest;
   }
-  jpeg_stdio_dest(&cinfo, fout);
 
   /* Step 3: set parameters for compression */
 
-  /* First we supply a description of the input image.
-   * Four fields of the cinfo struct must be filled in:
-   */
-  cinfo.image_width = img->ncol; 	/* image width and height, in pixels */
-  cinfo.image_height = img->nrow;
-  cinfo.input_components = 3;		/* # of color components per pixel */
-  cinfo.in_color_space = JCS_RGB; 	/* colorspace of input image */
+  cinfo->image_width = img->ncol; 	/* image width and height, in pixels */
+  cinfo->image_height = img->nrow;
+  if (NULL == src) {
+    cinfo->input_components = 3;	/* # of color components per pixel */
+    /* colorspace of input image; YCbCr planes need no conversion */
+    cinfo->in_color_space = (CSP_YCC == img->cspace) ? JCS_YCbCr : JCS_RGB;
+  } else {
+    cinfo->input_components = 1;
+    cinfo->in_color_space = JCS_GRAYSCALE;
+  }
   /* Now use the library's routine to set default compression parameters.
    * (You must set at least cinfo.in_color_space before calling this,
-   * since the defaults depend on the source color space.)
+   * since the defaults depend on the source color space.)  On a context's
+   * compressor this reuses the component and table storage from before.
    */
-  jpeg_set_defaults(&cinfo);
-  /* Now you can set any non-default parameters you wish to.
-   * Here we just illustrate the use of quality (quantization table) scaling:
-   */
-  jpeg_set_quality(&cinfo, quality, TRUE /* limit to baseline-JPEG values */);
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, quality, TRUE /* limit to baseline-JPEG values */);
 
   /* Step 4: Start compressor */
 
-  /* TRUE ensures that we will write a complete interchange-JPEG file.
-   * Pass TRUE unless you are very sure of what you're doing.
-   */
-  jpeg_start_compress(&cinfo, TRUE);
+  /* TRUE ensures that we will write a complete interchange-JPEG file. */
+  jpeg_start_compress(cinfo, TRUE);
 
   /* Step 5: while (scan lines remain to be written) */
   /*           jpeg_write_scanlines(...); */
 
-  /* Here we use the library's state variable cinfo.next_scanline as the
-   * loop counter, so that we don't have to keep track ourselves.
-   * To keep things simple, we pass one scanline per call; you can pass
-   * more if you wish, though.
+  /* Each pass builds the row pointers for one strip.  For RGB the strip
+   * buffer is refilled from the planes; a single plane needs no copy since
+   * its rows are already greyscale scanlines.  The stdio destination can't
+   * suspend, so the whole strip is taken in one call.
    */
-  row_stride = cinfo.image_width * 3;	/* JSAMPLEs per row in image_buffer */
+  for (y=0; y<img->nrow; y+=nstrip) {
+    nstrip = img->nrow - y;
+    if (JPEG_STRIP < nstrip) {
+      nstrip = JPEG_STRIP;
+    }
 
-  while (cinfo.next_scanline < cinfo.image_height) {
-    /* jpeg_write_scanlines expects an array of pointers to scanlines.
-     * Here the array is only one element long, but you could pass
-     * more than one scanline at a time if that's more convenient.
-     */
-    //row_pointer[0] = & image_buffer[cinfo.next_scanline * row_stride];
-    row_pointer[0] = img->r+cinfo.next_scanline*row_stride;
-		(void) jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    xy = (size_t) y * img->stride;
+    if (NULL == src) {
+      for (i=0; i<nstrip; i++, xy+=img->stride) {
+        rows[i] = strip + ((size_t) i * row_stride);
+        kern_int3(img->r + xy, img->g + xy, img->b + xy, rows[i], img->ncol);
+      }
+    } else {
+      for (i=0; i<nstrip; i++, xy+=img->stride) {
+        rows[i] = src + xy;
+      }
+    }
+
+    (void) jpeg_write_scanlines(cinfo, rows, nstrip);
   }
-  
+
   /* Step 6: Finish compression */
 
-  cleanup:
+  jpeg_finish_compress(cinfo);
 
-	jpeg_finish_compress(&cinfo);
-	retval=0;
-  /* After finish_compress, we can close the output file. */
-  if (NULL != fout) {
-    retval = fclose(fout);
-    if (0 != retval) {
-      errmsg = strerror(errno);
-      printf("problem closing %s: %s\n", fname, errmsg);
-      retval = -1;
-    }
-  }
-	
+  retval = 0;
 
+ cleanup:
   /* Step 7: release JPEG compression object */
 
-  /* This is an important step since it will release a good deal of memory. */
-  jpeg_destroy_compress(&cinfo);
+  /* A shared context is only reset, after an error, so it can be used
+   * again.  Our own is destroyed, which releases a good deal of memory.
+   */
+  if (&local == ctx) {
+    jpeg_destroy_compress(cinfo);
+    free(local.strip);
+  } else if (retval < 0) {
+    jpeg_abort_compress(cinfo);
+  }
 
   /* And we're done! */
-	return retval;
+  return retval;
 }
 
-
-/**** rgbimage Support ****/
-
 /***
-    alloc_rgbimage:  Reserve memory for our internal storage of a color image.
-                     Pixels arrays are zeroed.  The ncol, nrow, and npix
-                     fields are filled in.
-    args:            img - structure to set up (first freed if non-NULL)
-                     ncol, nrow - size of image
+    JPEG_write_wrapper:  Copy an image to disk.
+    args:                fname - name of file to write to, if NULL use stdout
+                         img - image to save
+                         quality - compression quality 1-100
+                         plane - which data to store
     returns:   0 if successful
                < 0 on failure (value depends on error)
-    modifies:  img
 ***/
-int alloc_rgbimage(_rgbimage **img, int ncol, int nrow) {
-
-  /* The 'free if non-NULL' means we don't try to resize the image, just
-     start from scratch. */
-  free_rgbimage(img);
+int JPEG_write_wrapper(const char * fname, _rgbimage *img, int quality ,enum clrplane plane)
+{
 
-  if (NULL == (*img = (_rgbimage *) calloc(1, sizeof(_rgbimage)))) {
-    printf("can't allocate rgb image");
-    return -1;
-  }
+  return JPEG_write_ctx(NULL, fname, img, plane, quality);
+}
 
-  (*img)->ncol = ncol;
-  (*img)->nrow = nrow;
-  (*img)->npix = ncol * nrow;
+/***
+    JPEG_write_ctx:  Copy an image to disk with a codec context kept from
+                     earlier images.
+    args:            ctx - codec context, NULL to use a fresh one
+                     fname - name of file to write to, if NULL use stdout
+                     img - image to save
+                     plane - which data to store
+                     quality - compression quality 1-100, 0 for default (75)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx
+***/
+int JPEG_write_ctx(jpgctx *ctx, const char *fname, _rgbimage *img,
+                   enum clrplane plane, int quality) {
+  jpgdst dst;				/* file to write */
+  int retval;
 
-  if (NULL == ((*img)->r = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate red plane");
-    free(*img);
-    *img = NULL;
-    return -1;
+  /* VERY IMPORTANT: use "b" option to fopen() if you are on a machine that
+   * requires it in order to write binary files.
+   */
+  dst.buf = NULL;
+  dst.bufsz = dst.nbuf = 0;
+  if (NULL == fname) {
+    dst.fout = stdout;
+  } else if ((dst.fout = fopen(fname, "wb")) == NULL) {
+    return img_syserror(IMGERR_IO, errno, "can't open %s", fname);
   }
 
-  if (NULL == ((*img)->g = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate green plane");
-    free((*img)->r);
-    free(*img);
-    *img = NULL;
-    return - 1;
-  }
+  retval = write_jpeg(ctx, &dst, img, quality ? quality : 75, plane);
 
-  if (NULL == ((*img)->b = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate blue plane");
-    free((*img)->g);
-    free((*img)->r);
-    free(*img);
-    *img = NULL;
-    return - 1;
+  /* After finish_compress, we can close the output file. */
+  if (stdout != dst.fout) {
+    if (0 != fclose(dst.fout)) {
+      retval = img_syserror(IMGERR_IO, errno, "problem closing %s", fname);
+    }
   }
 
-  return 0;
+  return retval;
 }
 
 /***
-    free_rgbimage:  Release the memory stored with an image.
-    args:           img - data structure to free
-    modifies:  img (set to NULL when done)
+    JPEG_write_mem:  Encode an image as JPEG into a buffer in memory, for
+                     callers that send the bytes on rather than save them.
+                     The buffer belongs to the caller.  Passing back the
+                     buffer from an earlier call reuses it, growing it (with
+                     realloc) only if the new image doesn't fit.
+    args:            buf - buffer to write into, from malloc, or NULL to
+                           allocate one
+                     bufsz - size of buf, updated if it grows
+                     nbuf - number of bytes of JPEG data in buf
+                     img - image to save
+                     plane - which data to store
+                     quality - compression quality 1-100, 0 for default (75)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  buf, bufsz, nbuf (buf and bufsz are valid even on error)
 ***/
-void free_rgbimage(_rgbimage **img) {
+int JPEG_write_mem(uchar **buf, size_t *bufsz, size_t *nbuf, _rgbimage *img,
+                   enum clrplane plane, int quality) {
+  jpgdst dst;				/* buffer to write */
+  int retval;
 
-  if (*img) {
-    if ((*img)->r) {
-      free((*img)->r);
-    }
-    if ((*img)->g) {
-      free((*img)->g);
-    }
-    if ((*img)->b) {
-      free((*img)->b);
-    }
-    free(*img);
-    *img = NULL;
-  }
+  dst.fout = NULL;
+  dst.buf = *buf;
+  dst.bufsz = (NULL == *buf) ? 0 : *bufsz;
+  dst.nbuf = 0;
+
+  retval = write_jpeg(NULL, &dst, img, quality ? quality : 75, plane);
+
+  /* The buffer may have been made or grown before an error. */
+  *buf = dst.buf;
+  *bufsz = dst.bufsz;
+  *nbuf = (retval < 0) ? 0 : dst.nbuf;
+
+  return retval;
 }
 
 /***
-    read_rgb:  Get a pixel from the image.
-    args:      img - image
-               x, y - coordinates of pixel to read
-               r, g, b - color planes (all equal if greyscale image)
+    JPEG_ctx_create:  Make an empty codec context.  The libjpeg objects are
+                      created the first time the context reads or writes,
+                      and then kept.  A context holds libjpeg state and may
+                      only be used by one thread at a time; give each
+                      thread its own.
+    args:             ctx - context to create
     returns:   0 if successful
                < 0 on failure (value depends on error)
-    modifies:  r, g, b
+    modifies:  ctx
 ***/
-int read_rgb(_rgbimage *img, int x, int y, uchar *r, uchar *g, uchar *b) {
-  int xy;                               /* pixel index */
-  
-  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
-    printf("pixel %d,%4d is OOB (image size %d x %4d)\n", x,y, 
-           img->ncol,img->nrow);
-    return -1;
-  }
+int JPEG_ctx_create(jpgctx **ctx) {
 
-  xy = (y * img->ncol) + x;
-  *r = img->r[xy];
-  *g = img->g[xy];
-  *b = img->b[xy];
+  if (NULL == (*ctx = (jpgctx *) calloc(1, sizeof(**ctx)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate JPEG context");
+  }
 
   return 0;
 }
 
 /***
-    write_rgb:  Change a pixel in the image.
-    args:       img - image
-                x, y - coordinates of pixel to write to
-                r, g, b - color planes
-    returns:   0 if successful
-               < 0 on failure (value depends on error)
-    modifies:  img
+    JPEG_ctx_destroy:  Release a codec context and the libjpeg objects and
+                       buffers it has kept.
+    args:              ctx - context to destroy
+    modifies:  ctx (set to NULL when done)
 ***/
-int write_rgb(_rgbimage *img, int x, int y, uchar r, uchar g, uchar b) {
-  int xy;                               /* pixel index */
-  
-  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
-    printf("pixel %d,%4d is OOB (image size %d x %4d)\n", x,y, 
-           img->ncol,img->nrow);
-    return -1;
-  }
+void JPEG_ctx_destroy(jpgctx **ctx) {
 
-  xy = (y * img->ncol) + x;
-  img->r[xy] = r;
-  img->g[xy] = g;
-  img->b[xy] = b;
+  if (NULL == *ctx) {
+    return;
+  }
 
-  return 0;
+  if ((*ctx)->hasd) {
+    jpeg_destroy_decompress(&(*ctx)->dinfo);
+  }
+  if ((*ctx)->hasc) {
+    jpeg_destroy_compress(&(*ctx)->cinfo);
+  }
+  free((*ctx)->strip);
+  free(*ctx);
+  *ctx = NULL;
 }
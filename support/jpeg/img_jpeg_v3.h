@@ -1,58 +1,57 @@
 
 /*****
-      img_png_v3.h -
-      Public declarations for the PNG file support.  Also includes support
+      img_jpeg_v3.h -
+      Public declarations for the JPEG file support.  Also includes support
       for our in-memory image data structure.
 
       This version allows saving just a single plane from the image.
 
       Public Interface:
-        PNG_isa - test if file is in PNG format
-        PNG_read - read an image from disk
-        PNG_write - write an image to disk
-        alloc_rgbimage - allocate our internal image storage
-        free_rgbimage - release image memory
-        read_rgb - get a pixel in the image
-        write_rgb - set a pixel
+        JPEG_isa - test if file is in JPEG format
+        JPEG_read - read an image from disk
+        JPEG_read_pool - read an image into a block from an image pool
+        JPEG_read_input - read an image from an already open input
+        JPEG_read_ctx - read an image with a kept codec context
+        JPEG_read_mem - read an image from a buffer in memory
+        JPEG_read_scaled - read an image reduced in size for previews
+        JPEG_read_raw - read an image's YCbCr planes without libjpeg's
+                        color conversion
+        JPEG_write - write an image to disk
+        JPEG_write_ctx - write an image with a kept codec context
+        JPEG_write_mem - write an image to a buffer in memory
+        JPEG_ctx_create - make a codec context to keep between images
+        JPEG_ctx_destroy - release a codec context
+      The image data structure and its support routines (alloc_rgbimage,
+      free_rgbimage, read_rgb, write_rgb) are declared in img_rgb.h.
 
       Required Libraries:
-        libpng
+        libjpeg
 
       c @parthsarthiprasad
 *****/
 
-#ifndef _IMGPNG
-#define _IMGPNG 1
+#ifndef _IMGJPEG
+#define _IMGJPEG 1
 
 
-/*** Data Types ***/
-
-typedef unsigned char uchar;
+#include "img_rgb.h"
+#include "img_rgbpool.h"
+#include "img_input.h"
 
 
 /*** Data Structures ***/
 
-/* a color image with RGB planes stored separately */
-typedef struct __rgbimage {
-  int ncol;                             /* width (number columns) of image */
-  int nrow;                             /* height (number rows) of image */
-  int npix;                             /* number pixels = w * h */
-  uchar *r;                             /* red plane */
-  uchar *g;                             /* green plane */
-  uchar *b;                             /* blue plane */
-} _rgbimage, *rgbimage;
-
-
-/*** Constants / Enumerations ***/
+/* arguments to JPEG_write, so quality can be left off and default */
+typedef struct {
+  const char *fname;                    /* file to write to */
+  _rgbimage *img;                       /* image to write */
+  enum clrplane plane;                  /* CLR_* which plane to write */
+  int quality;                          /* 0-100, 0 to use default (75) */
+} f_args;
 
-/*
-  CLR_GREY: save an 8-bit PNG image, assumes r, g, and b planes have same value
-  CLR_RGB:  save a full-color PNG image
-  CLR_[RGB]: save an 8-bit PNG image using one of the planes
-*/
-enum clrplane {
-  CLR_GREY = 0x10, CLR_RGB = 0x01, CLR_R = 0x12, CLR_G = 0x14, CLR_B = 0x18
-};
+/* libjpeg's compressor and decompressor and our buffers, kept between
+   images (private to img_jpeg_v3.c); one per thread */
+typedef struct __jpgctx jpgctx;
 
 
 /*** External Functions ***/
@@ -70,40 +69,130 @@ extern int JPEG_isa(const char *);
 */
 extern int JPEG_read(const char *, _rgbimage **);
 
+/* read a JPEG image into an image from a pool, converting it to an rgbimage
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as JPEG_read)
+   returns < 0 on error
+   modifies img
+*/
+extern int JPEG_read_pool(const char *, _rgbimage **, rgbpool *);
+
+/* read a JPEG image with a codec context kept from earlier images, into an
+   image from a pool
+     ctx - context to decode with (if NULL, use a fresh one as JPEG_read)
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as JPEG_read)
+   returns < 0 on error
+   modifies ctx, img
+*/
+extern int JPEG_read_ctx(jpgctx *, const char *, _rgbimage **, rgbpool *);
+
+/* read a JPEG image from an input already opened with imginput_open (a
+   stream must not have been read from yet)
+     ctx - context to decode with (if NULL, use a fresh one)
+     fname - name of file, for messages
+     in - input to read
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as JPEG_read)
+   returns < 0 on error
+   modifies img
+*/
+extern int JPEG_read_input(jpgctx *, const char *, imginput *, _rgbimage **,
+                           rgbpool *);
+
+/* read a JPEG image held in memory, converting it to an rgbimage
+     buf - encoded image
+     nbuf - number of bytes in buf
+     img - pointer to image to create and read (frees old if non-NULL)
+   returns < 0 on error
+   modifies img
+*/
+extern int JPEG_read_mem(const uchar *, size_t, _rgbimage **);
+
+/* read a JPEG image scaled down by 1/2, 1/4, or 1/8 while decoding, using
+   the smallest scale that is at least the target size (full size if the
+   image is already smaller)
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (frees old if non-NULL)
+     mincol, minrow - smallest size wanted
+   returns < 0 on error
+   modifies img
+*/
+extern int JPEG_read_scaled(const char *, _rgbimage **, int, int);
+
+/* read a JPEG image's YCbCr planes directly, converting them to RGB with
+   our own kernels or keeping them as Y, Cb, Cr; files whose layout this
+   doesn't handle are read as JPEG_read does (check img->cspace)
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (frees old if non-NULL)
+     cspace - CSP_RGB to convert, CSP_YCC to keep the planes
+   returns < 0 on error
+   modifies img
+*/
+extern int JPEG_read_raw(const char *, _rgbimage **, enum clrspace);
+
 /* write an rgbimage to disk in JPEG format
      fname - name of file to write to (if NULL, use stdout)
      img - image to write
+     clrplane - CLR_* which plane to write
+     quality - (optional) compression quality 1-100, default 75
    returns < 0 on error
 */
-extern int JPEG_write(const char *, _rgbimage * , int ,enum clrplane);
+#define JPEG_write(...) JPEG_write_default((f_args){__VA_ARGS__})
+extern int JPEG_write_default(f_args);
 
-/* allocate an image in our format, initializing contents to 0
-     img - image to create (frees old if non-NULL)
-     ncol, nrow - size of image
+/* write an rgbimage to disk in JPEG format, all arguments explicit
+     fname - name of file to write to
+     img - image to write
+     quality - compression quality 1-100
+     clrplane - CLR_* which plane to write
    returns < 0 on error
-   modifies img
 */
-extern int alloc_rgbimage(_rgbimage **, int, int);
+extern int JPEG_write_wrapper(const char *, _rgbimage *, int, enum clrplane);
 
-/* release memory for an image
-     img - image to free
-   modifies img (set to NULL when done)
+/* write an rgbimage to disk in JPEG format with a codec context kept from
+   earlier images
+     ctx - context to encode with (if NULL, use a fresh one)
+     fname - name of file to write to (if NULL, use stdout)
+     img - image to write
+     clrplane - CLR_* which plane to write
+     quality - compression quality 1-100, 0 for default (75)
+   returns < 0 on error
+   modifies ctx
 */
-extern void free_rgbimage(rgbimage **);
+extern int JPEG_write_ctx(jpgctx *, const char *, _rgbimage *, enum clrplane,
+                          int);
+
+/* encode an rgbimage in JPEG format into a buffer in memory, which the
+   caller owns and frees; pass back the same buffer to reuse it
+     buf - buffer from malloc, or NULL to allocate one (grown with realloc
+           if too small)
+     bufsz - size of buf (updated)
+     nbuf - bytes of JPEG data written to buf
+     img - image to write
+     clrplane - CLR_* which plane to write
+     quality - compression quality 1-100, 0 for default (75)
+   returns < 0 on error
+   modifies buf, bufsz, nbuf (buf and bufsz are valid even on error)
+*/
+extern int JPEG_write_mem(uchar **, size_t *, size_t *, _rgbimage *,
+                          enum clrplane, int);
 
-/* get pixel's RGB values
-     img - image
-     x, y - pixel coordinates
-     r, g, b - color planes (all modified)
+/* make an empty codec context, which keeps libjpeg's objects, memory, and
+   tables between images; use one per thread
+     ctx - context to create
+   returns < 0 on error
+   modifies ctx
 */
-extern int read_rgb(rgbimage *, int, int, uchar *, uchar *, uchar *);
+extern int JPEG_ctx_create(jpgctx **);
 
-/* change a pixel's RGB values
-     img - image
-     x, y - pixel coordinates
-     r, g, b - color values
+/* release a codec context
+     ctx - context to destroy
+   modifies ctx (set to NULL when done)
 */
-extern int write_rgb(_rgbimage *, int, int, uchar, uchar, uchar);
+extern void JPEG_ctx_destroy(jpgctx **);
 
 
 #endif   /* _IMGJPEG */
@@ -29,6 +29,7 @@ extern class rgbimage {
   var ncol : c_int;                     /* width (columns) of image */
   var nrow : c_int;                     /* height (rows) of image */
   var npix : c_int;                     /* number pixels = w * h */
+  var stride : c_int;                   /* bytes between rows, >= ncol */
   var r : c_ptr(c_uchar);               /* red plane */
   var g : c_ptr(c_uchar);               /* green plane */
   var b : c_ptr(c_uchar);               /* blue plane */
@@ -48,16 +49,26 @@ var retval : c_int;                     /* return value with error code */
 
 /* External img_jpeg linkage. */
 extern proc JPEG_read(fname : c_string, ref img : rgbimage) : c_int;
+extern proc JPEG_read_mem(buf : c_ptr(c_uchar), nbuf : size_t,
+                           ref img : rgbimage) : c_int;
+extern proc JPEG_read_scaled(fname : c_string, ref img : rgbimage,
+                             mincol : c_int, minrow : c_int) : c_int;
 extern proc JPEG_write(fname : c_string, img : rgbimage, plane : c_int) : c_int;
+extern proc JPEG_write_mem(ref buf : c_ptr(c_uchar), ref bufsz : size_t,
+                           ref nbuf : size_t, img : rgbimage,
+                           plane : c_int, quality : c_int) : c_int;
 extern proc free_rgbimage(ref img : rgbimage) : void;
-extern proc JPEG_isa(fname : c_string) : c_int;
 /* The rest of the interface we don't use now. */
 /*
+extern proc JPEG_isa(fname : c_string) : c_int;
 extern proc alloc_rgbimage(ref img : rgbimage, 
                            ncol : c_int, nrow : c_int) : c_int;
 extern proc read_rgb(img : rgbimage, x, y : c_int, 
                      ref r, ref g, ref b : c_uchar) : c_int;
 extern proc write_rgb(img : rgbimage, x, y : c_int, r, g, b : c_uchar) : c_int;
+/* Call with 1 before decoding inside a forall, so the library's kernels
+   don't start threads of their own on cores the forall already uses. */
+extern proc thrpool_setshared(nthread : c_int) : c_int;
 */
 
 
@@ -107,11 +118,11 @@ if (y < 0) then
   usage("missing --y or value < 0");
 if ("" == inname) then
   usage("missing --inname");
-if (!JPEG_isa(inname.c_str())) then
-  usage("input file not a JPEG picture");
 if ("" == outname) then
   usage("missing --outname");
 
+/* The reader checks the signature itself, so there's no need to open the
+   file first with JPEG_isa. */
 retval = JPEG_read(inname.c_str(), rgb);
 end_onerr(retval, rgb);
 
@@ -124,8 +135,9 @@ if (rgb.nrow <= y) {
   usage("--y (0-based) >= image height");
 }
 
-/* Now we can access the fields directly. */
-xy = (y * rgb.ncol) + x;
+/* Now we can access the fields directly.  Rows may be padded, so step
+   by the stride, not the width. */
+xy = (y * rgb.stride) + x;
 writef("\nRead %4i x %4i JPEG image\n", rgb.ncol, rgb.nrow);
 writef("At %4i,%4i      R %3u  G %3u  B %3u\n\n", x,y, 
        rgb.r(xy), rgb.g(xy), rgb.b(xy));
@@ -0,0 +1,211 @@
+
+/*****
+      test_jpeg_mem.c -
+      Test program for JPEG_write_mem's handling of the caller's buffer.
+      Encodes images that libjpeg refuses (too wide) and that we refuse
+      (a bad plane), into no buffer and into one too small for the
+      image, checking that each call fails and leaves buf and bufsz
+      usable.  The same buffer is then reused for images that encode,
+      which are read back to check their size.  Prints each case and
+      exits with 1 if any failed.  Build with -fsanitize=address to also
+      check that no buffer is leaked.
+
+      Call:
+        test_jpeg_mem
+
+      @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "img_jpeg_v3.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+/***
+    TOOWIDE:  Width of an image past libjpeg's limit (JPEG_MAX_DIMENSION,
+              65500), so encoding it fails.
+***/
+#define TOOWIDE      70000
+
+
+/**** Program ****/
+
+/***
+    make_image:  Allocate an image and fill it with a pattern.
+    args:        img - image to make
+                 ncol, nrow - size of image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int make_image(_rgbimage **img, int ncol, int nrow) {
+  size_t xy;                            /* index of pixel */
+  int x, y;                             /* pixel coordinates */
+  int retval;
+
+  retval = alloc_rgbimage(img, ncol, nrow);
+  if (retval < 0) {
+    return retval;
+  }
+
+  for (y=0; y<nrow; y++) {
+    xy = (size_t) y * (*img)->stride;
+    for (x=0; x<ncol; x++, xy++) {
+      (*img)->r[xy] = (uchar) (x + y);
+      (*img)->g[xy] = (uchar) (x ^ y);
+      (*img)->b[xy] = (uchar) (3 * y);
+    }
+  }
+
+  return 0;
+}
+
+/***
+    expect_fail:  Encode an image that can't be, checking the call fails
+                  without losing the buffer.
+    args:         what - description of the case
+                  buf - buffer to encode into, may be NULL
+                  bufsz - size of buf
+                  img - image to encode
+                  plane - which data to store
+    returns:   0 if the case passed, 1 if not
+    modifies:  buf, bufsz
+***/
+static int expect_fail(const char *what, uchar **buf, size_t *bufsz,
+                       _rgbimage *img, enum clrplane plane) {
+  size_t nbuf;                          /* bytes written */
+  int retval;
+
+  nbuf = 1;
+  retval = JPEG_write_mem(buf, bufsz, &nbuf, img, plane, 0);
+  if (0 <= retval) {
+    printf("FAIL  %s:  encoded %zu bytes\n", what, nbuf);
+    return 1;
+  }
+  if ((0 != nbuf) || ((NULL == *buf) != (0 == *bufsz))) {
+    printf("FAIL  %s:  nbuf %zu, buf %s, bufsz %zu after error\n", what,
+           nbuf, (NULL == *buf) ? "NULL" : "set", *bufsz);
+    return 1;
+  }
+
+  printf("ok    %s:  %s\n", what, img_errmsg());
+  return 0;
+}
+
+/***
+    expect_write:  Encode an image, checking it fits in the buffer and
+                   reads back at the same size.
+    args:          what - description of the case
+                   buf - buffer to encode into, may be NULL
+                   bufsz - size of buf
+                   img - image to encode
+    returns:   0 if the case passed, 1 if not
+    modifies:  buf, bufsz
+***/
+static int expect_write(const char *what, uchar **buf, size_t *bufsz,
+                        _rgbimage *img) {
+  _rgbimage *back;                      /* image read from buf */
+  size_t nbuf;                          /* bytes written */
+  int failed;                           /* true if check failed */
+  int retval;
+
+  back = NULL;
+  failed = 1;
+
+  retval = JPEG_write_mem(buf, bufsz, &nbuf, img, CLR_RGB, 0);
+  if (retval < 0) {
+    printf("FAIL  %s:  %s\n", what, img_errmsg());
+    return 1;
+  }
+  if ((NULL == *buf) || (0 == nbuf) || (*bufsz < nbuf)) {
+    printf("FAIL  %s:  nbuf %zu, bufsz %zu\n", what, nbuf, *bufsz);
+    return 1;
+  }
+
+  retval = JPEG_read_mem(*buf, nbuf, &back);
+  if (retval < 0) {
+    printf("FAIL  %s:  can't read back, %s\n", what, img_errmsg());
+    goto cleanup;
+  }
+  if ((back->ncol != img->ncol) || (back->nrow != img->nrow)) {
+    printf("FAIL  %s:  read back %d x %d, wrote %d x %d\n", what,
+           back->ncol, back->nrow, img->ncol, img->nrow);
+    goto cleanup;
+  }
+
+  printf("ok    %s:  %zu bytes in a buffer of %zu\n", what, nbuf, *bufsz);
+  failed = 0;
+
+ cleanup:
+  free_rgbimage(&back);
+
+  return failed;
+}
+
+
+int main(void) {
+  _rgbimage *wide;                      /* image libjpeg won't encode */
+  _rgbimage *img;                       /* image that encodes */
+  uchar *buf;                           /* encoded image */
+  size_t bufsz;                         /* size of buf */
+  int nfail;                            /* cases that failed */
+  int retval;
+
+  wide = img = NULL;
+  buf = NULL;
+  bufsz = 0;
+  nfail = 0;
+
+  /* Errors are expected; print them with the cases instead. */
+  img_setlog(NULL, NULL);
+
+  retval = make_image(&wide, TOOWIDE, 1);
+  CLEANUPONERR;
+
+  retval = make_image(&img, 256, 256);
+  CLEANUPONERR;
+
+  nfail += expect_fail("too wide, no buffer", &buf, &bufsz, wide, CLR_GREY);
+  nfail += expect_write("reuse after error", &buf, &bufsz, img);
+  nfail += expect_fail("too wide, buffer", &buf, &bufsz, wide, CLR_RGB);
+  nfail += expect_fail("bad plane", &buf, &bufsz, img, CLR_RGBA);
+
+  /* A buffer too small for the image is grown, and one the caller made
+     must also survive an error. */
+  free(buf);
+  bufsz = 64;
+  if (NULL == (buf = (uchar *) malloc(bufsz))) {
+    retval = IMGERR_NOMEM;
+    goto cleanup;
+  }
+  nfail += expect_fail("too wide, small buffer", &buf, &bufsz, wide,
+                       CLR_GREY);
+  nfail += expect_write("small buffer grown", &buf, &bufsz, img);
+
+  printf("\n%d case%s failed\n", nfail, (1 == nfail) ? "" : "s");
+  retval = (0 == nfail) ? 0 : 1;
+
+ cleanup:
+  if (retval < 0) {
+    printf("test_jpeg_mem: %s\n", img_errmsg());
+    retval = 1;
+  }
+  free(buf);
+  free_rgbimage(&img);
+  free_rgbimage(&wide);
+
+  return retval;
+}
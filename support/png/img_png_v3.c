@@ -6,14 +6,35 @@
 
       This version allows saving just a single plane from the image.
 
+      If asked, a large image is written in strips on the shared pool, each
+      filtered and deflated on its own and stored as its own IDAT chunk.
+      The strips end in sync flushes and are primed with the rows above
+      them, so together they form the one zlib stream any decoder expects;
+      their Adler-32 checksums are combined for its trailer.
+
+      If asked, a large image read from memory is decoded in two stages at
+      once: a thread inflates batches of rows into a ring while the reader
+      unfilters the batches before them and splits them into planes.
+
       Public Interface:
         PNG_isa - test if file is in PNG format
         PNG_read - read an image from disk
+        PNG_read_pool - read an image into a block from an image pool
+        PNG_read_input - read an image from an already open input
+        PNG_read_ctx - read an image with a kept codec context
+        PNG_read_mem - read an image from a buffer in memory
         PNG_write - write an image to disk
-        alloc_rgbimage - allocate an image in our format
-        free_rgbimage - release an image
-        read_rgb - retrieve the value of a pixel
-        write_rgb - set the value of a pixel
+        PNG_write_ctx - write an image with a kept codec context
+        PNG_write_mem - write an image to a buffer in memory
+        PNG_write_opts - write an image to disk with compression options
+        PNG_write_mem_opts - write an image to memory with compression
+                             options
+        PNG_opts_preset - fill in compression options from a preset
+        PNG_setpipeline - decode large images on two threads or one
+        PNG_setparwrite - write large images on the shared pool or not
+        PNG_ctx_create - make a codec context to keep between images
+        PNG_ctx_destroy - release a codec context
+      The rgbimage support routines are in img_rgb.c.
 
       c 2015-2018 Primordial Machine Vision Systems, Inc.
 *****/
@@ -21,30 +42,1420 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <png.h>
+#include <zlib.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "img_png_v3.h"
+#include "img_input.h"
+#include "img_kern.h"
+#include "img_err.h"
+#include "img_thread.h"
+
+
+/**** Macros ****/
+
+/***
+    RETONERR:  If the previous function call returned an error code (< 0),
+               exit the function, returning the code.  Assumes the code has
+               been assigned to a local variable 'retval'.
+***/
+#define RETONERR     { if (retval < 0) { return retval; }}
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+/***
+    PNG_MEMCHUNK:  Starting size of a buffer PNG_write_mem allocates.
+***/
+#define PNG_MEMCHUNK   65536
+
+/***
+    PNG_CTXBLK:  Most blocks a codec context keeps after libpng and zlib free
+                 them.  A decode or encode makes a dozen or so allocations,
+                 the same from one image to the next.
+***/
+#define PNG_CTXBLK     32
+
+/***
+    PNG_BLKHDR:  Bytes ahead of each block from ctx_malloc, holding its size.
+                 A multiple of the malloc alignment so the block keeps it.
+***/
+#define PNG_BLKHDR     16
+
+/***
+    PNG_PARBYTES:  Fewest bytes of decoded rows worth deinterleaving on
+                   another thread.  Smaller pieces cost more to hand over
+                   than they take to do.
+***/
+#define PNG_PARBYTES   (256 * 1024)
+
+/***
+    PNG_PARSTRIP:  Bytes of filtered rows deflated as one strip by the
+                   parallel encoder.  Each strip ends in a sync flush and
+                   starts deflate's match search over, costing a little
+                   compression, so strips are kept large.
+***/
+#define PNG_PARSTRIP   (1024 * 1024)
+
+/***
+    PNG_PARWAVE:  Strips per thread deflated before any are written.  Only
+                  one wave of strips is held in memory at a time.
+***/
+#define PNG_PARWAVE    4
+
+/***
+    PNG_WINDOW:  Size of deflate's window, how far back before a strip its
+                 matches may reach.
+***/
+#define PNG_WINDOW     32768
+
+/***
+    PNG_PIPEBYTES:  Fewest bytes of filtered rows worth splitting between
+                    an inflating thread and an unfiltering one.  Starting
+                    the thread costs more than a small image takes.
+***/
+#define PNG_PIPEBYTES  (1024 * 1024)
+
+/***
+    PNG_PIPEBATCH:  Bytes of filtered rows passed from the inflater to the
+                    unfilterer at a time, so that each handoff is worth its
+                    lock and the batch stays in cache between the two.
+***/
+#define PNG_PIPEBATCH  (64 * 1024)
+
+/***
+    PNG_PIPESLOTS:  Batches the inflater may run ahead of the unfilterer.
+***/
+#define PNG_PIPESLOTS  8
+
+
+
+/**** Data Structures ****/
+
+/* where read_png gets its bytes: an open file, or a buffer in memory */
+typedef struct {
+  FILE *fin;                            /* file to read, NULL to use buf */
+  const uchar *buf;                     /* encoded image */
+  size_t nbuf;                          /* bytes in buf */
+  size_t pos;                           /* next byte of buf to read */
+} pngsrc;
+
+/* where write_png puts its bytes: an open file, or a buffer in memory */
+typedef struct {
+  FILE *fout;                           /* file to write, NULL to use buf */
+  uchar *buf;                           /* encoded image */
+  size_t bufsz;                         /* size of buf */
+  size_t nbuf;                          /* bytes of buf used */
+} pngdst;
+
+/* an interlaced image's rows, for deint_rows */
+typedef struct {
+  _rgbimage *img;                       /* image to fill */
+  png_bytep *rows;                      /* decoded rows */
+  int nchan;                            /* channels per pixel */
+} deintarg;
+
+/* a decode split between an inflating thread and the caller, which
+   unfilters; batches of filtered rows pass through a ring of slots */
+typedef struct {
+  const uchar *buf;                     /* encoded image */
+  size_t nbuf;                          /* bytes in buf */
+  size_t pos;                           /* first chunk after IHDR */
+  size_t flen;                          /* bytes in a filtered row */
+  int h;                                /* rows in image */
+  int batch;                            /* rows in a slot */
+  int nbatch;                           /* batches in image */
+  uchar *ring;                          /* PNG_PIPESLOTS slots */
+  pthread_t inflater;                   /* thread inflating */
+  pthread_mutex_t lock;                 /* guards everything below */
+  pthread_cond_t change;                /* slot filled or drained, or quit */
+  int filled;                           /* batches inflated */
+  int drained;                          /* batches unfiltered */
+  int quit;                             /* true to stop the inflater */
+  int err;                              /* < 0 if inflating failed */
+  const char *why;                      /* what went wrong */
+} pngpipe;
+
+/* one strip of rows deflated by the parallel encoder.  The slots of a
+   wave are kept in the codec context, so the buffers and deflate state
+   are reused by each wave and each image after. */
+typedef struct {
+  uchar *buf;                           /* deflated rows */
+  size_t bufsz;                         /* size of buf */
+  size_t nbuf;                          /* bytes of buf used */
+  uLong adler;                          /* Adler-32 of the filtered rows */
+  size_t nraw;                          /* bytes of filtered rows */
+  int err;                              /* < 0 if the strip failed */
+  void *filt;                           /* filtered rows, with scratch */
+  size_t filtsz;                        /* bytes in filt */
+  z_stream z;                           /* deflate state */
+  int zlevel;                           /* level z was made for */
+  int zstrat;                           /* PNGZ_* strategy of z */
+  int zinit;                            /* true if z has been made */
+} pngstrip;
+
+/* an image being written in strips, for enc_strips */
+typedef struct {
+  _rgbimage *img;                       /* image to save */
+  const uchar *src;                     /* plane to write, NULL if RGB */
+  int nchan;                            /* channels per pixel */
+  size_t rowbytes;                      /* bytes in an interleaved row */
+  int rowsper;                          /* rows in a strip */
+  int nstrip;                           /* strips in the image */
+  int first;                            /* first strip of this wave */
+  pngstrip *strip;                      /* the wave's strips */
+  const pngopts *opts;                  /* how to compress */
+} parenc;
+
+/* codec state kept between images.  libpng can't reset its structures for
+   another image, so they are still made and destroyed each time, but
+   through ctx_malloc/ctx_free, which keep the blocks libpng and zlib free
+   (the structures, the inflate/deflate state and window, libpng's row
+   buffers) and hand them back on the next image.  Our own row buffers are
+   kept too, as are the parallel writer's strip slots. */
+struct __pngctx {
+  void *blk[PNG_CTXBLK];                /* freed blocks, headers included */
+  int nblk;                             /* blocks in blk */
+  void *row;                            /* decoded rows, or row to write */
+  size_t rowsz;                         /* bytes in row */
+  void *rows;                           /* pointers into row, interlaced */
+  size_t rowssz;                        /* bytes in rows */
+  pngstrip *strip;                      /* parallel writer's wave slots */
+  int nstrip;                           /* slots in strip */
+};
+
+
+
+/**** Local Variables ****/
+
+/* true if large images in memory are decoded with an inflating thread */
+static atomic_int pipeline = 0;
+
+/* true if large images are deflated in strips on the shared pool */
+static atomic_int parwrite = 0;
+
+/* zlib strategy for each PNGZ_* */
+static const int zstrategy[] = {
+  Z_DEFAULT_STRATEGY, Z_FILTERED, Z_RLE, Z_HUFFMAN_ONLY
+};
+
+/* what PNG_write and friends use without options, matching libpng's own
+   defaults for 8-bit images */
+static const pngopts defopts = { Z_DEFAULT_COMPRESSION, PNGZ_FILTERED,
+                                 PNGF_ALL };
+
+
+
+/**** Local Functions ****/
+
+/***
+    read_mem:  libpng read function for a PNG in memory, copying the next
+               bytes of the buffer.  Running off the end is a libpng error,
+               which doesn't return.
+    args:      ptr - PNG being read, with the pngsrc as its I/O pointer
+               data - where to put the bytes
+               len - number of bytes wanted
+    modifies:  data
+***/
+static void read_mem(png_structp ptr, png_bytep data, png_size_t len) {
+  pngsrc *src;                          /* buffer being read */
+
+  src = (pngsrc *) png_get_io_ptr(ptr);
+  if ((src->nbuf - src->pos) < len) {
+    png_error(ptr, "read past end of PNG data");
+  }
+
+  memcpy(data, src->buf + src->pos, len);
+  src->pos += len;
+}
+
+/***
+    mem_put:  Append bytes to a PNG going to memory, doubling the buffer
+              when full.
+    args:     dst - buffer being written
+              data - bytes to add
+              len - number of bytes
+    returns:   0 if successful
+               < 0 if the buffer can't grow
+    modifies:  dst
+***/
+static int mem_put(pngdst *dst, const uchar *data, size_t len) {
+  uchar *newbuf;                        /* buffer after growing */
+  size_t newsz;                         /* size of newbuf */
+
+  if ((dst->bufsz - dst->nbuf) < len) {
+    newsz = (0 == dst->bufsz) ? PNG_MEMCHUNK : dst->bufsz;
+    while ((newsz - dst->nbuf) < len) {
+      newsz *= 2;
+    }
+    if (NULL == (newbuf = (uchar *) realloc(dst->buf, newsz))) {
+      return IMGERR_NOMEM;
+    }
+    dst->buf = newbuf;
+    dst->bufsz = newsz;
+  }
+
+  memcpy(dst->buf + dst->nbuf, data, len);
+  dst->nbuf += len;
+
+  return 0;
+}
+
+/***
+    write_mem:  libpng write function for a PNG going to memory.  Running
+                out of memory is a libpng error, which doesn't return.
+    args:       ptr - PNG being written, with the pngdst as its I/O pointer
+                data - bytes to add
+                len - number of bytes
+    modifies:  I/O pointer's buffer
+***/
+static void write_mem(png_structp ptr, png_bytep data, png_size_t len) {
+
+  if (mem_put((pngdst *) png_get_io_ptr(ptr), data, len) < 0) {
+    png_error(ptr, "can't grow PNG output buffer");
+  }
+}
+
+/***
+    flush_mem:  libpng flush function for a PNG going to memory, which has
+                nothing to do.
+    args:       ptr - PNG being written
+***/
+static void flush_mem(png_structp ptr) {
+
+  (void) ptr;
+}
+
+/***
+    png_errfn:  libpng error function.  Records the message as this
+                thread's last error (instead of libpng's default write to
+                stderr) and jumps back to the setjmp in read_png or
+                write_png.
+    args:       ptr - PNG being read or written
+                msg - libpng's message
+***/
+static void png_errfn(png_structp ptr, png_const_charp msg) {
+
+  (void) img_error(IMGERR_CODEC, "PNG: %s", msg);
+  png_longjmp(ptr, 1);
+}
+
+/***
+    png_warnfn:  libpng warning function, passing the message to our log.
+    args:        ptr - PNG being read or written
+                 msg - libpng's message
+***/
+static void png_warnfn(png_structp ptr, png_const_charp msg) {
+
+  (void) ptr;
+  img_warning("PNG: %s", msg);
+}
+
+/***
+    ctx_malloc:  libpng allocator for a codec context.  Reuses the smallest
+                 kept block that fits and isn't more than twice the size
+                 asked for, else allocates a new block with a header giving
+                 its size.
+    args:        ptr - PNG being made or used, with the context as its
+                       memory pointer
+                 n - bytes wanted
+    returns:   block, NULL if out of memory (libpng makes that an error)
+***/
+static png_voidp ctx_malloc(png_structp ptr, png_alloc_size_t n) {
+  pngctx *ctx;                          /* context keeping blocks */
+  size_t sz;                            /* size of a kept block */
+  int best;                             /* kept block that fits best */
+  int i;
+  uchar *blk;                           /* block with header */
+
+  ctx = (pngctx *) png_get_mem_ptr(ptr);
+
+  best = -1;
+  for (i=0; i<ctx->nblk; i++) {
+    sz = *(size_t *) ctx->blk[i];
+    if ((n <= sz) && (sz / 2 <= n) &&
+        ((best < 0) || (sz < *(size_t *) ctx->blk[best]))) {
+      best = i;
+    }
+  }
+
+  if (0 <= best) {
+    blk = (uchar *) ctx->blk[best];
+    ctx->blk[best] = ctx->blk[--ctx->nblk];
+  } else {
+    if (NULL == (blk = (uchar *) malloc(PNG_BLKHDR + n))) {
+      return NULL;
+    }
+    *(size_t *) blk = n;
+  }
+
+  return blk + PNG_BLKHDR;
+}
+
+/***
+    ctx_free:  libpng free function for a codec context.  Keeps the block
+               for the next image if there's room, else frees it.
+    args:      ptr - PNG being used or destroyed, with the context as its
+                     memory pointer
+               mem - block from ctx_malloc
+***/
+static void ctx_free(png_structp ptr, png_voidp mem) {
+  pngctx *ctx;                          /* context keeping blocks */
+  uchar *blk;                           /* block with header */
+
+  if (NULL == mem) {
+    return;
+  }
+
+  ctx = (pngctx *) png_get_mem_ptr(ptr);
+  blk = (uchar *) mem - PNG_BLKHDR;
+  if (ctx->nblk < PNG_CTXBLK) {
+    ctx->blk[ctx->nblk++] = blk;
+  } else {
+    free(blk);
+  }
+}
+
+/***
+    ctx_buf:  Get a scratch buffer kept in a codec context, growing it if
+              needed.
+    args:     buf - kept buffer
+              bufsz - size of kept buffer
+              n - bytes needed
+    returns:   buffer, NULL if out of memory
+    modifies:  buf, bufsz
+***/
+static void *ctx_buf(void **buf, size_t *bufsz, size_t n) {
+
+  if (*bufsz < n) {
+    free(*buf);
+    *bufsz = 0;
+    if (NULL == (*buf = malloc(n))) {
+      return NULL;
+    }
+    *bufsz = n;
+  }
+
+  return *buf;
+}
+
+/***
+    ctx_clear:  Free everything a codec context keeps.
+    args:       ctx - context to empty
+    modifies:   ctx
+***/
+static void ctx_clear(pngctx *ctx) {
+  pngstrip *st;                         /* strip slot being freed */
+
+  while (0 < ctx->nblk) {
+    free(ctx->blk[--ctx->nblk]);
+  }
+  free(ctx->row);
+  free(ctx->rows);
+  ctx->row = ctx->rows = NULL;
+  ctx->rowsz = ctx->rowssz = 0;
+
+  while (0 < ctx->nstrip) {
+    st = &ctx->strip[--ctx->nstrip];
+    if (st->zinit) {
+      deflateEnd(&st->z);
+    }
+    free(st->buf);
+    free(st->filt);
+  }
+  free(ctx->strip);
+  ctx->strip = NULL;
+}
+
+/***
+    deint_row:  Split one decoded row of interleaved samples into the
+                image's planes with the img_kern kernels.
+    args:       img - image to fill
+                y - row being filled
+                row - samples, nchan per pixel
+                nchan - channels per pixel (1 to 4; alpha goes to the
+                        alpha plane, or is dropped if the image has none)
+    modifies:   img
+***/
+static void deint_row(_rgbimage *img, int y, const png_byte *row, int nchan) {
+  size_t xy;                            /* index of row start */
+  uchar *a;                             /* alpha row, NULL if none */
+
+  xy = (size_t) y * img->stride;
+  a = (NULL != img->a) ? img->a + xy : NULL;
+  if (1 == nchan) {
+	  /* Note this correctly reads 1-channel greyscale, where r == g == b. */
+    kern_deint1(row, img->r + xy, img->g + xy, img->b + xy, img->ncol);
+  } else if (2 == nchan) {
+    kern_deint2(row, img->r + xy, img->g + xy, img->b + xy, a, img->ncol);
+  } else if (3 == nchan) {
+    kern_deint3(row, img->r + xy, img->g + xy, img->b + xy, img->ncol);
+  } else {
+    kern_deint4(row, img->r + xy, img->g + xy, img->b + xy, a, img->ncol);
+  }
+}
+
+
+/***
+    deint_rows:  thrbody splitting a range of buffered rows into planes.
+    args:        arg - deintarg with image and rows
+                 lo, hi - rows to do
+***/
+static void deint_rows(void *arg, long lo, long hi) {
+  deintarg *d;                          /* image and rows */
+  long y;                               /* row */
+
+  d = (deintarg *) arg;
+  for (y=lo; y<hi; y++) {
+    deint_row(d->img, y, d->rows[y], d->nchan);
+  }
+}
+
+
+/***
+    put32:  Store a value as 4 bytes, most significant first, as PNG and
+            zlib do.
+    args:   buf - where to put the bytes
+            val - value to store
+    modifies:  buf
+***/
+static void put32(uchar *buf, uLong val) {
+
+  buf[0] = (uchar) (val >> 24);
+  buf[1] = (uchar) (val >> 16);
+  buf[2] = (uchar) (val >> 8);
+  buf[3] = (uchar) val;
+}
+
+/***
+    get_row:  Fetch a row to write as interleaved samples.
+    args:     pe - image being written
+              y - row to fetch
+              row - where to put the row's rowbytes samples
+    modifies:  row
+***/
+static void get_row(const parenc *pe, int y, uchar *row) {
+  size_t xy;                            /* index of row start */
+
+  xy = (size_t) y * pe->img->stride;
+  if (4 == pe->nchan) {
+    kern_int4(pe->img->r + xy, pe->img->g + xy, pe->img->b + xy,
+              pe->img->a + xy, row, pe->img->ncol);
+  } else if (NULL == pe->src) {
+    kern_int3(pe->img->r + xy, pe->img->g + xy, pe->img->b + xy, row,
+              pe->img->ncol);
+  } else {
+    memcpy(row, pe->src + xy, pe->rowbytes);
+  }
+}
+
+/***
+    paeth:  PNG's Paeth predictor, whichever neighbor is closest to
+            left + up - upleft.
+    args:   a - sample to the left
+            b - sample above
+            c - sample above and to the left
+    returns:   predicted sample
+***/
+static int paeth(int a, int b, int c) {
+  int pa, pb, pc;                       /* distances to prediction */
+
+  pa = abs(b - c);
+  pb = abs(a - c);
+  pc = abs(a + b - c - c);
+  if ((pa <= pb) && (pa <= pc)) {
+    return a;
+  }
+  return (pb <= pc) ? b : c;
+}
+
+/***
+    filter_one:  Apply one PNG filter to a row.
+    args:        ftype - filter (0 none, 1 sub, 2 up, 3 average, 4 Paeth)
+                 cur - row to filter
+                 prev - row above it, zeros for the first row
+                 n - bytes in a row
+                 bpp - bytes per pixel
+                 out - filter type and then the n filtered bytes
+    modifies:  out
+***/
+static void filter_one(int ftype, const uchar *cur, const uchar *prev,
+                       size_t n, int bpp, uchar *out) {
+  size_t i;
+
+  out[0] = (uchar) ftype;
+  out++;
+
+  /* The first pixel has no left neighbor, which counts as zero. */
+  switch (ftype) {
+  case 0:
+    memcpy(out, cur, n);
+    break;
+  case 1:
+    memcpy(out, cur, bpp);
+    for (i=bpp; i<n; i++) {
+      out[i] = cur[i] - cur[i - bpp];
+    }
+    break;
+  case 2:
+    for (i=0; i<n; i++) {
+      out[i] = cur[i] - prev[i];
+    }
+    break;
+  case 3:
+    for (i=0; i<(size_t) bpp; i++) {
+      out[i] = cur[i] - (prev[i] / 2);
+    }
+    for (; i<n; i++) {
+      out[i] = cur[i] - ((cur[i - bpp] + prev[i]) / 2);
+    }
+    break;
+  default:
+    for (i=0; i<(size_t) bpp; i++) {
+      out[i] = cur[i] - prev[i];
+    }
+    for (; i<n; i++) {
+      out[i] = cur[i] - paeth(cur[i - bpp], prev[i], prev[i - bpp]);
+    }
+    break;
+  }
+}
+
+/***
+    row_cost:  Sum the magnitudes of a filtered row's bytes as signed
+               values, libpng's measure of how well the row will compress.
+    args:      out - filtered bytes, after the filter type
+               n - bytes in a row
+    returns:   the sum
+***/
+static long row_cost(const uchar *out, size_t n) {
+  long sum;                             /* magnitudes so far */
+  size_t i;
+
+  for (i=0, sum=0; i<n; i++) {
+    sum += (out[i] < 128) ? out[i] : (256 - out[i]);
+  }
+
+  return sum;
+}
+
+/***
+    filter_row:  Filter a row the way libpng does, trying each filter
+                 allowed and keeping the one with the smallest row_cost.
+                 With only one allowed there's nothing to compare.
+    args:        cur - row to filter
+                 prev - row above it, zeros for the first row
+                 n - bytes in a row
+                 bpp - bytes per pixel
+                 filters - PNGF_* filters allowed, or'd together
+                 out - filter type and then the n filtered bytes
+                 tmp - scratch space for n + 1 bytes
+    modifies:  out, tmp
+***/
+static void filter_row(const uchar *cur, const uchar *prev, size_t n,
+                       int bpp, int filters, uchar *out, uchar *tmp) {
+  uchar *best;                          /* output of best filter so far */
+  uchar *next;                          /* output of filter being tried */
+  long bestsum;                         /* sum of best */
+  long sum;                             /* sum of next */
+  int ftype;                            /* filter being tried */
+
+  best = NULL;
+  bestsum = 0;
+  for (ftype=0; ftype<5; ftype++) {
+    if (0 == (filters & (PNGF_NONE << ftype))) {
+      continue;
+    }
+    next = (best == out) ? tmp : out;
+    filter_one(ftype, cur, prev, n, bpp, next);
+    if (0 == (filters & (filters - 1))) {
+      return;
+    }
+    sum = row_cost(next + 1, n);
+    if ((NULL == best) || (sum < bestsum)) {
+      best = next;
+      bestsum = sum;
+    }
+  }
+
+  if (best != out) {
+    memcpy(out, best, n + 1);
+  }
+}
+
+/***
+    enc_strip:  Filter and deflate one strip of rows as a piece of a raw
+                deflate stream.  Up to a window of rows above the strip are
+                filtered too and set as deflate's dictionary, so matches
+                reach back past the strip's start as in a single stream.
+                Every strip but the last ends in a sync flush, which leaves
+                the stream open on a byte boundary for the next to follow.
+                Room is left for the zlib header before the first strip and
+                the checksum after the last.  The slot's buffers and
+                deflate state are reused, the stream only reset if made
+                for the same level and strategy.  Errors are kept in the
+                strip for the writer to report.
+    args:       pe - image being written
+                s - strip number
+                st - slot to deflate the strip into
+    modifies:   st
+***/
+static void enc_strip(const parenc *pe, int s, pngstrip *st) {
+  z_stream *z;                          /* deflate state */
+  uchar *filt;                          /* filtered rows, with scratch */
+  uchar *cur, *prev, *tmp;              /* rows being filtered */
+  uchar *bigger;                        /* grown output buffer */
+  size_t flen;                          /* bytes in a filtered row */
+  size_t ndict;                         /* bytes of dictionary */
+  size_t head, tail;                    /* room for zlib header, trailer */
+  size_t nout;                          /* bytes deflated so far */
+  int y0, y1;                           /* rows of the strip */
+  int ydict;                            /* first row of the dictionary */
+  int y;                                /* row */
+  int flush;                            /* how to end the strip */
+  int zret;                             /* zlib return */
+
+  st->err = 0;
+  st->nbuf = 0;
+  flen = pe->rowbytes + 1;
+  y0 = s * pe->rowsper;
+  y1 = y0 + pe->rowsper;
+  if (pe->img->nrow < y1) {
+    y1 = pe->img->nrow;
+  }
+  ydict = y0 - (int) ((PNG_WINDOW + flen - 1) / flen);
+  if (ydict < 0) {
+    ydict = 0;
+  }
+  flush = (pe->nstrip - 1 == s) ? Z_FINISH : Z_SYNC_FLUSH;
+  head = (0 == s) ? 2 : 0;
+  tail = (Z_FINISH == flush) ? 4 : 0;
+
+  filt = (uchar *) ctx_buf(&st->filt, &st->filtsz,
+                           ((size_t) (y1 - ydict) + 3) * flen);
+  if (NULL == filt) {
+    st->err = IMGERR_NOMEM;
+    return;
+  }
+  cur = filt + ((size_t) (y1 - ydict) * flen);
+  prev = cur + flen;
+  tmp = prev + flen;
+
+  if (0 < ydict) {
+    get_row(pe, ydict - 1, prev);
+  } else {
+    memset(prev, 0, pe->rowbytes);
+  }
+  for (y=ydict; y<y1; y++) {
+    get_row(pe, y, cur);
+    filter_row(cur, prev, pe->rowbytes, pe->nchan, pe->opts->filters,
+               filt + ((size_t) (y - ydict) * flen), tmp);
+    bigger = prev;
+    prev = cur;
+    cur = bigger;
+  }
+
+  z = &st->z;
+  if (st->zinit && (pe->opts->level == st->zlevel) &&
+      (pe->opts->strategy == st->zstrat)) {
+    zret = deflateReset(z);
+  } else {
+    if (st->zinit) {
+      deflateEnd(z);
+      st->zinit = 0;
+    }
+    memset(z, 0, sizeof(*z));
+    zret = deflateInit2(z, pe->opts->level, Z_DEFLATED, -15, 8,
+                        zstrategy[pe->opts->strategy]);
+    if (Z_OK == zret) {
+      st->zinit = 1;
+      st->zlevel = pe->opts->level;
+      st->zstrat = pe->opts->strategy;
+    }
+  }
+  if (Z_OK != zret) {
+    st->err = (Z_MEM_ERROR == zret) ? IMGERR_NOMEM : IMGERR_CODEC;
+    return;
+  }
+
+  ndict = (size_t) (y0 - ydict) * flen;
+  if (0 < ndict) {
+    if (PNG_WINDOW < ndict) {
+      ndict = PNG_WINDOW;
+    }
+    (void) deflateSetDictionary(z, filt + ((y0 - ydict) * flen) - ndict,
+                                ndict);
+  }
+
+  z->next_in = filt + ((size_t) (y0 - ydict) * flen);
+  z->avail_in = (uInt) ((size_t) (y1 - y0) * flen);
+  st->nraw = z->avail_in;
+  st->adler = adler32(adler32(0L, Z_NULL, 0), z->next_in, z->avail_in);
+
+  /* A sync flush adds at most a few bytes past deflate's bound. */
+  nout = head + deflateBound(z, z->avail_in) + 16 + tail;
+  if (st->bufsz < nout) {
+    if (NULL == (bigger = (uchar *) realloc(st->buf, nout))) {
+      st->err = IMGERR_NOMEM;
+      return;
+    }
+    st->buf = bigger;
+    st->bufsz = nout;
+  }
+  z->next_out = st->buf + head;
+  z->avail_out = (uInt) (st->bufsz - head - tail);
+
+  while (1) {
+    zret = deflate(z, flush);
+    if (Z_STREAM_ERROR == zret) {
+      st->err = IMGERR_CODEC;
+      return;
+    }
+    if ((Z_FINISH == flush) ? (Z_STREAM_END == zret) : (0 != z->avail_out)) {
+      break;
+    }
+    nout = z->next_out - st->buf;
+    if (NULL == (bigger = (uchar *) realloc(st->buf, 2 * st->bufsz))) {
+      st->err = IMGERR_NOMEM;
+      return;
+    }
+    st->buf = bigger;
+    st->bufsz *= 2;
+    z->next_out = st->buf + nout;
+    z->avail_out = (uInt) (st->bufsz - nout - tail);
+  }
+
+  st->nbuf = z->next_out - st->buf;
+}
+
+/***
+    enc_strips:  thrbody deflating a range of a wave's strips.
+    args:        arg - parenc with the image and wave
+                 lo, hi - strips of the wave to do
+***/
+static void enc_strips(void *arg, long lo, long hi) {
+  parenc *pe;                           /* image being written */
+  long k;                               /* strip in wave */
+
+  pe = (parenc *) arg;
+  for (k=lo; k<hi; k++) {
+    enc_strip(pe, pe->first + k, &pe->strip[k]);
+  }
+}
+
+/***
+    dst_put:  Add bytes to a PNG being written without libpng.
+    args:     dst - file or buffer to write to
+              data - bytes to add
+              len - number of bytes
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  dst
+***/
+static int dst_put(pngdst *dst, const uchar *data, size_t len) {
+
+  if (0 == len) {
+    return 0;
+  }
+  if (NULL != dst->fout) {
+    if (len != fwrite(data, 1, len, dst->fout)) {
+      return img_syserror(IMGERR_IO, errno, "can't write PNG");
+    }
+  } else if (mem_put(dst, data, len) < 0) {
+    return img_error(IMGERR_NOMEM, "can't grow PNG output buffer");
+  }
+
+  return 0;
+}
+
+/***
+    put_chunk:  Write a PNG chunk: its length, type, data, and CRC.
+    args:       dst - file or buffer to write to
+                type - 4 letter chunk type
+                data - contents of chunk
+                len - bytes in data
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  dst
+***/
+static int put_chunk(pngdst *dst, const char *type, const uchar *data,
+                     size_t len) {
+  uchar hdr[8];                         /* length and type */
+  uchar crc[4];                         /* CRC of type and data */
+  uLong sum;                            /* running CRC */
+  int retval;
+
+  put32(hdr, len);
+  memcpy(hdr + 4, type, 4);
+  sum = crc32(crc32(0L, Z_NULL, 0), hdr + 4, 4);
+  if (0 < len) {
+    sum = crc32(sum, data, len);
+  }
+  put32(crc, sum);
+
+  retval = dst_put(dst, hdr, sizeof(hdr));
+  RETONERR;
+  retval = dst_put(dst, data, len);
+  RETONERR;
+  return dst_put(dst, crc, sizeof(crc));
+}
+
+/***
+    zlib_header:  Make the two byte zlib header, whose level hint zlib
+                  sets the same way when it writes the header itself.
+    args:         opts - how the stream is compressed
+                  hdr - where to put the header
+    modifies:  hdr
+***/
+static void zlib_header(const pngopts *opts, uchar *hdr) {
+  int level;                            /* compression level */
+  int flevel;                           /* its hint */
+
+  level = (Z_DEFAULT_COMPRESSION == opts->level) ? 6 : opts->level;
+  if ((PNGZ_RLE <= opts->strategy) || (level < 2)) {
+    flevel = 0;
+  } else if (level < 6) {
+    flevel = 1;
+  } else {
+    flevel = (6 == level) ? 2 : 3;
+  }
+
+  /* deflate with a 32K window, no dictionary, and a check on the pair */
+  hdr[0] = 0x78;
+  hdr[1] = flevel << 6;
+  hdr[1] += 31 - (((hdr[0] << 8) + hdr[1]) % 31);
+}
+
+/***
+    write_png_par:  Encode an image as PNG in strips on a thread pool.
+                    Strips are deflated a wave at a time and written in
+                    order as IDAT chunks, the first behind the zlib header
+                    and the last followed by the combined checksum.  Only
+                    the chunks libpng writes for us (IHDR, IDAT, IEND) are
+                    written.  A wave's strips are deflated in slots kept in
+                    the codec context, grown to the wave's size.
+    args:           ctx - codec context to keep the strip slots in
+                    dst - file or buffer to write to
+                    img - image to save
+                    src - plane to write, NULL for RGB or RGBA
+                    nchan - channels per pixel (1 with src, else 3 or 4)
+                    pool - threads to deflate on
+                    rowsper - rows in a strip
+                    opts - how to compress
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, dst
+***/
+static int write_png_par(pngctx *ctx, pngdst *dst, _rgbimage *img,
+                         const uchar *src, int nchan, thrpool *pool,
+                         int rowsper, const pngopts *opts) {
+  static const uchar sig[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  parenc pe;                            /* image being written */
+  pngstrip *st;                         /* strip being written */
+  pngstrip *more;                       /* slots after growing */
+  uchar ihdr[13];                       /* header chunk */
+  uLong adler;                          /* checksum of strips so far */
+  int nwave;                            /* strips in a wave */
+  int nthis;                            /* strips in this wave */
+  int k;                                /* strip in wave */
+  int retval;
+
+  pe.img = img;
+  pe.src = src;
+  pe.nchan = nchan;
+  pe.rowbytes = (size_t) pe.nchan * img->ncol;
+  pe.rowsper = rowsper;
+  pe.opts = opts;
+  pe.nstrip = (img->nrow + rowsper - 1) / rowsper;
+  nwave = PNG_PARWAVE * thrpool_size(pool);
+  if (pe.nstrip < nwave) {
+    nwave = pe.nstrip;
+  }
+  if (ctx->nstrip < nwave) {
+    more = (pngstrip *) realloc(ctx->strip, nwave * sizeof(pngstrip));
+    if (NULL == more) {
+      return img_error(IMGERR_NOMEM, "can't allocate PNG strips");
+    }
+    memset(more + ctx->nstrip, 0, (nwave - ctx->nstrip) * sizeof(pngstrip));
+    ctx->strip = more;
+    ctx->nstrip = nwave;
+  }
+  pe.strip = ctx->strip;
+  adler = 0;
+
+  retval = dst_put(dst, sig, sizeof(sig));
+  RETONERR;
+
+  put32(ihdr, img->ncol);
+  put32(ihdr + 4, img->nrow);
+  ihdr[8] = 8;
+  if (4 == nchan) {
+    ihdr[9] = PNG_COLOR_TYPE_RGB_ALPHA;
+  } else if (3 == nchan) {
+    ihdr[9] = PNG_COLOR_TYPE_RGB;
+  } else {
+    ihdr[9] = PNG_COLOR_TYPE_GRAY;
+  }
+  ihdr[10] = PNG_COMPRESSION_TYPE_DEFAULT;
+  ihdr[11] = PNG_FILTER_TYPE_DEFAULT;
+  ihdr[12] = PNG_INTERLACE_NONE;
+  retval = put_chunk(dst, "IHDR", ihdr, sizeof(ihdr));
+  RETONERR;
+
+  for (pe.first=0; pe.first<pe.nstrip; pe.first+=nwave) {
+    nthis = pe.nstrip - pe.first;
+    if (nwave < nthis) {
+      nthis = nwave;
+    }
+    thrpool_parfor(pool, 0, nthis, 1, enc_strips, &pe);
+
+    for (k=0; k<nthis; k++) {
+      st = &pe.strip[k];
+      if (st->err < 0) {
+        return img_error(st->err, "can't deflate strip %d of PNG",
+                         pe.first + k);
+      }
+      if (0 == pe.first + k) {
+        zlib_header(opts, st->buf);
+        adler = st->adler;
+      } else {
+        adler = adler32_combine(adler, st->adler, st->nraw);
+      }
+      if (pe.nstrip - 1 == pe.first + k) {
+        put32(st->buf + st->nbuf, adler);
+        st->nbuf += 4;
+      }
+      retval = put_chunk(dst, "IDAT", st->buf, st->nbuf);
+      RETONERR;
+    }
+  }
+
+  return put_chunk(dst, "IEND", NULL, 0);
+}
+
+/***
+    get32:  Read a 4 byte value stored most significant first.
+    args:   buf - the bytes
+    returns:   their value
+***/
+static uLong get32(const uchar *buf) {
+
+  return ((uLong) buf[0] << 24) | ((uLong) buf[1] << 16) |
+    ((uLong) buf[2] << 8) | buf[3];
+}
+
+/***
+    pipe_ok:  See if a PNG in memory can go to read_png_pipe, from its
+              header chunk: a large plain 8-bit image, within libpng's
+              size limits, with no transparent color (tRNS) before the
+              image data.  Anything else goes to libpng, which reports
+              any problem with the header.
+    args:     src - buffer holding image, past the signature
+              w, h - image size
+              nchan - channels per pixel
+    returns:   true if the image can be pipelined, 0 if not
+    modifies:  w, h, nchan
+***/
+static int pipe_ok(const pngsrc *src, int *w, int *h, int *nchan) {
+  const uchar *ihdr;                    /* header chunk */
+  uLong ncol, nrow;                     /* image size */
+  uLong clen;                           /* bytes of a chunk's data */
+  size_t pos;                           /* offset of a chunk */
+
+  if ((NULL != src->fin) || (src->nbuf < 8 + 25)) {
+    return 0;
+  }
+  ihdr = src->buf + 8;
+  if ((13 != get32(ihdr)) || (0 != memcmp(ihdr + 4, "IHDR", 4)) ||
+      (get32(ihdr + 21) != crc32(crc32(0L, Z_NULL, 0), ihdr + 4, 17))) {
+    return 0;
+  }
+
+  ncol = get32(ihdr + 8);
+  nrow = get32(ihdr + 12);
+  if ((0 == ncol) || (PNG_USER_WIDTH_MAX < ncol) ||
+      (0 == nrow) || (PNG_USER_HEIGHT_MAX < nrow) ||
+      (8 != ihdr[16]) ||
+      ((PNG_COLOR_TYPE_GRAY != ihdr[17]) && (PNG_COLOR_TYPE_RGB != ihdr[17])) ||
+      (0 != ihdr[18]) || (0 != ihdr[19]) || (0 != ihdr[20])) {
+    return 0;
+  }
+
+  /* Transparency becomes an alpha plane, which libpng has to make.  A
+     truncated chunk just ends the search; next_idat will report it. */
+  for (pos=8+25; pos+12<=src->nbuf; pos+=12+clen) {
+    if (0 == memcmp(src->buf + pos + 4, "IDAT", 4)) {
+      break;
+    }
+    if (0 == memcmp(src->buf + pos + 4, "tRNS", 4)) {
+      return 0;
+    }
+    clen = get32(src->buf + pos);
+    if (src->nbuf - pos - 12 < clen) {
+      break;
+    }
+  }
+
+  *w = ncol;
+  *h = nrow;
+  *nchan = (PNG_COLOR_TYPE_RGB == ihdr[17]) ? 3 : 1;
+
+  return (PNG_PIPEBYTES <= ((ncol * *nchan) + 1) * nrow);
+}
+
+/***
+    pipe_fail:  Stop the inflater with an error for the caller to report.
+    args:       pp - pipeline
+                err - error code
+                why - what went wrong
+    modifies:   pp
+***/
+static void pipe_fail(pngpipe *pp, int err, const char *why) {
+
+  pthread_mutex_lock(&pp->lock);
+  pp->err = err;
+  pp->why = why;
+  pthread_cond_broadcast(&pp->change);
+  pthread_mutex_unlock(&pp->lock);
+}
+
+/***
+    next_idat:  Give inflate the data of the next IDAT chunk, checking its
+                CRC.  The IDAT chunks must follow each other; other chunks
+                before the first are skipped, as libpng skips them without
+                transforms to apply, unless critical.
+    args:       pp - pipeline
+                first - true if looking for the first IDAT
+                z - inflate state
+    returns:   0 if found
+               < 0 if not, with pp->why set
+    modifies:  pp, z
+***/
+static int next_idat(pngpipe *pp, int first, z_stream *z) {
+  const uchar *chunk;                   /* chunk being looked at */
+  uLong clen;                           /* bytes of its data */
+
+  while (1) {
+    if (pp->nbuf - pp->pos < 12) {
+      pp->why = "not enough image data";
+      return IMGERR_CODEC;
+    }
+    chunk = pp->buf + pp->pos;
+    clen = get32(chunk);
+    if ((0x7fffffff < clen) || (pp->nbuf - pp->pos - 12 < clen)) {
+      pp->why = "chunk runs past end of file";
+      return IMGERR_CODEC;
+    }
+    pp->pos += 12 + clen;
+
+    if (0 == memcmp(chunk + 4, "IDAT", 4)) {
+      if (get32(chunk + 8 + clen) !=
+          crc32(crc32(0L, Z_NULL, 0), chunk + 4, 4 + clen)) {
+        pp->why = "IDAT: CRC error";
+        return IMGERR_CODEC;
+      }
+      z->next_in = (Bytef *) chunk + 8;
+      z->avail_in = clen;
+      return 0;
+    }
+    if (!first) {
+      pp->why = "not enough image data";
+      return IMGERR_CODEC;
+    }
+    /* Critical chunks have an upper case first letter, and only PLTE (a
+       suggested palette for RGB) is allowed here. */
+    if ((0 == (chunk[4] & 0x20)) && (0 != memcmp(chunk + 4, "PLTE", 4))) {
+      pp->why = "unknown critical chunk";
+      return IMGERR_CODEC;
+    }
+  }
+}
+
+/***
+    pipe_inflate:  Main loop of the inflating thread, filling each slot of
+                   the ring with a batch of filtered rows as the caller
+                   drains it, then checking the stream's end.
+    args:          arg - pipeline
+    returns:   NULL
+***/
+static void *pipe_inflate(void *arg) {
+  pngpipe *pp;                          /* pipeline */
+  z_stream z;                           /* inflate state */
+  uchar extra[64];                      /* output past the last row */
+  int b;                                /* batch */
+  int nrow;                             /* rows in batch */
+  int quit;                             /* true if told to stop */
+  int zret;                             /* zlib return */
+  int retval;
+
+  pp = (pngpipe *) arg;
+  memset(&z, 0, sizeof(z));
+  if (Z_OK != inflateInit(&z)) {
+    pipe_fail(pp, IMGERR_NOMEM, "can't start inflating");
+    return NULL;
+  }
+  zret = Z_OK;
+  retval = next_idat(pp, 1, &z);
+  CLEANUPONERR;
+
+  for (b=0; b<pp->nbatch; b++) {
+    pthread_mutex_lock(&pp->lock);
+    while (!pp->quit && (pp->drained + PNG_PIPESLOTS <= b)) {
+      pthread_cond_wait(&pp->change, &pp->lock);
+    }
+    quit = pp->quit;
+    pthread_mutex_unlock(&pp->lock);
+    if (quit) {
+      goto cleanup;
+    }
+
+    nrow = pp->h - (b * pp->batch);
+    if (pp->batch < nrow) {
+      nrow = pp->batch;
+    }
+    z.next_out = pp->ring + ((size_t) (b % PNG_PIPESLOTS) * pp->batch *
+                             pp->flen);
+    z.avail_out = (uInt) (nrow * pp->flen);
+
+    while (0 < z.avail_out) {
+      if (0 == z.avail_in) {
+        retval = next_idat(pp, 0, &z);
+        CLEANUPONERR;
+        continue;
+      }
+      zret = inflate(&z, Z_NO_FLUSH);
+      if ((Z_STREAM_END == zret) && (0 < z.avail_out)) {
+        retval = IMGERR_CODEC;
+        pp->why = "not enough image data";
+        goto cleanup;
+      } else if ((Z_OK != zret) && (Z_STREAM_END != zret)) {
+        retval = IMGERR_CODEC;
+        pp->why = (NULL != z.msg) ? z.msg : "bad compressed data";
+        goto cleanup;
+      }
+    }
+
+    pthread_mutex_lock(&pp->lock);
+    pp->filled = b + 1;
+    pthread_cond_broadcast(&pp->change);
+    pthread_mutex_unlock(&pp->lock);
+  }
 
-#include "img_png_v3.h"
+  /* Read on to the check value at the end of the stream so a corrupt one
+     is caught; like libpng, tolerate a stream cut short after the rows or
+     extra data past them. */
+  do {
+    z.next_out = extra;
+    z.avail_out = sizeof(extra);
+    if ((0 == z.avail_in) &&
+        (next_idat(pp, 0, &z) < 0)) {
+      break;
+    }
+    zret = inflate(&z, Z_NO_FLUSH);
+  } while ((Z_OK == zret) && (sizeof(extra) == z.avail_out));
+  if (Z_DATA_ERROR == zret) {
+    retval = IMGERR_CODEC;
+    pp->why = (NULL != z.msg) ? z.msg : "bad compressed data";
+    goto cleanup;
+  }
 
+  retval = 0;
 
-/**** Macros ****/
+ cleanup:
+  if (retval < 0) {
+    pipe_fail(pp, retval, pp->why);
+  }
+  inflateEnd(&z);
+  return NULL;
+}
 
 /***
-    RETONERR:  If the previous function call returned an error code (< 0),
-               exit the function, returning the code.  Assumes the code has
-               been assigned to a local variable 'retval'.
+    unfilter_row:  Undo the filter on a row.
+    args:          in - filter type and then the filtered bytes
+                   prev - the row above, unfiltered, zeros for the first
+                   n - bytes in a row
+                   bpp - bytes per pixel
+                   out - the row unfiltered
+    returns:   0 if successful
+               < 0 if the filter type is unknown
+    modifies:  out
 ***/
-#define RETONERR     { if (retval < 0) { return retval; }}
+static int unfilter_row(const uchar *in, const uchar *prev, size_t n,
+                        int bpp, uchar *out) {
+  size_t i;
+
+  /* The first pixel has no left neighbor, which counts as zero. */
+  switch (in[0]) {
+  case 0:
+    memcpy(out, in + 1, n);
+    break;
+  case 1:
+    memcpy(out, in + 1, bpp);
+    for (i=bpp; i<n; i++) {
+      out[i] = in[i + 1] + out[i - bpp];
+    }
+    break;
+  case 2:
+    for (i=0; i<n; i++) {
+      out[i] = in[i + 1] + prev[i];
+    }
+    break;
+  case 3:
+    for (i=0; i<(size_t) bpp; i++) {
+      out[i] = in[i + 1] + (prev[i] / 2);
+    }
+    for (; i<n; i++) {
+      out[i] = in[i + 1] + ((out[i - bpp] + prev[i]) / 2);
+    }
+    break;
+  case 4:
+    for (i=0; i<(size_t) bpp; i++) {
+      out[i] = in[i + 1] + prev[i];
+    }
+    for (; i<n; i++) {
+      out[i] = in[i + 1] + paeth(out[i - bpp], prev[i], prev[i - bpp]);
+    }
+    break;
+  default:
+    return IMGERR_CODEC;
+  }
+
+  return 0;
+}
 
 /***
-    CLEANUPONERR:  If the previous function call returned an error code (< 0),
-                   jump to the end of the function to clean up any locally
-                   allocated storage.  Assumes the error code has been assigned
-                   to a local variable 'retval' and that there is a label
-                   'cleanup' to jump to.
+    read_png_pipe:  Decode a large plain PNG in memory in two stages at
+                    once.  A thread of its own inflates batches of filtered
+                    rows into a ring while this thread unfilters them and
+                    splits them into the planes.  Inflating is the larger
+                    stage, so the decode takes about as long as it alone.
+    args:           ctx - codec context to keep the ring in
+                    name - file name, for messages
+                    src - buffer holding image, checked by pipe_ok
+                    img - image to fill (if non-NULL, old image released
+                          to pool)
+                    pool - image pool, NULL to allocate a new image
+                    w, h - image size
+                    nchan - channels per pixel
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
 ***/
-#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+static int read_png_pipe(pngctx *ctx, const char *name, pngsrc *src,
+                         _rgbimage **img, rgbpool *pool, int w, int h,
+                         int nchan) {
+  pngpipe pp;                           /* pipeline */
+  uchar *slot;                          /* batch being unfiltered */
+  uchar *in;                            /* row being unfiltered */
+  uchar *cur, *prev;                    /* row unfiltered, row above */
+  uchar *tmp;                           /* for swapping cur and prev */
+  size_t rowbytes;                      /* bytes in an unfiltered row */
+  int started;                          /* true if inflater running */
+  int b;                                /* batch */
+  int k;                                /* row in batch */
+  int y;                                /* row in image */
+  int retval;
+
+  memset(&pp, 0, sizeof(pp));
+  pp.buf = src->buf;
+  pp.nbuf = src->nbuf;
+  pp.pos = 8 + 25;
+  rowbytes = (size_t) w * nchan;
+  pp.flen = rowbytes + 1;
+  pp.h = h;
+  pp.batch = (pp.flen < PNG_PIPEBATCH) ? (int) (PNG_PIPEBATCH / pp.flen) : 1;
+  pp.nbatch = (h + pp.batch - 1) / pp.batch;
+  started = 0;
+
+  retval = rgbpool_acquire(pool, img, w, h);
+  RETONERR;
+
+  pp.ring = (uchar *) ctx_buf(&ctx->row, &ctx->rowsz,
+                              (PNG_PIPESLOTS * pp.batch * pp.flen) +
+                              (2 * rowbytes));
+  if (NULL == pp.ring) {
+    return img_error(IMGERR_NOMEM, "can't allocate PNG row ring");
+  }
+  cur = pp.ring + (PNG_PIPESLOTS * pp.batch * pp.flen);
+  prev = cur + rowbytes;
+  memset(prev, 0, rowbytes);
+
+  if (0 != pthread_mutex_init(&pp.lock, NULL)) {
+    return img_error(IMGERR_FAIL, "can't initialize PNG pipeline lock");
+  }
+  if (0 != pthread_cond_init(&pp.change, NULL)) {
+    pthread_mutex_destroy(&pp.lock);
+    return img_error(IMGERR_FAIL, "can't initialize PNG pipeline condition");
+  }
+  retval = pthread_create(&pp.inflater, NULL, pipe_inflate, &pp);
+  if (0 != retval) {
+    retval = img_syserror(IMGERR_FAIL, retval,
+                          "can't start PNG inflating thread");
+    goto cleanup;
+  }
+  started = 1;
+
+  for (b=0, y=0; b<pp.nbatch; b++) {
+    pthread_mutex_lock(&pp.lock);
+    while ((pp.filled <= b) && (0 == pp.err)) {
+      pthread_cond_wait(&pp.change, &pp.lock);
+    }
+    retval = pp.err;
+    pthread_mutex_unlock(&pp.lock);
+    if (retval < 0) {
+      retval = img_error(retval, "PNG: %s in %s", pp.why, name);
+      goto cleanup;
+    }
+
+    slot = pp.ring + ((size_t) (b % PNG_PIPESLOTS) * pp.batch * pp.flen);
+    for (k=0; (k < pp.batch) && (y < h); k++, y++) {
+      in = slot + (k * pp.flen);
+      if (unfilter_row(in, prev, rowbytes, nchan, cur) < 0) {
+        retval = img_error(IMGERR_CODEC,
+                           "PNG: bad filter type %d in row %d of %s",
+                           in[0], y, name);
+        goto cleanup;
+      }
+      deint_row(*img, y, cur, nchan);
+      tmp = prev;
+      prev = cur;
+      cur = tmp;
+    }
+
+    pthread_mutex_lock(&pp.lock);
+    pp.drained = b + 1;
+    pthread_cond_broadcast(&pp.change);
+    pthread_mutex_unlock(&pp.lock);
+  }
 
+  retval = 0;
+
+ cleanup:
+  if (started) {
+    pthread_mutex_lock(&pp.lock);
+    pp.quit = 1;
+    pthread_cond_broadcast(&pp.change);
+    pthread_mutex_unlock(&pp.lock);
+    pthread_join(pp.inflater, NULL);
+    /* A bad check value is only found once every row is in. */
+    if ((0 == retval) && (pp.err < 0)) {
+      retval = img_error(pp.err, "PNG: %s in %s", pp.why, name);
+    }
+  }
+  pthread_cond_destroy(&pp.change);
+  pthread_mutex_destroy(&pp.lock);
+
+  return retval;
+}
 
 
 /**** PNG Functions ****/
@@ -58,41 +1469,31 @@
 int PNG_isa(const char *fname) {
   FILE *fin;                            /* file handle to read from */
   png_byte header[8];                   /* PNG file verification */
-  char *errmsg;                         /* error message */
   int ispng;                            /* true if PNG file */
   int retval;
 
   /* For Windows, make this "rb". */
   fin = fopen(fname, "r");
   if (NULL == fin) {
-    errmsg = strerror(errno);
-    printf("can't open file %s to read: %s\n", fname, errmsg);
+    (void) img_syserror(IMGERR_IO, errno, "can't open file %s to read",
+                        fname);
     return 0;
   }
 
-  /* Verify is a PNG. */
+  /* Verify is a PNG.  A file too short for the signature isn't one. */
   retval = fread(&header, 1, 8, fin);
-  if (8 != retval) {
-    printf("only read %d header bytes from %s\n", retval, fname);
-    return 0;
-  }
-
-  ispng = !png_sig_cmp(header, 0, 8);
+  ispng = (8 == retval) && !png_sig_cmp(header, 0, 8);
 
   retval = fclose(fin);
   if (0 != retval) {
-    errmsg = strerror(errno);
-    printf("problem closing %s: %s\n", fname, errmsg);
-    return -1;
+    return img_syserror(IMGERR_IO, errno, "problem closing %s", fname);
   }
 
   return ispng;
 }
 
 /***
-    PNG_read:  Bring in a PNG image.  See the libpng manpage for what we're
-               doing.  Stored internally as an _rgbimage.  Alpha channel is
-               ignored.
+    PNG_read:  Bring in a PNG image, allocating fresh storage for it.
     args:      fname - name of file with image, if NULL take from stdin
                img - image read (if non-NULL, will free old image)
     returns:   0 if successful
@@ -100,127 +1501,191 @@ int PNG_isa(const char *fname) {
     modifies:  img
 ***/
 int PNG_read(const char *fname, _rgbimage **img) {
-  FILE *fin;                            /* file handle to read from */
+
+  return PNG_read_pool(fname, img, NULL);
+}
+
+/***
+    read_png:  Bring in a PNG image.  See the libpng manpage for what we're
+               doing.  Stored internally as an _rgbimage with aligned,
+               padded rows, drawn from the pool if given.  Rows are decoded
+               one at a time into a single buffer and split into the planes
+               while still in cache, rather than holding a second full copy
+               of the image; only interlaced files, whose passes revisit
+               every row, are read whole.  Any color type and bit depth is
+               read, with libpng converting it to 8-bit grey or RGB.  If
+               the file has alpha, or transparency (a tRNS chunk), the
+               image gets an alpha plane holding it, not premultiplied;
+               otherwise img->a is NULL.
+    args:      ctx - codec context to allocate from and keep buffers in,
+                     NULL to set one up and clear it for just this image
+               name - what we're reading, for messages
+               src - file or buffer to read
+               img - image read (if non-NULL, old image released to pool)
+               pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int read_png(pngctx *ctx, const char *name, pngsrc *src,
+                    _rgbimage **img, rgbpool *pool) {
+  pngctx local;                         /* context if the caller has none */
   png_structp ptr;                      /* internal reference to PNG data */
   png_infop info;                       /* picture information */
-  png_bytep *rows;                      /* each row in image */
+  png_bytep volatile row;               /* decoded row(s) */
+  png_bytep * volatile rows;            /* each row in image, if interlaced */
   png_byte header[8];                   /* PNG file verification */
-  char *errmsg;                         /* error message */
+  deintarg deint;                       /* rows to split, if interlaced */
+  size_t rowbytes;                      /* bytes in one decoded row */
   int ispng;                            /* true if PNG file */
   int w, h;                             /* image size */
-  int nchan;                            /* number of color channels */
-  int x, y, xy;                         /* pixel coordinates/index */
-  int i;
+  int nchan;                            /* channels per decoded pixel */
+  int alpha;                            /* true if decoding alpha */
+  int depth;                            /* bits per sample in file */
+  int pngtype;                          /* color type in file */
+  int npass;                            /* interlace passes */
+  int y;                                /* row */
   int retval;
 
-  fin = NULL;
+  if (NULL == ctx) {
+    memset(&local, 0, sizeof(local));
+    ctx = &local;
+  }
   ptr = NULL;
   info = NULL;
+  row = NULL;
+  rows = NULL;
 
-  if (NULL == fname) {
-    fin = stdin;
+  /* Verify is a PNG. */
+  if (NULL != src->fin) {
+    retval = fread(&header, 1, 8, src->fin);
   } else {
-    /* For Windows, make this "rb". */
-    fin = fopen(fname, "r");
-    if (NULL == fin) {
-      errmsg = strerror(errno);
-      printf("can't open file %s to read: %s\n", fname, errmsg);
-      return -1;
-    }
+    retval = (src->nbuf < 8) ? (int) src->nbuf : 8;
+    memcpy(header, src->buf, retval);
+    src->pos = retval;
   }
-
-  /* Verify is a PNG. */
-  retval = fread(&header, 1, 8, fin);
   if (8 != retval) {
-    printf("only read %d header bytes from %s\n", retval, fname);
-    return -1;
+    retval = img_error(IMGERR_FORMAT, "only read %d header bytes from %s",
+                       retval, name);
+    goto cleanup;
   }
 
   ispng = !png_sig_cmp(header, 0, 8);
   if (!ispng) {
-    printf("%s is not in PNG format\n", fname);
-    retval = -1;
+    retval = img_error(IMGERR_FORMAT, "%s is not in PNG format", name);
+    goto cleanup;
+  }
+
+  if (atomic_load(&pipeline) && pipe_ok(src, &w, &h, &nchan)) {
+    retval = read_png_pipe(ctx, name, src, img, pool, w, h, nchan);
     goto cleanup;
   }
 
-  ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  ptr = png_create_read_struct_2(PNG_LIBPNG_VER_STRING, NULL, png_errfn,
+                                 png_warnfn, ctx, ctx_malloc, ctx_free);
   if (NULL == ptr) {
-    printf("could not read main PNG structure from %s\n", fname);
-    retval = -1;
+    retval = img_error(IMGERR_NOMEM,
+                       "could not read main PNG structure from %s", name);
     goto cleanup;
   }
 
   info = png_create_info_struct(ptr);
   if (NULL == info) {
-    printf("could not read PNG starting info from %s\n", fname);
-    retval = -1;
+    retval = img_error(IMGERR_NOMEM,
+                       "could not read PNG starting info from %s", name);
     goto cleanup;
   }
     
   if (setjmp(png_jmpbuf(ptr))) {
-    retval = -1;
+    retval = IMGERR_CODEC;
     goto cleanup;
   }
 
   /* Prepare to read */
-  png_init_io(ptr, fin);
+  if (NULL != src->fin) {
+    png_init_io(ptr, src->fin);
+  } else {
+    png_set_read_fn(ptr, src, read_mem);
+  }
   png_set_sig_bytes(ptr, 8);
 
-  png_read_png(ptr, info, PNG_TRANSFORM_IDENTITY, NULL);
-  rows = png_get_rows(ptr, info);
+  png_read_info(ptr, info);
   h = png_get_image_height(ptr, info);
   w = png_get_image_width(ptr, info);
+  depth = png_get_bit_depth(ptr, info);
+  pngtype = png_get_color_type(ptr, info);
+
+  /* Have libpng bring every type and depth to 8-bit grey or RGB samples,
+     plus alpha if any, as it decodes each row.  Grey stays one channel,
+     which deint_row copies to all three planes. */
+  if (PNG_COLOR_TYPE_PALETTE == pngtype) {
+    png_set_palette_to_rgb(ptr);
+  } else if ((PNG_COLOR_TYPE_GRAY == pngtype) && (depth < 8)) {
+    png_set_expand_gray_1_2_4_to_8(ptr);
+  }
+  if (16 == depth) {
+    png_set_scale_16(ptr);
+  }
+  /* A transparent color or palette entries become a full alpha channel. */
+  if (png_get_valid(ptr, info, PNG_INFO_tRNS)) {
+    png_set_tRNS_to_alpha(ptr);
+  }
+
+  npass = png_set_interlace_handling(ptr);
+  png_read_update_info(ptr, info);
+  rowbytes = png_get_rowbytes(ptr, info);
   nchan = png_get_channels(ptr, info);
+  alpha = (2 == nchan) || (4 == nchan);
 
-  if ((8 != png_get_bit_depth(ptr, info)) || 
-      ((2 != png_get_color_type(ptr, info) && 
-       (0 != png_get_color_type(ptr,info))))) {
-    printf("PNG: unsupported bit depth %d or color type %d\n",
-           png_get_bit_depth(ptr, info), png_get_color_type(ptr, info));
-    retval = -1;
+  if ((8 != png_get_bit_depth(ptr, info)) || (nchan < 1) || (4 < nchan)) {
+    retval = img_error(IMGERR_UNSUPPORTED,
+                       "PNG: can't convert bit depth %d color type %d",
+                       depth, pngtype);
     goto cleanup;
   }
 
-  retval = alloc_rgbimage(img, w, h);
+  retval = rgbpool_acquire_alpha(pool, img, w, h, alpha);
   CLEANUPONERR;
 
-  if (1 == nchan) {
-	  /* Note this correctly reads 1-channel greyscale, where r == g == b. */
-    for (y=0, xy=0; y<h; y++) {
-      for (x=0; x<w; x++, xy++) {
-        (*img)->r[xy] = rows[y][x];
-        (*img)->g[xy] = rows[y][x];
-        (*img)->b[xy] = rows[y][x];
-      }
+  if (1 == npass) {
+    if (NULL == (row = (png_bytep) ctx_buf(&ctx->row, &ctx->rowsz,
+                                           rowbytes))) {
+      retval = img_error(IMGERR_NOMEM, "can't allocate local row storage");
+      goto cleanup;
     }
-  } else if ((3 == nchan) || (4 == nchan)) {
-    for (y=0, xy=0; y<h; y++) {
-      for (x=0, i=0; x<w; x++, xy++, i+=nchan) {
-        (*img)->r[xy] = rows[y][i];
-        (*img)->g[xy] = rows[y][i+1];
-        (*img)->b[xy] = rows[y][i+2];
-      }
+
+    for (y=0; y<h; y++) {
+      png_read_row(ptr, row, NULL);
+      deint_row(*img, y, row, nchan);
     }
   } else {
-    printf("PNG: do not support %d channels\n", nchan);
-    retval = -1;
-    goto cleanup;
+    if ((NULL == (row = (png_bytep) ctx_buf(&ctx->row, &ctx->rowsz,
+                                            rowbytes * h))) ||
+        (NULL == (rows = (png_bytep *) ctx_buf(&ctx->rows, &ctx->rowssz,
+                                               h * sizeof(png_bytep))))) {
+      retval = img_error(IMGERR_NOMEM, "can't allocate local image storage");
+      goto cleanup;
+    }
+
+    for (y=0; y<h; y++) {
+      rows[y] = row + (y * rowbytes);
+    }
+    png_read_image(ptr, rows);
+
+    /* The whole image is in hand, so split it on the shared pool, in
+       pieces of at least PNG_PARBYTES. */
+    deint.img = *img;
+    deint.rows = rows;
+    deint.nchan = nchan;
+    thrpool_parfor(thrpool_shared(), 0, h, 1 + (PNG_PARBYTES / rowbytes),
+                   deint_rows, &deint);
   }
 
+  png_read_end(ptr, NULL);
+
   retval = 0;
 
  cleanup:
-  if (NULL != fin) {
-    retval = fclose(fin);
-    if (0 != retval) {
-      errmsg = strerror(errno);
-      printf("problem closing %s: %s\n", fname, errmsg);
-      retval = -1;
-    }
-  }
-
-  /* Note that png_destroy removes all memory allocated for the image, 
-     including rows. */
   if (NULL != ptr) {
     if (NULL != info) {
       png_destroy_read_struct(&ptr, &info, NULL);
@@ -229,114 +1694,274 @@ int PNG_read(const char *fname, _rgbimage **img) {
     }
   }
 
+  /* libpng's blocks and the row buffers stay in a caller's context. */
+  if (&local == ctx) {
+    ctx_clear(ctx);
+  }
+
   return retval;
 }
 
 /***
-    PNG_write:  Copy a image to disk.  See the libpng manpage for the flow
-                here.  Can save both 8-bit and full-color images.
-    args:       fname - name of file to write to, if NULL use stdout
+    PNG_read_pool:  Bring in a PNG image from a file, drawing it from an
+                    image pool.  Regular files are mapped and decoded from
+                    memory; stdin and pipes go through stdio.
+    args:           fname - name of file with image, if NULL take from stdin
+                    img - image read (if non-NULL, old image released to
+                          pool)
+                    pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int PNG_read_pool(const char *fname, _rgbimage **img, rgbpool *pool) {
+
+  return PNG_read_ctx(NULL, fname, img, pool);
+}
+
+/***
+    PNG_read_ctx:  Bring in a PNG image from a file with a codec context
+                   kept from earlier images, drawing it from an image pool.
+    args:          ctx - codec context, NULL to use a fresh one
+                   fname - name of file with image, if NULL take from stdin
+                   img - image read (if non-NULL, old image released to
+                         pool)
+                   pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
+***/
+int PNG_read_ctx(pngctx *ctx, const char *fname, _rgbimage **img,
+                 rgbpool *pool) {
+  imginput in;                          /* file to read */
+  int retval;
+
+  retval = imginput_open(&in, fname);
+  RETONERR;
+
+  retval = PNG_read_input(ctx, fname, &in, img, pool);
+
+  if (imginput_close(&in, fname) < 0) {
+    retval = img_errcode();
+  }
+
+  return retval;
+}
+
+/***
+    PNG_read_input:  Bring in a PNG image from an input that is already
+                     open, so a caller that has looked at the first bytes
+                     to pick the format needn't open the file again.  A
+                     stream must still be at its start.
+    args:            ctx - codec context, NULL to use a fresh one
+                     fname - name of file, for messages
+                     in - open input to read (from imginput_open)
+                     img - image read (if non-NULL, old image released to
+                           pool)
+                     pool - image pool, NULL to allocate a new image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx, img
+***/
+int PNG_read_input(pngctx *ctx, const char *fname, imginput *in,
+                   _rgbimage **img, rgbpool *pool) {
+  pngsrc src;                           /* how read_png sees it */
+
+  src.fin = in->fin;
+  src.buf = in->buf;
+  src.nbuf = in->nbuf;
+  src.pos = 0;
+  return read_png(ctx, fname, &src, img, pool);
+}
+
+/***
+    PNG_read_mem:  Bring in a PNG image already in memory, feeding it to
+                   libpng with our own read function, so it needn't be
+                   written out to a file.
+    args:          buf - encoded image
+                   nbuf - number of bytes in buf
+                   img - image read (if non-NULL, will free old image)
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+int PNG_read_mem(const uchar *buf, size_t nbuf, _rgbimage **img) {
+  pngsrc src;                           /* buffer to read */
+
+  if (NULL == buf) {
+    return img_error(IMGERR_ARG, "no PNG data to read");
+  }
+
+  src.fin = NULL;
+  src.buf = buf;
+  src.nbuf = nbuf;
+  src.pos = 0;
+  return read_png(NULL, "PNG buffer", &src, img, NULL);
+}
+
+/***
+    write_png:  Encode an image as PNG.  See the libpng manpage for the
+                flow here.  Can save 8-bit, full-color, and full-color
+                with alpha images.  How rows are prepared is decided once
+                per image: a full-color row is interleaved from the planes
+                with kern_int3 (kern_int4 with alpha) into a scratch row,
+                while a single plane's rows are already in the
+                output layout and are handed to libpng as they are.  If
+                PNG_setparwrite has turned it on, an image of several
+                strips goes to write_png_par instead when the shared pool
+                has more than one thread.
+    args:       ctx - codec context to allocate from and keep buffers in,
+                      NULL to set one up and clear it for just this image
+                dst - file or buffer to write to
                 img - image to save
                 plane - which data to store
+                opts - how to compress, NULL for libpng's defaults
     returns:   0 if successful
                < 0 on failure (value depends on error)
+    modifies:  ctx, dst
 ***/
-int PNG_write(const char *fname, _rgbimage *img, enum clrplane plane) {
-  FILE *fout;                           /* file handle to write to */
+static int write_png(pngctx *ctx, pngdst *dst, _rgbimage *img,
+                     enum clrplane plane, const pngopts *opts) {
+  pngctx local;                         /* context if the caller has none */
   png_structp ptr;                      /* internal reference to PNG data */
   png_infop info;                       /* picture information */
-  png_byte *row;                        /* copy of image row to write */
-  char *errmsg;                         /* error message */
-  int nbyte;                            /* number bytes per pixel */
+  png_byte *row;                        /* interleaved row to write */
+  uchar *src;                           /* plane to write, NULL if RGB(A) */
+  thrpool *pool;                        /* threads to deflate strips on */
+  size_t xy;                            /* index of row start */
+  size_t flen;                          /* bytes in a filtered row */
+  int rowsper;                          /* rows in a strip */
   int pngtype;                          /* color type for PNG */
-  int x, y, xy;                         /* pixel coordinates/index */
-  int i;
+  int nchan;                            /* channels per pixel */
+  int y;                                /* row */
   int retval;
 
-  fout = NULL;
+  if (NULL == opts) {
+    opts = &defopts;
+  }
+  if ((opts->level < Z_DEFAULT_COMPRESSION) || (9 < opts->level)) {
+    return img_error(IMGERR_ARG, "PNG compression level %d not -1 to 9",
+                     opts->level);
+  }
+  if ((opts->strategy < PNGZ_DEFAULT) || (PNGZ_HUFFMAN < opts->strategy)) {
+    return img_error(IMGERR_ARG, "illegal PNG strategy %d", opts->strategy);
+  }
+  if ((0 == opts->filters) || (0 != (opts->filters & ~PNGF_ALL))) {
+    return img_error(IMGERR_ARG, "illegal PNG filter set 0x%x",
+                     opts->filters);
+  }
+
+  if (NULL == ctx) {
+    memset(&local, 0, sizeof(local));
+    ctx = &local;
+  }
+  ptr = NULL;
+  info = NULL;
   row = NULL;
 
+  nchan = 1;
   switch (plane) {
   case CLR_RGB:
-    nbyte = 3;
+    src = NULL;
+    nchan = 3;
     pngtype = PNG_COLOR_TYPE_RGB;
     break;
+  case CLR_RGBA:
+    if (NULL == img->a) {
+      return img_error(IMGERR_ARG, "can't write RGBA PNG without alpha");
+    }
+    src = NULL;
+    nchan = 4;
+    pngtype = PNG_COLOR_TYPE_RGB_ALPHA;
+    break;
   case CLR_GREY:
   case CLR_R:
+    src = img->r;
+    pngtype = PNG_COLOR_TYPE_GRAY;
+    break;
   case CLR_G:
+    src = img->g;
+    pngtype = PNG_COLOR_TYPE_GRAY;
+    break;
   case CLR_B:
-    nbyte = 1;
+    src = img->b;
     pngtype = PNG_COLOR_TYPE_GRAY;
     break;
   default:
-    printf("illegal color plane %d\n", plane);
-    return -1;
+    return img_error(IMGERR_ARG, "illegal color plane %d", plane);
   }
 
-  if (NULL == fname) {
-    fout = stdout;
-  } else {
-    /* For Windows, "wb". */
-    fout = fopen(fname, "w");
-    if (NULL == fout) {
-      errmsg = strerror(errno);
-      printf("can't open file %s to write: %s\n", fname, errmsg);
-      return -1;
-    }
+  if ((NULL == src) && (CSP_RGB != img->cspace)) {
+    return img_error(IMGERR_ARG,
+                     "can't write full-color PNG from YCbCr planes");
+  }
+
+  /* If asked, and with threads to spare, an image of more than one
+     strip is deflated in parallel. */
+  pool = thrpool_shared();
+  flen = (nchan * (size_t) img->ncol) + 1;
+  rowsper = (flen < PNG_PARSTRIP) ? (int) (PNG_PARSTRIP / flen) : 1;
+  if (atomic_load(&parwrite) && (1 < thrpool_size(pool)) &&
+      (rowsper < img->nrow)) {
+    retval = write_png_par(ctx, dst, img, src, nchan, pool, rowsper, opts);
+    goto cleanup;
   }
 
-  if (NULL == 
-      (row = (png_byte *) calloc(nbyte * img->ncol, sizeof(png_byte)))) {
-    printf("can't allocate local row storage\n");
-    retval = -1;
+  if ((NULL == src) &&
+      (NULL == (row = (png_byte *) ctx_buf(&ctx->row, &ctx->rowsz,
+                                           flen - 1)))) {
+    retval = img_error(IMGERR_NOMEM, "can't allocate local row storage");
     goto cleanup;
   }
 
-  ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, NULL, png_errfn,
+                                  png_warnfn, ctx, ctx_malloc, ctx_free);
   if (NULL == ptr) {
-    printf("could not prepare PNG for write\n");
-    retval = -1;
+    retval = img_error(IMGERR_NOMEM, "could not prepare PNG for write");
     goto cleanup;
   }
 
   info = png_create_info_struct(ptr);
   if (NULL == info) {
-    printf("could not prepare PNG info\n");
-    retval = -1;
+    retval = img_error(IMGERR_NOMEM, "could not prepare PNG info");
     goto cleanup;
   }
     
   if (setjmp(png_jmpbuf(ptr))) {
-    retval = -1;
+    retval = IMGERR_CODEC;
     goto cleanup;
   }
 
   /* Prepare to write. */
-  png_init_io(ptr, fout);
+  if (NULL != dst->fout) {
+    png_init_io(ptr, dst->fout);
+  } else {
+    png_set_write_fn(ptr, dst, write_mem, flush_mem);
+  }
   png_set_IHDR(ptr, info, img->ncol, img->nrow, 8, pngtype,
                PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, 
                PNG_FILTER_TYPE_DEFAULT);
+  png_set_compression_level(ptr, opts->level);
+  png_set_compression_strategy(ptr, zstrategy[opts->strategy]);
+  /* libpng's filter bits are ours, shifted up. */
+  png_set_filter(ptr, PNG_FILTER_TYPE_BASE, opts->filters << 3);
   png_write_info(ptr, info);
 
-  for (y=0, xy=0; y<img->nrow; y++) {
-    for (x=0, i=0; x<img->ncol; x++, xy++, i+=nbyte) {
-      if (CLR_RGB == plane) {
-        row[i] = img->r[xy];
-        row[i+1] = img->g[xy];
-        row[i+2] = img->b[xy];
-      } else if ((CLR_GREY == plane) || (CLR_R == plane)) {
-        row[i] = img->r[xy];
-      } else if (CLR_G == plane) {
-        row[i] = img->g[xy];
-      } else if (CLR_B == plane) {
-        row[i] = img->b[xy];
-      } else {
-        printf("illegal color plane %d\n", plane);
-        retval = -1;
-        goto cleanup;
-      }
+  if (4 == nchan) {
+    for (y=0, xy=0; y<img->nrow; y++, xy+=img->stride) {
+      kern_int4(img->r + xy, img->g + xy, img->b + xy, img->a + xy, row,
+                img->ncol);
+      png_write_row(ptr, row);
+    }
+  } else if (NULL == src) {
+    for (y=0, xy=0; y<img->nrow; y++, xy+=img->stride) {
+      kern_int3(img->r + xy, img->g + xy, img->b + xy, row, img->ncol);
+      png_write_row(ptr, row);
+    }
+  } else {
+    for (y=0, xy=0; y<img->nrow; y++, xy+=img->stride) {
+      png_write_row(ptr, src + xy);
     }
-    png_write_row(ptr, row);
   }
 
   png_write_end(ptr, info);
@@ -344,19 +1969,6 @@ int PNG_write(const char *fname, _rgbimage *img, enum clrplane plane) {
   retval = 0;
 
  cleanup:
-  if (row) {
-    free(row);
-  }
-
-  if (NULL != fout) {
-    retval = fclose(fout);
-    if (0 != retval) {
-      errmsg = strerror(errno);
-      printf("problem closing %s: %s\n", fname, errmsg);
-      retval = -1;
-    }
-  }
-
   if (NULL != ptr) {
     if (NULL != info) {
       png_destroy_write_struct(&ptr, &info);
@@ -365,136 +1977,244 @@ int PNG_write(const char *fname, _rgbimage *img, enum clrplane plane) {
     }
   }
 
+  /* libpng's blocks, the row buffer, and the strip slots stay in a
+     caller's context. */
+  if (&local == ctx) {
+    ctx_clear(ctx);
+  }
 
   return retval;
 }
 
+/***
+    PNG_write:  Copy a image to disk.
+    args:       fname - name of file to write to, if NULL use stdout
+                img - image to save
+                plane - which data to store
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+***/
+int PNG_write(const char *fname, _rgbimage *img, enum clrplane plane) {
 
-
-/**** rgbimage Support ****/
+  return PNG_write_ctx(NULL, fname, img, plane);
+}
 
 /***
-    alloc_rgbimage:  Reserve memory for our internal storage of a color image.
-                     Pixels arrays are zeroed.  The ncol, nrow, and npix
-                     fields are filled in.
-    args:            img - structure to set up (first freed if non-NULL)
-                     ncol, nrow - size of image
+    PNG_write_ctx:  Copy an image to disk with a codec context kept from
+                    earlier images.
+    args:           ctx - codec context, NULL to use a fresh one
+                    fname - name of file to write to, if NULL use stdout
+                    img - image to save
+                    plane - which data to store
     returns:   0 if successful
                < 0 on failure (value depends on error)
-    modifies:  img
+    modifies:  ctx
 ***/
-int alloc_rgbimage(_rgbimage **img, int ncol, int nrow) {
+int PNG_write_ctx(pngctx *ctx, const char *fname, _rgbimage *img,
+                  enum clrplane plane) {
+
+  return PNG_write_opts(ctx, fname, img, plane, NULL);
+}
 
-  /* The 'free if non-NULL' means we don't try to resize the image, just
-     start from scratch. */
-  free_rgbimage(img);
+/***
+    PNG_write_opts:  Copy an image to disk, compressing it as asked.
+    args:            ctx - codec context, NULL to use a fresh one
+                     fname - name of file to write to, if NULL use stdout
+                     img - image to save
+                     plane - which data to store
+                     opts - how to compress, NULL for the defaults
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  ctx
+***/
+int PNG_write_opts(pngctx *ctx, const char *fname, _rgbimage *img,
+                   enum clrplane plane, const pngopts *opts) {
+  pngdst dst;                           /* file to write */
+  int retval;
 
-  if (NULL == (*img = (_rgbimage *) calloc(1, sizeof(_rgbimage)))) {
-    printf("can't allocate rgb image");
-    return -1;
+  dst.buf = NULL;
+  dst.bufsz = dst.nbuf = 0;
+  if (NULL == fname) {
+    dst.fout = stdout;
+  } else {
+    /* For Windows, "wb". */
+    dst.fout = fopen(fname, "w");
+    if (NULL == dst.fout) {
+      return img_syserror(IMGERR_IO, errno, "can't open file %s to write",
+                          fname);
+    }
   }
 
-  (*img)->ncol = ncol;
-  (*img)->nrow = nrow;
-  (*img)->npix = ncol * nrow;
+  retval = write_png(ctx, &dst, img, plane, opts);
 
-  if (NULL == ((*img)->r = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate red plane");
-    free(*img);
-    *img = NULL;
-    return -1;
+  if (0 != fclose(dst.fout)) {
+    retval = img_syserror(IMGERR_IO, errno, "problem closing %s", fname);
   }
 
-  if (NULL == ((*img)->g = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate green plane");
-    free((*img)->r);
-    free(*img);
-    *img = NULL;
-    return - 1;
-  }
+  return retval;
+}
 
-  if (NULL == ((*img)->b = (uchar *) calloc(ncol * nrow, sizeof(uchar)))) {
-    printf("can't allocate blue plane");
-    free((*img)->g);
-    free((*img)->r);
-    free(*img);
-    *img = NULL;
-    return - 1;
-  }
+/***
+    PNG_write_mem:  Encode an image as PNG into a buffer in memory, for
+                    callers that send the bytes on rather than save them.
+                    The buffer belongs to the caller.  Passing back the
+                    buffer from an earlier call reuses it, growing it (with
+                    realloc) only if the new image doesn't fit.
+    args:           buf - buffer to write into, from malloc, or NULL to
+                          allocate one
+                    bufsz - size of buf, updated if it grows
+                    nbuf - number of bytes of PNG data in buf
+                    img - image to save
+                    plane - which data to store
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  buf, bufsz, nbuf (buf and bufsz are valid even on error)
+***/
+int PNG_write_mem(uchar **buf, size_t *bufsz, size_t *nbuf, _rgbimage *img,
+                  enum clrplane plane) {
 
-  return 0;
+  return PNG_write_mem_opts(buf, bufsz, nbuf, img, plane, NULL);
 }
 
 /***
-    free_rgbimage:  Release the memory stored with an image.
-    args:           img - data structure to free
-    modifies:  img (set to NULL when done)
+    PNG_write_mem_opts:  Encode an image as PNG into a buffer in memory,
+                         compressing it as asked.  The buffer is handled as
+                         by PNG_write_mem.
+    args:                buf - buffer to write into, from malloc, or NULL to
+                               allocate one
+                         bufsz - size of buf, updated if it grows
+                         nbuf - number of bytes of PNG data in buf
+                         img - image to save
+                         plane - which data to store
+                         opts - how to compress, NULL for the defaults
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  buf, bufsz, nbuf (buf and bufsz are valid even on error)
 ***/
-void free_rgbimage(_rgbimage **img) {
+int PNG_write_mem_opts(uchar **buf, size_t *bufsz, size_t *nbuf,
+                       _rgbimage *img, enum clrplane plane,
+                       const pngopts *opts) {
+  pngdst dst;                           /* buffer to write */
+  int retval;
 
-  if (*img) {
-    if ((*img)->r) {
-      free((*img)->r);
-    }
-    if ((*img)->g) {
-      free((*img)->g);
-    }
-    if ((*img)->b) {
-      free((*img)->b);
-    }
-    free(*img);
-    *img = NULL;
-  }
+  dst.fout = NULL;
+  dst.buf = *buf;
+  dst.bufsz = (NULL == *buf) ? 0 : *bufsz;
+  dst.nbuf = 0;
+
+  retval = write_png(NULL, &dst, img, plane, opts);
+
+  *buf = dst.buf;
+  *bufsz = dst.bufsz;
+  *nbuf = (retval < 0) ? 0 : dst.nbuf;
+
+  return retval;
+}
+
+/***
+    PNG_setpipeline:  Turn the pipelined decode on or off for every thread.
+                      When on, a large 8-bit PNG that isn't interlaced and
+                      is read from memory (a mapped file or PNG_read_mem)
+                      is inflated on a thread of its own while the reading
+                      thread unfilters it.  This cuts the time to decode
+                      one image when a core is spare, but a core is busy
+                      with each image, so leave it off when decoding many
+                      images at once.
+    args:             on - true to pipeline large images, 0 to not
+    returns:   the previous setting
+***/
+int PNG_setpipeline(int on) {
+
+  return atomic_exchange(&pipeline, (0 != on));
+}
+
+/***
+    PNG_setparwrite:  Turn the parallel writer on or off for every thread.
+                      When on, an image of more than one strip
+                      (PNG_PARSTRIP bytes of filtered rows) is filtered and
+                      deflated a strip per task on the shared pool, if it
+                      has more than one thread.  The strips' IDAT chunks
+                      and sync flushes make a file that differs in its
+                      bytes, and is a little larger, than libpng's, so with
+                      this on the bytes written depend on the pool's size.
+                      The pixels decoded are the same either way.
+    args:             on - true to write large images in parallel, 0 to
+                           always use libpng
+    returns:   the previous setting
+***/
+int PNG_setparwrite(int on) {
+
+  return atomic_exchange(&parwrite, (0 != on));
 }
 
 /***
-    read_rgb:  Get a pixel from the image.
-    args:      img - image
-               x, y - coordinates of pixel to read
-               r, g, b - color planes (all equal if greyscale image)
+    PNG_opts_preset:  Fill in compression options from a preset.  The
+                      default matches libpng's.  Fast is for scratch files
+                      read back soon: one cheap filter and run-length
+                      matching, several times quicker to write and a
+                      fraction larger.  Small tries every filter at the
+                      highest level, for files kept a long time.
+    args:             opts - options to set
+                      preset - PNGP_* which preset
     returns:   0 if successful
                < 0 on failure (value depends on error)
-    modifies:  r, g, b
+    modifies:  opts
 ***/
-int read_rgb(_rgbimage *img, int x, int y, uchar *r, uchar *g, uchar *b) {
-  int xy;                               /* pixel index */
-  
-  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
-    printf("pixel %d,%4d is OOB (image size %d x %4d)\n", x,y, 
-           img->ncol,img->nrow);
-    return -1;
-  }
+int PNG_opts_preset(pngopts *opts, enum pngpreset preset) {
 
-  xy = (y * img->ncol) + x;
-  *r = img->r[xy];
-  *g = img->g[xy];
-  *b = img->b[xy];
+  switch (preset) {
+  case PNGP_DEFAULT:
+    *opts = defopts;
+    break;
+  case PNGP_FAST:
+    opts->level = 1;
+    opts->strategy = PNGZ_RLE;
+    opts->filters = PNGF_SUB;
+    break;
+  case PNGP_SMALL:
+    opts->level = 9;
+    opts->strategy = PNGZ_FILTERED;
+    opts->filters = PNGF_ALL;
+    break;
+  default:
+    return img_error(IMGERR_ARG, "illegal PNG preset %d", preset);
+  }
 
   return 0;
 }
 
 /***
-    write_rgb:  Change a pixel in the image.
-    args:       img - image
-                x, y - coordinates of pixel to write to
-                r, g, b - color planes
+    PNG_ctx_create:  Make an empty codec context.  It fills with libpng's
+                     and zlib's blocks and our row buffers as it is used.
+                     A context may only be used by one thread at a time;
+                     give each thread its own.
+    args:            ctx - context to create
     returns:   0 if successful
                < 0 on failure (value depends on error)
-    modifies:  img
+    modifies:  ctx
 ***/
-int write_rgb(_rgbimage *img, int x, int y, uchar r, uchar g, uchar b) {
-  int xy;                               /* pixel index */
-  
-  if ((x < 0) || (y < 0) || (img->ncol <= x) || (img->nrow <= y)) {
-    printf("pixel %d,%4d is OOB (image size %d x %4d)\n", x,y, 
-           img->ncol,img->nrow);
-    return -1;
-  }
+int PNG_ctx_create(pngctx **ctx) {
 
-  xy = (y * img->ncol) + x;
-  img->r[xy] = r;
-  img->g[xy] = g;
-  img->b[xy] = b;
+  if (NULL == (*ctx = (pngctx *) calloc(1, sizeof(**ctx)))) {
+    return img_error(IMGERR_NOMEM, "can't allocate PNG context");
+  }
 
   return 0;
 }
+
+/***
+    PNG_ctx_destroy:  Release a codec context and every block and buffer it
+                      has kept.
+    args:             ctx - context to destroy
+    modifies:  ctx (set to NULL when done)
+***/
+void PNG_ctx_destroy(pngctx **ctx) {
+
+  if (NULL == *ctx) {
+    return;
+  }
+
+  ctx_clear(*ctx);
+  free(*ctx);
+  *ctx = NULL;
+}
@@ -9,14 +9,26 @@
       Public Interface:
         PNG_isa - test if file is in PNG format
         PNG_read - read an image from disk
+        PNG_read_pool - read an image into a block from an image pool
+        PNG_read_input - read an image from an already open input
+        PNG_read_ctx - read an image with a kept codec context
+        PNG_read_mem - read an image from a buffer in memory
         PNG_write - write an image to disk
-        alloc_rgbimage - allocate our internal image storage
-        free_rgbimage - release image memory
-        read_rgb - get a pixel in the image
-        write_rgb - set a pixel
+        PNG_write_ctx - write an image with a kept codec context
+        PNG_write_mem - write an image to a buffer in memory
+        PNG_write_opts - write an image to disk with compression options
+        PNG_write_mem_opts - write an image to memory with compression
+                             options
+        PNG_opts_preset - fill in compression options from a preset
+        PNG_setpipeline - decode large images on two threads or one
+        PNG_setparwrite - write large images on the shared pool or not
+        PNG_ctx_create - make a codec context to keep between images
+        PNG_ctx_destroy - release a codec context
+      The image data structure and its support routines (alloc_rgbimage,
+      free_rgbimage, read_rgb, write_rgb) are declared in img_rgb.h.
 
       Required Libraries:
-        libpng
+        libpng, zlib
 
       c 2015-2018 Primordial Machine Vision Systems, Inc.
 *****/
@@ -25,35 +37,55 @@
 #define _IMGPNG 1
 
 
-/*** Data Types ***/
-
-typedef unsigned char uchar;
+#include "img_rgb.h"
+#include "img_rgbpool.h"
+#include "img_input.h"
 
 
 /*** Data Structures ***/
 
-/* a color image with RGB planes stored separately */
-typedef struct __rgbimage {
-  int ncol;                             /* width (number columns) of image */
-  int nrow;                             /* height (number rows) of image */
-  int npix;                             /* number pixels = w * h */
-  uchar *r;                             /* red plane */
-  uchar *g;                             /* green plane */
-  uchar *b;                             /* blue plane */
-} _rgbimage, *rgbimage;
+/* blocks libpng and zlib have freed, our row buffers, and the parallel
+   writer's deflate state, kept between images (private to img_png_v3.c);
+   one per thread */
+typedef struct __pngctx pngctx;
 
+/*
+  PNGZ_DEFAULT: zlib's usual mix of matches and Huffman codes
+  PNGZ_FILTERED: favor Huffman codes over short matches, which suits
+                 filtered rows (libpng's default)
+  PNGZ_RLE: only match the bytes just before, much faster
+  PNGZ_HUFFMAN: no matches at all, Huffman codes only
+*/
+enum pngstrategy {
+  PNGZ_DEFAULT = 0, PNGZ_FILTERED = 1, PNGZ_RLE = 2, PNGZ_HUFFMAN = 3
+};
 
-/*** Constants / Enumerations ***/
+/*
+  PNGF_*: the row filters the encoder may choose from, or'd together; with
+          more than one it picks per row as libpng does
+*/
+enum pngfilter {
+  PNGF_NONE = 0x01, PNGF_SUB = 0x02, PNGF_UP = 0x04, PNGF_AVG = 0x08,
+  PNGF_PAETH = 0x10, PNGF_ALL = 0x1f
+};
 
 /*
-  CLR_GREY: save an 8-bit PNG image, assumes r, g, and b planes have same value
-  CLR_RGB:  save a full-color PNG image
-  CLR_[RGB]: save an 8-bit PNG image using one of the planes
+  PNGP_DEFAULT: libpng's defaults
+  PNGP_FAST: quickest to write, for scratch files
+  PNGP_SMALL: smallest output, for archiving
 */
-enum clrplane {
-  CLR_GREY = 0x10, CLR_RGB = 0x01, CLR_R = 0x12, CLR_G = 0x14, CLR_B = 0x18
+enum pngpreset {
+  PNGP_DEFAULT = 0, PNGP_FAST = 1, PNGP_SMALL = 2
 };
 
+/* how an image is compressed */
+typedef struct {
+  int level;                            /* zlib level, 0 (none) to 9
+                                           (smallest), or -1 (default 6) */
+  int strategy;                         /* PNGZ_* */
+  int filters;                          /* PNGF_* allowed, or'd */
+} pngopts;
+
 
 /*** External Functions ***/
 
@@ -62,7 +94,9 @@ enum clrplane {
 */
 extern int PNG_isa(const char *);
 
-/* read a PNG image, converting it to an rgbimage
+/* read a PNG image, converting it to an rgbimage; if the file has alpha
+   or a transparent color the image has an alpha plane (img->a, straight
+   rather than premultiplied), else img->a is NULL
      fname - name of file to read (if NULL, use stdin)
      img - pointer to image to create and read (frees old if non-NULL)
    returns < 0 on error
@@ -70,41 +104,143 @@ extern int PNG_isa(const char *);
 */
 extern int PNG_read(const char *, _rgbimage **);
 
+/* read a PNG image into an image from a pool, converting it to an rgbimage
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as PNG_read)
+   returns < 0 on error
+   modifies img
+*/
+extern int PNG_read_pool(const char *, _rgbimage **, rgbpool *);
+
+/* read a PNG image with a codec context kept from earlier images, into an
+   image from a pool
+     ctx - context to decode with (if NULL, use a fresh one as PNG_read)
+     fname - name of file to read (if NULL, use stdin)
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as PNG_read)
+   returns < 0 on error
+   modifies ctx, img
+*/
+extern int PNG_read_ctx(pngctx *, const char *, _rgbimage **, rgbpool *);
+
+/* read a PNG image from an input already opened with imginput_open (a
+   stream must not have been read from yet)
+     ctx - context to decode with (if NULL, use a fresh one)
+     fname - name of file, for messages
+     in - input to read
+     img - pointer to image to create and read (releases old to pool)
+     pool - pool to draw the image from (if NULL, allocate as PNG_read)
+   returns < 0 on error
+   modifies img
+*/
+extern int PNG_read_input(pngctx *, const char *, imginput *, _rgbimage **,
+                          rgbpool *);
+
+/* read a PNG image held in memory, converting it to an rgbimage
+     buf - encoded image
+     nbuf - number of bytes in buf
+     img - pointer to image to create and read (frees old if non-NULL)
+   returns < 0 on error
+   modifies img
+*/
+extern int PNG_read_mem(const uchar *, size_t, _rgbimage **);
+
 /* write an rgbimage to disk in PNG format
      fname - name of file to write to (if NULL, use stdout)
      img - image to write
-     clrplane - CLR_* which plane to write
+     clrplane - CLR_* which plane to write (CLR_RGBA needs img->a)
    returns < 0 on error
 */
 extern int PNG_write(const char *, _rgbimage *, enum clrplane);
 
-/* allocate an image in our format, initializing contents to 0
-     img - image to create (frees old if non-NULL)
-     ncol, nrow - size of image
+/* write an rgbimage to disk in PNG format with a codec context kept from
+   earlier images
+     ctx - context to encode with (if NULL, use a fresh one)
+     fname - name of file to write to (if NULL, use stdout)
+     img - image to write
+     clrplane - CLR_* which plane to write
    returns < 0 on error
-   modifies img
+   modifies ctx
 */
-extern int alloc_rgbimage(_rgbimage **, int, int);
+extern int PNG_write_ctx(pngctx *, const char *, _rgbimage *, enum clrplane);
 
-/* release memory for an image
-     img - image to free
-   modifies img (set to NULL when done)
+/* encode an rgbimage in PNG format into a buffer in memory, which the
+   caller owns and frees; pass back the same buffer to reuse it
+     buf - buffer from malloc, or NULL to allocate one (grown as needed)
+     bufsz - size of buf (updated)
+     nbuf - bytes of PNG data written to buf
+     img - image to write
+     clrplane - CLR_* which plane to write
+   returns < 0 on error
+   modifies buf, bufsz, nbuf
 */
-extern void free_rgbimage(_rgbimage **);
+extern int PNG_write_mem(uchar **, size_t *, size_t *, _rgbimage *,
+                         enum clrplane);
 
-/* get pixel's RGB values
-     img - image
-     x, y - pixel coordinates
-     r, g, b - color planes (all modified)
+/* write an rgbimage to disk in PNG format, compressed as asked
+     ctx - context to encode with (if NULL, use a fresh one)
+     fname - name of file to write to (if NULL, use stdout)
+     img - image to write
+     clrplane - CLR_* which plane to write
+     opts - how to compress (if NULL, libpng's defaults)
+   returns < 0 on error
+   modifies ctx
+*/
+extern int PNG_write_opts(pngctx *, const char *, _rgbimage *, enum clrplane,
+                          const pngopts *);
+
+/* encode an rgbimage in PNG format into a buffer in memory, compressed as
+   asked; the buffer is handled as by PNG_write_mem
+     buf - buffer from malloc, or NULL to allocate one (grown as needed)
+     bufsz - size of buf (updated)
+     nbuf - bytes of PNG data written to buf
+     img - image to write
+     clrplane - CLR_* which plane to write
+     opts - how to compress (if NULL, libpng's defaults)
+   returns < 0 on error
+   modifies buf, bufsz, nbuf
+*/
+extern int PNG_write_mem_opts(uchar **, size_t *, size_t *, _rgbimage *,
+                              enum clrplane, const pngopts *);
+
+/* fill in compression options from a preset
+     opts - options to set
+     preset - PNGP_* which preset
+   returns < 0 on error
+   modifies opts
+*/
+extern int PNG_opts_preset(pngopts *, enum pngpreset);
+
+/* decode large, plain PNGs held in memory (including mapped files) with
+   inflating on a thread of its own, for all threads; off to start
+     on - true to pipeline, 0 to decode on the reading thread only
+   returns the previous setting
+*/
+extern int PNG_setpipeline(int);
+
+/* encode large images (over a 1 MB strip of rows) in strips on the shared
+   thread pool, for all threads; off to start.  The file written then
+   depends on the pool's size: libpng writes it with one thread, and the
+   strips with more give different bytes, though the same pixels.
+     on - true to write in parallel, 0 to always use libpng
+   returns the previous setting
+*/
+extern int PNG_setparwrite(int);
+
+/* make an empty codec context, which keeps the memory libpng and zlib use
+   and our row buffers between images; use one per thread
+     ctx - context to create
+   returns < 0 on error
+   modifies ctx
 */
-extern int read_rgb(_rgbimage *, int, int, uchar *, uchar *, uchar *);
+extern int PNG_ctx_create(pngctx **);
 
-/* change a pixel's RGB values
-     img - image
-     x, y - pixel coordinates
-     r, g, b - color values
+/* release a codec context
+     ctx - context to destroy
+   modifies ctx (set to NULL when done)
 */
-extern int write_rgb(_rgbimage *, int, int, uchar, uchar, uchar);
+extern void PNG_ctx_destroy(pngctx **);
 
 
 #endif   /* _IMGPNG */
@@ -12,6 +12,7 @@
             --outname=<file>   file to write to
             --x=<#>            x coordinate of pixel to print
             --y=<#>            y coordinate of pixel to print
+            --compress=<how>   default, fast, or small PNG output
 
         c 2015-2018 Primordial Machine Vision Systems
 *****/
@@ -23,41 +24,88 @@ config const inname : string;           /* name of file to read */
 config const outname : string;          /* file to create with modded pixel */
 config const x : c_int = -1;            /* pixel to change */
 config const y : c_int = -1;            /* pixel to change */
+config const compress = "default";      /* PNG compression preset */
 
 /* The C image data structure. */
 extern class rgbimage {
   var ncol : c_int;                     /* width (columns) of image */
   var nrow : c_int;                     /* height (rows) of image */
   var npix : c_int;                     /* number pixels = w * h */
+  var stride : c_int;                   /* bytes between rows, >= ncol */
   var r : c_ptr(c_uchar);               /* red plane */
   var g : c_ptr(c_uchar);               /* green plane */
   var b : c_ptr(c_uchar);               /* blue plane */
+  var a : c_ptr(c_uchar);               /* alpha plane, nil if none */
 }
 
 /* Can't import an enum directly from C; need to grab each component. */
 extern const CLR_GREY : int(32);
 extern const CLR_RGB : int(32);
+extern const CLR_RGBA : int(32);
 extern const CLR_R : int(32);
 extern const CLR_G : int(32);
 extern const CLR_B : int(32);
+extern const PNGP_DEFAULT : int(32);
+extern const PNGP_FAST : int(32);
+extern const PNGP_SMALL : int(32);
+
+/* How PNG_write_opts compresses, set with PNG_opts_preset. */
+extern record pngopts {
+  var level : c_int;                    /* zlib level, -1 to 9 */
+  var strategy : c_int;                 /* PNGZ_* */
+  var filters : c_int;                  /* PNGF_* allowed, or'd */
+}
 
 /* Our variables */
 var rgb : rgbimage;                     /* the image we read */
 var xy : int(32);                       /* 1D index of x, y coord */
+var opts : pngopts;                     /* how to compress output */
+var preset : c_int;                     /* PNGP_* for --compress */
+var plane : c_int;                      /* CLR_* to write */
 var retval : c_int;                     /* return value with error code */
 
 /* External img_png linkage. */
 extern proc PNG_read(fname : c_string, ref img : rgbimage) : c_int;
+extern proc PNG_read_mem(buf : c_ptr(c_uchar), nbuf : size_t,
+                          ref img : rgbimage) : c_int;
 extern proc PNG_write(fname : c_string, img : rgbimage, plane : c_int) : c_int;
+extern proc PNG_write_mem(ref buf : c_ptr(c_uchar), ref bufsz : size_t,
+                          ref nbuf : size_t, img : rgbimage,
+                          plane : c_int) : c_int;
+extern proc PNG_write_opts(ctx : c_void_ptr, fname : c_string,
+                           img : rgbimage, plane : c_int,
+                           ref opts : pngopts) : c_int;
+extern proc PNG_opts_preset(ref opts : pngopts, preset : c_int) : c_int;
 extern proc free_rgbimage(ref img : rgbimage) : void;
-extern proc PNG_isa(fname : c_string) : c_int;
 /* The rest of the interface we don't use now. */
 /*
+extern proc PNG_isa(fname : c_string) : c_int;
 extern proc alloc_rgbimage(ref img : rgbimage, 
                            ncol : c_int, nrow : c_int) : c_int;
 extern proc read_rgb(img : rgbimage, x, y : c_int, 
                      ref r, ref g, ref b : c_uchar) : c_int;
 extern proc write_rgb(img : rgbimage, x, y : c_int, r, g, b : c_uchar) : c_int;
+extern proc PNG_write_mem_opts(ref buf : c_ptr(c_uchar), ref bufsz : size_t,
+                               ref nbuf : size_t, img : rgbimage,
+                               plane : c_int, ref opts : pngopts) : c_int;
+/* Call with 1 before decoding inside a forall, so the library's kernels
+   don't start threads of their own on cores the forall already uses. */
+extern proc thrpool_setshared(nthread : c_int) : c_int;
+/* Call with 1 to decode one large image on two threads, inflating on a
+   thread of its own; leave off when decoding many at once. */
+extern proc PNG_setpipeline(on : c_int) : c_int;
+/* Call with 1 to deflate large images in strips on the shared pool; the
+   file's bytes then depend on the pool's size, its pixels don't. */
+extern proc PNG_setparwrite(on : c_int) : c_int;
+/* Overlays: premultiply each row of the overlay, composite it over the
+   frame's rows (da nil if the frame is opaque), then unpremultiply the
+   frame if it has alpha, all on the planes. */
+extern proc kern_premul(r, g, b : c_ptr(c_uchar), a : c_ptr(c_uchar),
+                        n : c_int) : void;
+extern proc kern_unpremul(r, g, b : c_ptr(c_uchar), a : c_ptr(c_uchar),
+                          n : c_int) : void;
+extern proc kern_over(sr, sg, sb, sa : c_ptr(c_uchar),
+                      dr, dg, db, da : c_ptr(c_uchar), n : c_int) : void;
 */
 
 
@@ -107,11 +155,17 @@ if (y < 0) then
   usage("missing --y or value < 0");
 if ("" == inname) then
   usage("missing --inname");
-if (!PNG_isa(inname.c_str())) then
-  usage("input file not a PNG picture");
 if ("" == outname) then
   usage("missing --outname");
+select compress {
+  when "default" do preset = PNGP_DEFAULT;
+  when "fast" do preset = PNGP_FAST;
+  when "small" do preset = PNGP_SMALL;
+  otherwise do usage("--compress must be default, fast, or small");
+}
 
+/* The reader checks the signature itself, so there's no need to open the
+   file first with PNG_isa. */
 retval = PNG_read(inname.c_str(), rgb);
 end_onerr(retval, rgb);
 
@@ -124,8 +178,9 @@ if (rgb.nrow <= y) {
   usage("--y (0-based) >= image height");
 }
 
-/* Now we can access the fields directly. */
-xy = (y * rgb.ncol) + x;
+/* Now we can access the fields directly.  Rows may be padded, so step
+   by the stride, not the width. */
+xy = (y * rgb.stride) + x;
 writef("\nRead %4i x %4i PNG image\n", rgb.ncol, rgb.nrow);
 writef("At %4i,%4i      R %3u  G %3u  B %3u\n\n", x,y, 
        rgb.r(xy), rgb.g(xy), rgb.b(xy));
@@ -134,7 +189,11 @@ rgb.r(xy) = 1;
 rgb.g(xy) = 2;
 rgb.b(xy) = 3;
 
-retval = PNG_write(outname.c_str(), rgb, CLR_RGB);
+retval = PNG_opts_preset(opts, preset);
+end_onerr(retval, rgb);
+/* Keep the alpha plane if the file had one. */
+plane = if (rgb.a == nil) then CLR_RGB else CLR_RGBA;
+retval = PNG_write_opts(c_nil, outname.c_str(), rgb, plane, opts);
 end_onerr(retval, rgb);
 
 free_rgbimage(rgb);
@@ -0,0 +1,511 @@
+
+/*****
+      test_png_par.c -
+      Round-trip test for the PNG writer, in particular the parallel one
+      used when turned on (PNG_setparwrite), the shared thread pool has
+      more than one thread, and the image is over a strip (PNG_PARSTRIP)
+      of filtered rows.  Writes test images into memory as RGB, RGBA, and
+      grey with every compression level, strategy, and filter set on four
+      threads, and with the defaults on one thread (libpng's writer) and
+      two, then reads each back with libpng itself and compares it to the
+      planes written.  Every setting is then written again through one
+      codec context, which keeps the strips' deflate state, and must give
+      the same bytes as without one; and with the parallel writer off,
+      four threads must give libpng's bytes.  The pool size is set here,
+      so the parallel writer runs even on a single core.  Prints a line
+      per check and exits with 1 if anything failed.
+
+      Call:
+        test_png_par
+
+      @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <png.h>
+
+#include "img_png_v3.h"
+#include "img_thread.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+/***
+    NOPTS:  Number of compression settings tried, in opts_list.
+***/
+#define NOPTS        25
+
+
+/**** Data ****/
+
+/* planes to write, and the names to print for them */
+static const enum clrplane planes[] = { CLR_RGB, CLR_RGBA, CLR_GREY };
+static const char *planenm[] = { "RGB", "RGBA", "grey" };
+
+/* filter sets tried, each filter alone and mixes */
+static const int filtsets[] = {
+  PNGF_NONE, PNGF_SUB, PNGF_UP, PNGF_AVG, PNGF_PAETH,
+  PNGF_SUB | PNGF_PAETH, PNGF_NONE | PNGF_UP | PNGF_AVG, PNGF_ALL
+};
+
+
+/**** Program ****/
+
+/***
+    opts_list:  Fill in the compression settings to try: each level with
+                the default strategy and filters, each strategy, each
+                filter set, and the fast and small presets.
+    args:       opts - settings, NOPTS of them
+***/
+static void opts_list(pngopts *opts) {
+  pngopts def;                          /* default settings */
+  int n;                                /* settings filled in */
+  int i;
+
+  (void) PNG_opts_preset(&def, PNGP_DEFAULT);
+  n = 0;
+
+  for (i=-1; i<=9; i++, n++) {
+    opts[n] = def;
+    opts[n].level = i;
+  }
+  for (i=PNGZ_DEFAULT; i<=PNGZ_HUFFMAN; i++, n++) {
+    opts[n] = def;
+    opts[n].strategy = i;
+  }
+  for (i=0; i<(int) (sizeof(filtsets) / sizeof(filtsets[0])); i++, n++) {
+    opts[n] = def;
+    opts[n].filters = filtsets[i];
+  }
+  (void) PNG_opts_preset(&opts[n++], PNGP_FAST);
+  (void) PNG_opts_preset(&opts[n++], PNGP_SMALL);
+}
+
+/***
+    make_image:  Allocate an image with an alpha plane and padded rows, and
+                 fill it with smooth ramps and some noise, so every filter
+                 has something to do.
+    args:        img - image to make
+                 ncol, nrow - size of image
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int make_image(_rgbimage **img, int ncol, int nrow) {
+  unsigned int seed;                    /* noise generator state */
+  size_t xy;                            /* index of pixel */
+  int x, y;                             /* pixel coordinates */
+  int retval;
+
+  retval = alloc_rgbimage_mode(img, ncol, nrow, ALLOC_ALIGNED | ALLOC_ALPHA);
+  if (retval < 0) {
+    return retval;
+  }
+
+  seed = 12345;
+  for (y=0; y<nrow; y++) {
+    xy = (size_t) y * (*img)->stride;
+    for (x=0; x<ncol; x++, xy++) {
+      seed = (seed * 1103515245) + 12345;
+      (*img)->r[xy] = (uchar) (x + y);
+      (*img)->g[xy] = (uchar) ((x * y) >> 6);
+      (*img)->b[xy] = (uchar) ((y >> 2) + ((seed >> 16) & 0x0f));
+      (*img)->a[xy] = (uchar) ((x ^ y) | 0x80);
+    }
+  }
+
+  return 0;
+}
+
+/***
+    compare:  Check a decoded image against the planes written.
+    args:     img - image written
+              plane - which data was written
+              dec - decoded pixels, interleaved, as many channels as plane
+    returns:   -1 if they match, else the index of the first bad pixel
+***/
+static long compare(_rgbimage *img, enum clrplane plane, const uchar *dec) {
+  const uchar *p;                       /* decoded pixel */
+  size_t xy;                            /* index of pixel in planes */
+  int x, y;                             /* pixel coordinates */
+
+  p = dec;
+  for (y=0; y<img->nrow; y++) {
+    xy = (size_t) y * img->stride;
+    for (x=0; x<img->ncol; x++, xy++) {
+      if (p[0] != img->r[xy]) {
+        return ((long) y * img->ncol) + x;
+      }
+      if (CLR_GREY == plane) {
+        p++;
+        continue;
+      }
+      if ((p[1] != img->g[xy]) || (p[2] != img->b[xy]) ||
+          ((CLR_RGBA == plane) && (p[3] != img->a[xy]))) {
+        return ((long) y * img->ncol) + x;
+      }
+      p += (CLR_RGBA == plane) ? 4 : 3;
+    }
+  }
+
+  return -1;
+}
+
+/***
+    round_trip:  Write an image into memory and read it back with libpng,
+                 checking the pixels survived.
+    args:        img - image to write
+                 plane - which data to write
+                 opts - how to compress
+                 buf - buffer to write into, reused between calls
+                 bufsz - size of buf
+    returns:   0 if the image came back the same, 1 if not
+    modifies:  buf, bufsz
+***/
+static int round_trip(_rgbimage *img, enum clrplane plane,
+                      const pngopts *opts, uchar **buf, size_t *bufsz) {
+  png_image pimg;                       /* libpng's simplified reader */
+  uchar *dec;                           /* decoded pixels */
+  size_t nbuf;                          /* bytes of PNG in buf */
+  long bad;                             /* first pixel that differs */
+  int format;                           /* PNG_FORMAT_* expected */
+  int failed;                           /* true if check failed */
+
+  dec = NULL;
+  failed = 1;
+  if (CLR_RGBA == plane) {
+    format = PNG_FORMAT_RGBA;
+  } else {
+    format = (CLR_RGB == plane) ? PNG_FORMAT_RGB : PNG_FORMAT_GRAY;
+  }
+
+  if (PNG_write_mem_opts(buf, bufsz, &nbuf, img, plane, opts) < 0) {
+    printf("    can't write: %s\n", img_errmsg());
+    return 1;
+  }
+
+  memset(&pimg, 0, sizeof(pimg));
+  pimg.version = PNG_IMAGE_VERSION;
+  if (!png_image_begin_read_from_memory(&pimg, *buf, nbuf)) {
+    printf("    libpng can't read header: %s\n", pimg.message);
+    goto cleanup;
+  }
+  if (((int) pimg.width != img->ncol) || ((int) pimg.height != img->nrow) ||
+      ((int) pimg.format != format)) {
+    printf("    read back %u x %u format 0x%x, wrote %d x %d format 0x%x\n",
+           pimg.width, pimg.height, pimg.format, img->ncol, img->nrow,
+           format);
+    goto cleanup;
+  }
+
+  if (NULL == (dec = (uchar *) malloc(PNG_IMAGE_SIZE(pimg)))) {
+    printf("    can't allocate decoded image\n");
+    goto cleanup;
+  }
+  if (!png_image_finish_read(&pimg, NULL, dec, 0, NULL)) {
+    printf("    libpng can't read: %s\n", pimg.message);
+    goto cleanup;
+  }
+
+  if (0 <= (bad = compare(img, plane, dec))) {
+    printf("    pixel %ld,%ld differs\n", bad % img->ncol, bad / img->ncol);
+    goto cleanup;
+  }
+
+  failed = 0;
+
+ cleanup:
+  png_image_free(&pimg);
+  free(dec);
+
+  return failed;
+}
+
+/***
+    run_image:  Round-trip an image in each plane with the compression
+                settings given, on a shared pool of the size given.
+    args:       img - image to write
+                nthread - threads in the shared pool
+                opts - settings to try
+                nopts - number of settings
+                buf - buffer to write into, reused between calls
+                bufsz - size of buf
+    returns:   number of round trips that failed, < 0 if the pool can't
+               be set
+    modifies:  buf, bufsz, the shared thread pool
+***/
+static int run_image(_rgbimage *img, int nthread, const pngopts *opts,
+                     int nopts, uchar **buf, size_t *bufsz) {
+  int nfail;                            /* round trips that failed */
+  int nbad;                             /* of those, for this plane */
+  int p, o;                             /* plane, setting */
+  int retval;
+
+  nfail = 0;
+
+  retval = thrpool_setshared(nthread);
+  if (retval < 0) {
+    return retval;
+  }
+
+  for (p=0; p<(int) (sizeof(planes) / sizeof(planes[0])); p++) {
+    nbad = 0;
+    for (o=0; o<nopts; o++) {
+      if (round_trip(img, planes[p], &opts[o], buf, bufsz)) {
+        printf("FAIL  level %d strategy %d filters 0x%02x\n",
+               opts[o].level, opts[o].strategy, opts[o].filters);
+        nbad++;
+      }
+    }
+    printf("%-4s  %4d x %5d  %d thread%s  %2d of %d settings ok\n",
+           planenm[p], img->ncol, img->nrow, nthread,
+           (1 == nthread) ? " " : "s", nopts - nbad, nopts);
+    nfail += nbad;
+  }
+
+  return nfail;
+}
+
+/***
+    read_file:  Load a whole file into a buffer.
+    args:       fname - file to read
+                buf - buffer to fill, reused between calls
+                bufsz - size of buf
+                nbuf - bytes read
+    returns:   0 if successful, 1 if not
+    modifies:  buf, bufsz, nbuf
+***/
+static int read_file(const char *fname, uchar **buf, size_t *bufsz,
+                     size_t *nbuf) {
+  FILE *fin;                            /* file being read */
+  uchar *bigger;                        /* buffer after growing */
+  size_t n;                             /* bytes from one read */
+
+  if (NULL == (fin = fopen(fname, "rb"))) {
+    return 1;
+  }
+
+  *nbuf = 0;
+  while (1) {
+    if (*bufsz == *nbuf) {
+      bigger = (uchar *) realloc(*buf, (0 == *bufsz) ? 65536 : 2 * *bufsz);
+      if (NULL == bigger) {
+        fclose(fin);
+        return 1;
+      }
+      *buf = bigger;
+      *bufsz = (0 == *bufsz) ? 65536 : 2 * *bufsz;
+    }
+    if (0 == (n = fread(*buf + *nbuf, 1, *bufsz - *nbuf, fin))) {
+      break;
+    }
+    *nbuf += n;
+  }
+
+  fclose(fin);
+  return 0;
+}
+
+/***
+    same_bytes:  Write an image into memory without a codec context, and
+                 to a file with one, checking the two are identical.
+    args:        ctx - context to write the file with
+                 fname - file to write
+                 img - image to write
+                 opts - how to compress
+                 buf, bufsz - buffer for the image in memory
+                 back, backsz - buffer for the file read back
+    returns:   0 if the bytes match, 1 if not
+    modifies:  ctx, buf, bufsz, back, backsz, the file
+***/
+static int same_bytes(pngctx *ctx, const char *fname, _rgbimage *img,
+                      const pngopts *opts, uchar **buf, size_t *bufsz,
+                      uchar **back, size_t *backsz) {
+  size_t nbuf;                          /* bytes of PNG in memory */
+  size_t nback;                         /* bytes of PNG in the file */
+
+  if ((PNG_write_mem_opts(buf, bufsz, &nbuf, img, CLR_RGB, opts) < 0) ||
+      (PNG_write_opts(ctx, fname, img, CLR_RGB, opts) < 0)) {
+    printf("    can't write: %s\n", img_errmsg());
+    return 1;
+  }
+  if (read_file(fname, back, backsz, &nback)) {
+    printf("    can't read back %s\n", fname);
+    return 1;
+  }
+  if ((nbuf != nback) || (0 != memcmp(*buf, *back, nbuf))) {
+    printf("    %zu bytes with a context, %zu without\n", nback, nbuf);
+    return 1;
+  }
+
+  return 0;
+}
+
+/***
+    run_same:  Check writing with a kept context gives the same bytes as
+               without, for each setting in turn through the one context
+               so its strips' deflate state is both reset and remade, and
+               that with the parallel writer off, a larger pool gives
+               libpng's bytes.
+    args:      img - image to write
+               opts - settings to try
+               nopts - number of settings
+               buf, bufsz - buffer for the image in memory
+    returns:   number of checks that failed, < 0 if the pool or context
+               can't be set up
+    modifies:  buf, bufsz, the shared thread pool, the parallel writer
+***/
+static int run_same(_rgbimage *img, const pngopts *opts, int nopts,
+                    uchar **buf, size_t *bufsz) {
+  char fname[32];                       /* scratch file */
+  pngctx *ctx;                          /* context kept between writes */
+  uchar *back;                          /* file read back */
+  size_t backsz;                        /* size of back */
+  int nfail;                            /* checks that failed */
+  size_t nbuf;                          /* bytes of PNG in memory */
+  size_t nback;                         /* bytes of PNG in the file */
+  int fd;                               /* scratch file descriptor */
+  int o;                                /* setting */
+  int retval;
+
+  ctx = NULL;
+  back = NULL;
+  backsz = 0;
+  nfail = 0;
+
+  strcpy(fname, "/tmp/test_png_parXXXXXX");
+  if ((fd = mkstemp(fname)) < 0) {
+    return img_error(IMGERR_IO, "can't make scratch file");
+  }
+  close(fd);
+
+  retval = PNG_ctx_create(&ctx);
+  CLEANUPONERR;
+
+  retval = thrpool_setshared(4);
+  CLEANUPONERR;
+
+  for (o=0; o<nopts; o++) {
+    if (same_bytes(ctx, fname, img, &opts[o], buf, bufsz, &back, &backsz)) {
+      printf("FAIL  level %d strategy %d filters 0x%02x\n",
+             opts[o].level, opts[o].strategy, opts[o].filters);
+      nfail++;
+    }
+  }
+  /* Back to the first, with every slot's stream made for the last. */
+  nfail += same_bytes(ctx, fname, img, &opts[0], buf, bufsz, &back, &backsz);
+  printf("RGB   %4d x %5d  context    %2d of %d settings same\n",
+         img->ncol, img->nrow, nopts + 1 - nfail, nopts + 1);
+
+  /* libpng's bytes, written on one thread with or without the switch,
+     then on four with it off. */
+  retval = thrpool_setshared(1);
+  CLEANUPONERR;
+  retval = PNG_write_opts(ctx, fname, img, CLR_RGB, &opts[0]);
+  CLEANUPONERR;
+  if (read_file(fname, &back, &backsz, &nback)) {
+    retval = img_error(IMGERR_IO, "can't read back %s", fname);
+    goto cleanup;
+  }
+  retval = thrpool_setshared(4);
+  CLEANUPONERR;
+
+  (void) PNG_setparwrite(0);
+  retval = PNG_write_mem_opts(buf, bufsz, &nbuf, img, CLR_RGB, &opts[0]);
+  (void) PNG_setparwrite(1);
+  CLEANUPONERR;
+  if ((nbuf != nback) || (0 != memcmp(*buf, back, nbuf))) {
+    printf("FAIL  parallel writer off: %zu bytes on 4 threads, %zu on 1\n",
+           nbuf, nback);
+    nfail++;
+  } else {
+    printf("ok    parallel writer off: 4 threads give libpng's bytes\n");
+  }
+
+  retval = nfail;
+
+ cleanup:
+  PNG_ctx_destroy(&ctx);
+  free(back);
+  (void) remove(fname);
+
+  return retval;
+}
+
+
+int main(void) {
+  _rgbimage *img;                       /* image with a few strips */
+  _rgbimage *tall;                      /* image with several waves */
+  pngopts opts[NOPTS];                  /* compression settings to try */
+  uchar *buf;                           /* encoded image */
+  size_t bufsz;                         /* size of buf */
+  int nfail;                            /* round trips that failed */
+  int retval;
+
+  img = tall = NULL;
+  buf = NULL;
+  bufsz = 0;
+  nfail = 0;
+
+  img_setlog(NULL, NULL);
+  opts_list(opts);
+  (void) PNG_setparwrite(1);
+
+  /* Grey, RGB, and RGBA are 2, 4, and 5 strips, with rows padded to a
+     stride wider than the image. */
+  retval = make_image(&img, 601, 2000);
+  CLEANUPONERR;
+
+  /* More strips than a wave of 2 threads holds: 10 in RGBA. */
+  retval = make_image(&tall, 256, 10000);
+  CLEANUPONERR;
+
+  /* Every setting in parallel, then the defaults (the first setting)
+     through libpng's writer and with fewer threads. */
+  retval = run_image(img, 4, opts, NOPTS, &buf, &bufsz);
+  CLEANUPONERR;
+  nfail += retval;
+
+  retval = run_image(img, 1, opts, 1, &buf, &bufsz);
+  CLEANUPONERR;
+  nfail += retval;
+
+  retval = run_image(img, 2, opts, 1, &buf, &bufsz);
+  CLEANUPONERR;
+  nfail += retval;
+
+  retval = run_image(tall, 2, opts, 1, &buf, &bufsz);
+  CLEANUPONERR;
+  nfail += retval;
+
+  retval = run_same(img, opts, NOPTS, &buf, &bufsz);
+  CLEANUPONERR;
+  nfail += retval;
+
+  printf("\n%d check%s failed\n", nfail, (1 == nfail) ? "" : "s");
+  retval = (0 == nfail) ? 0 : 1;
+
+ cleanup:
+  if (retval < 0) {
+    printf("test_png_par: %s\n", img_errmsg());
+    retval = 1;
+  }
+  free(buf);
+  free_rgbimage(&tall);
+  free_rgbimage(&img);
+
+  return retval;
+}
@@ -0,0 +1,370 @@
+
+/*****
+      test_png_pipe.c -
+      Test program for the pipelined PNG decode.  Writes large grey and
+      RGB images into memory with libpng itself, forcing each of the five
+      row filters in turn and then letting libpng choose, with the image
+      data (IDAT) in one chunk, in libpng's usual 8K chunks, and in
+      hundreds of tiny ones.  Each is read back with PNG_read_mem with the
+      pipeline on (PNG_setpipeline(1)) and off, and the planes compared
+      to each other and to the image written.  Prints a line per case and
+      exits with 1 if any failed.
+
+      Call:
+        test_png_pipe
+
+      @parthsarthiprasad
+*****/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <png.h>
+
+#include "img_png_v3.h"
+#include "img_err.h"
+
+
+/**** Macros ****/
+
+/***
+    CLEANUPONERR:  If the previous function call returned an error code (< 0),
+                   jump to the end of the function to clean up any locally
+                   allocated storage.  Assumes the error code has been assigned
+                   to a local variable 'retval' and that there is a label
+                   'cleanup' to jump to.
+***/
+#define CLEANUPONERR   { if (retval < 0) { goto cleanup; }}
+
+/***
+    NCOL, NROW:  Size of the test image, over the pipeline's 1 MB of
+                 filtered rows (PNG_PIPEBYTES) even in grey.  An odd width
+                 puts pixels across the ends of the inflated batches.
+***/
+#define NCOL         701
+#define NROW         1600
+
+
+/**** Data ****/
+
+/* a PNG being written into memory */
+typedef struct {
+  uchar *buf;                           /* encoded image */
+  size_t bufsz;                         /* size of buf */
+  size_t nbuf;                          /* bytes of buf used */
+} membuf;
+
+/* filters forced, and the names to print for them */
+static const int filters[] = {
+  PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG,
+  PNG_FILTER_PAETH, PNG_ALL_FILTERS
+};
+static const char *filternm[] = { "none", "sub", "up", "avg", "paeth", "all" };
+
+/* libpng's compression buffer sizes, each the most IDAT data per chunk,
+   and the names to print for them */
+static const size_t idatsz[] = { 4 * NCOL * NROW, 8192, 256 };
+static const char *idatnm[] = { "one IDAT", "8K IDATs", "tiny IDATs" };
+
+
+/**** Program ****/
+
+/***
+    write_mem:  libpng write function appending to a membuf.
+    args:       ptr - PNG being written, with the membuf as its I/O pointer
+                data - bytes to add
+                len - number of bytes
+    modifies:  I/O pointer's buffer
+***/
+static void write_mem(png_structp ptr, png_bytep data, png_size_t len) {
+  membuf *mb;                           /* buffer being written */
+  uchar *newbuf;                        /* buffer after growing */
+  size_t newsz;                         /* size of newbuf */
+
+  mb = (membuf *) png_get_io_ptr(ptr);
+  if ((mb->bufsz - mb->nbuf) < len) {
+    newsz = (0 == mb->bufsz) ? 65536 : mb->bufsz;
+    while ((newsz - mb->nbuf) < len) {
+      newsz *= 2;
+    }
+    if (NULL == (newbuf = (uchar *) realloc(mb->buf, newsz))) {
+      png_error(ptr, "can't grow output buffer");
+    }
+    mb->buf = newbuf;
+    mb->bufsz = newsz;
+  }
+
+  memcpy(mb->buf + mb->nbuf, data, len);
+  mb->nbuf += len;
+}
+
+/***
+    flush_mem:  libpng flush function for a membuf, which has nothing to do.
+    args:       ptr - PNG being written
+***/
+static void flush_mem(png_structp ptr) {
+
+  (void) ptr;
+}
+
+/***
+    make_image:  Allocate an image and fill it with ramps and some noise,
+                 the same in each plane for grey, so every filter has
+                 something to do.
+    args:        img - image to make
+                 grey - true to make r, g, and b the same
+    returns:   0 if successful
+               < 0 on failure (value depends on error)
+    modifies:  img
+***/
+static int make_image(_rgbimage **img, int grey) {
+  unsigned int seed;                    /* noise generator state */
+  size_t xy;                            /* index of pixel */
+  int x, y;                             /* pixel coordinates */
+  int retval;
+
+  retval = alloc_rgbimage(img, NCOL, NROW);
+  if (retval < 0) {
+    return retval;
+  }
+
+  seed = 4321;
+  for (y=0; y<NROW; y++) {
+    xy = (size_t) y * (*img)->stride;
+    for (x=0; x<NCOL; x++, xy++) {
+      seed = (seed * 1103515245) + 12345;
+      (*img)->r[xy] = (uchar) ((x + (y * 3)) ^ ((seed >> 16) & 0x07));
+      (*img)->g[xy] = grey ? (*img)->r[xy] : (uchar) ((x * y) >> 5);
+      (*img)->b[xy] = grey ? (*img)->r[xy] : (uchar) (255 - y - x / 2);
+    }
+  }
+
+  return 0;
+}
+
+/***
+    write_png:  Encode an image with libpng, with the filter and chunk size
+                given.
+    args:       img - image to write
+                grey - true to write grey (the r plane), false for RGB
+                filter - PNG_FILTER_* allowed
+                zbufsz - libpng's compression buffer size, the largest
+                         IDAT chunk
+                mb - buffer to write into, emptied first
+    returns:   0 if successful
+               < 0 on failure
+    modifies:  mb
+***/
+static int write_png(_rgbimage *img, int grey, int filter, size_t zbufsz,
+                     membuf *mb) {
+  png_structp ptr;                      /* internal reference to PNG data */
+  png_infop info;                       /* picture information */
+  png_byte *row;                        /* interleaved row to write */
+  size_t xy;                            /* index of pixel */
+  int x, y;                             /* pixel coordinates */
+  int retval;
+
+  ptr = NULL;
+  info = NULL;
+  row = NULL;
+  mb->nbuf = 0;
+
+  ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if ((NULL == ptr) || (NULL == (info = png_create_info_struct(ptr)))) {
+    retval = IMGERR_NOMEM;
+    goto cleanup;
+  }
+  if (NULL == (row = (png_byte *) malloc(3 * (size_t) img->ncol))) {
+    retval = IMGERR_NOMEM;
+    goto cleanup;
+  }
+  if (setjmp(png_jmpbuf(ptr))) {
+    retval = IMGERR_CODEC;
+    goto cleanup;
+  }
+
+  png_set_write_fn(ptr, mb, write_mem, flush_mem);
+  png_set_filter(ptr, PNG_FILTER_TYPE_BASE, filter);
+  png_set_compression_buffer_size(ptr, zbufsz);
+  png_set_IHDR(ptr, info, img->ncol, img->nrow, 8,
+               grey ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(ptr, info);
+
+  for (y=0; y<img->nrow; y++) {
+    xy = (size_t) y * img->stride;
+    if (grey) {
+      png_write_row(ptr, img->r + xy);
+      continue;
+    }
+    for (x=0; x<img->ncol; x++, xy++) {
+      row[3 * x] = img->r[xy];
+      row[(3 * x) + 1] = img->g[xy];
+      row[(3 * x) + 2] = img->b[xy];
+    }
+    png_write_row(ptr, row);
+  }
+  png_write_end(ptr, info);
+
+  retval = 0;
+
+ cleanup:
+  png_destroy_write_struct(&ptr, &info);
+  free(row);
+
+  return retval;
+}
+
+/***
+    count_idat:  Count the image data chunks in a PNG.
+    args:        mb - buffer holding PNG
+    returns:   number of IDAT chunks
+***/
+static int count_idat(const membuf *mb) {
+  size_t pos;                           /* offset of a chunk */
+  size_t clen;                          /* bytes of its data */
+  int n;                                /* chunks seen */
+
+  n = 0;
+  for (pos=8; pos+12<=mb->nbuf; pos+=12+clen) {
+    clen = ((size_t) mb->buf[pos] << 24) | (mb->buf[pos + 1] << 16) |
+      (mb->buf[pos + 2] << 8) | mb->buf[pos + 3];
+    if (0 == memcmp(mb->buf + pos + 4, "IDAT", 4)) {
+      n++;
+    }
+  }
+
+  return n;
+}
+
+/***
+    same_planes:  Check two images hold the same pixels.
+    args:         a, b - images to compare
+    returns:   true if size and r, g, b planes match, 0 if not
+***/
+static int same_planes(const _rgbimage *a, const _rgbimage *b) {
+  size_t xya, xyb;                      /* indices of row start */
+  int y;                                /* row */
+
+  if ((a->ncol != b->ncol) || (a->nrow != b->nrow) ||
+      (a->cspace != b->cspace) || ((NULL == a->a) != (NULL == b->a))) {
+    return 0;
+  }
+
+  for (y=0; y<a->nrow; y++) {
+    xya = (size_t) y * a->stride;
+    xyb = (size_t) y * b->stride;
+    if ((0 != memcmp(a->r + xya, b->r + xyb, a->ncol)) ||
+        (0 != memcmp(a->g + xya, b->g + xyb, a->ncol)) ||
+        (0 != memcmp(a->b + xya, b->b + xyb, a->ncol))) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+/***
+    check_case:  Decode a PNG with the pipeline on and off and compare the
+                 results to each other and to the image written.
+    args:        what - description of the case
+                 mb - buffer holding PNG
+                 img - image written
+    returns:   0 if the case passed, 1 if not
+***/
+static int check_case(const char *what, const membuf *mb, _rgbimage *img) {
+  _rgbimage *piped;                     /* decoded with the pipeline */
+  _rgbimage *plain;                     /* decoded without */
+  int nidat;                            /* IDAT chunks in PNG */
+  int failed;                           /* true if check failed */
+
+  piped = plain = NULL;
+  failed = 1;
+
+  (void) PNG_setpipeline(1);
+  if (PNG_read_mem(mb->buf, mb->nbuf, &piped) < 0) {
+    printf("FAIL  %s:  pipelined, %s\n", what, img_errmsg());
+    goto cleanup;
+  }
+  (void) PNG_setpipeline(0);
+  if (PNG_read_mem(mb->buf, mb->nbuf, &plain) < 0) {
+    printf("FAIL  %s:  not pipelined, %s\n", what, img_errmsg());
+    goto cleanup;
+  }
+
+  if (!same_planes(piped, plain)) {
+    printf("FAIL  %s:  pipelined and plain decodes differ\n", what);
+    goto cleanup;
+  }
+  if (!same_planes(plain, img)) {
+    printf("FAIL  %s:  decode differs from image written\n", what);
+    goto cleanup;
+  }
+
+  nidat = count_idat(mb);
+  printf("ok    %-28s %5d IDAT chunk%s\n", what, nidat,
+         (1 == nidat) ? "" : "s");
+  failed = 0;
+
+ cleanup:
+  (void) PNG_setpipeline(0);
+  free_rgbimage(&plain);
+  free_rgbimage(&piped);
+
+  return failed;
+}
+
+
+int main(void) {
+  _rgbimage *img;                       /* image to write */
+  membuf mb;                            /* encoded image */
+  char what[64];                        /* description of case */
+  int grey;                             /* true for the grey image */
+  int f, z;                             /* filter, IDAT size */
+  int nfail;                            /* cases that failed */
+  int retval;
+
+  img = NULL;
+  memset(&mb, 0, sizeof(mb));
+  nfail = 0;
+  retval = 0;
+
+  img_setlog(NULL, NULL);
+
+  for (grey=1; 0<=grey; grey--) {
+    free_rgbimage(&img);
+    retval = make_image(&img, grey);
+    CLEANUPONERR;
+
+    /* Each filter with libpng's usual chunks, then every filter with
+       one chunk and with tiny ones. */
+    for (f=0; f<(int) (sizeof(filters) / sizeof(filters[0])); f++) {
+      for (z=0; z<(int) (sizeof(idatsz) / sizeof(idatsz[0])); z++) {
+        if ((1 != z) && (PNG_ALL_FILTERS != filters[f])) {
+          continue;
+        }
+        retval = write_png(img, grey, filters[f], idatsz[z], &mb);
+        if (retval < 0) {
+          printf("test_png_pipe: libpng can't write test image\n");
+          goto cleanup;
+        }
+        snprintf(what, sizeof(what), "%s, %s, %s", grey ? "grey" : "RGB",
+                 filternm[f], idatnm[z]);
+        nfail += check_case(what, &mb, img);
+      }
+    }
+  }
+
+  printf("\n%d case%s failed\n", nfail, (1 == nfail) ? "" : "s");
+  retval = (0 == nfail) ? 0 : 1;
+
+ cleanup:
+  if (retval < 0) {
+    retval = 1;
+  }
+  free(mb.buf);
+  free_rgbimage(&img);
+
+  return retval;
+}